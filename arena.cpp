@@ -0,0 +1,102 @@
+/*****************************************
+ *
+ *           Arena.cpp
+ *
+ *  In debug builds every rewind fills the
+ *  freed bytes with 0xCD, and every time
+ *  a block grows it says by how much.
+ *
+ ****************************************/
+
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Arena::Arena(const char* name, size_t capacity) : name(name), capacity(capacity), used(0), highWater(0), overflowBytes(0)
+{
+	block = (char*)malloc(capacity);
+}
+
+Arena::~Arena()
+{
+	for (size_t i = 0; i < overflow.size(); i++)
+		free(overflow[i]);
+	free(block);
+}
+
+Arena& Arena::Frame()
+{
+	static Arena frame("frame", 1 << 20);
+	return frame;
+}
+
+Arena& Arena::Scratch()
+{
+	static Arena scratch("scratch", 4 << 20);
+	return scratch;
+}
+
+void* Arena::Allocate(size_t bytes, size_t alignment)
+{
+	size_t start = (used + alignment - 1) & ~(alignment - 1);
+	if (start + bytes <= capacity)
+	{
+		used = start + bytes;
+		if (Used() > highWater)
+			highWater = Used();
+		return block + start;
+	}
+
+	// Out of block. malloc only promises 16 byte alignment, anything more is rounded up by hand
+	char* memory = (char*)malloc(bytes + alignment);
+	overflow.push_back(memory);
+	overflowBytes += bytes + alignment;
+	if (Used() > highWater)
+		highWater = Used();
+	return (void*)(((size_t)memory + alignment - 1) & ~(alignment - 1));
+}
+
+Arena::Marker Arena::Mark() const
+{
+	Marker marker = { used, overflow.size(), overflowBytes };
+	return marker;
+}
+
+void Arena::Rewind(const Marker& marker)
+{
+#ifdef _DEBUG
+	memset(block + marker.used, 0xCD, used - marker.used);
+#endif
+
+	while (overflow.size() > marker.overflowCount)
+	{
+		free(overflow.back());
+		overflow.pop_back();
+	}
+	used = marker.used;
+	overflowBytes = marker.overflowBytes;
+
+	// Empty again, so the block can be swapped for one that holds everything the last run needed
+	if (used == 0 && highWater > capacity)
+	{
+		size_t grown = capacity;
+		while (grown < highWater)
+			grown += grown / 2;
+
+#ifdef _DEBUG
+		printf("%s arena grown from %u KB to %u KB, high water %u KB\n", name,
+			(unsigned int)(capacity >> 10), (unsigned int)(grown >> 10), (unsigned int)(highWater >> 10));
+#endif
+
+		free(block);
+		block = (char*)malloc(grown);
+		capacity = grown;
+	}
+}
+
+void Arena::Reset()
+{
+	Rewind(Marker());
+}
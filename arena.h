@@ -0,0 +1,99 @@
+/**************************************************
+ *
+ *                 Arena.h
+ *
+ *  Bump allocators. The frame arena is emptied at
+ *  the top of every frame, scratch scopes give the
+ *  scratch arena back when they close. Nothing is
+ *  freed one allocation at a time.
+ *
+ ***************************************************/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <vector>
+
+// One thread only. Running past the block mallocs the overflow on its own, and the next time the arena
+// empties the block grows to the high-water mark, so a steady workload stops calling malloc after a frame
+class Arena
+{
+public:
+    Arena(const char* name, size_t capacity);
+    ~Arena();
+
+    void* Allocate(size_t bytes, size_t alignment = 16);
+
+    struct Marker
+    {
+        size_t used;
+        size_t overflowCount;
+        size_t overflowBytes;
+    };
+    Marker Mark() const;
+    void Rewind(const Marker& marker);
+    void Reset();
+
+    size_t Used() const { return used + overflowBytes; }
+    size_t HighWater() const { return highWater; }
+    size_t Capacity() const { return capacity; }
+
+    // Emptied by the main loop before Update(), for anything that only lives until the frame's drawn
+    static Arena& Frame();
+
+    // For load time work, use it through a ScratchScope
+    static Arena& Scratch();
+
+private:
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    const char* name;
+    char* block;
+    size_t capacity, used, highWater;
+    std::vector<void*> overflow;
+    size_t overflowBytes;
+};
+
+// Everything allocated from the arena while the scope is open goes when it closes
+class ScratchScope
+{
+public:
+    explicit ScratchScope(Arena& arena = Arena::Scratch()) : arena(arena), marker(arena.Mark()) {}
+    ~ScratchScope() { arena.Rewind(marker); }
+
+private:
+    ScratchScope(const ScratchScope&);
+    ScratchScope& operator=(const ScratchScope&);
+
+    Arena& arena;
+    Arena::Marker marker;
+};
+
+// Lets the standard containers take their storage from an arena. Deallocation does nothing, the
+// memory comes back when the arena is reset or rewound, so containers mustn't outlive that
+template <class T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    ArenaAllocator(Arena& arena) : arena(&arena) {}
+    template <class U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return (T*)arena->Allocate(n * sizeof(T), alignof(T) > 16 ? alignof(T) : 16); }
+    void deallocate(T*, size_t) {}
+
+    template <class U> bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <class U> bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+private:
+    template <class U> friend class ArenaAllocator;
+    Arena* arena;
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+#endif
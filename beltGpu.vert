@@ -0,0 +1,24 @@
+#version 430
+
+// Written by beltUpdate.comp, one point per body
+layout (std430, binding = 1) readonly buffer Positions
+{
+	vec4 positions[];
+};
+
+out float brightness;
+
+uniform mat4 view;
+uniform mat4 proj;
+uniform float pointSize;
+
+void main()
+{
+	vec4 viewPosition = view * positions[gl_VertexID];
+	gl_Position = proj * viewPosition;
+
+	// Shrink with distance, but never below a pixel so far away belts don't vanish
+	float size = pointSize * 100.0f / max(-viewPosition.z, 1.0f);
+	gl_PointSize = max(size, 1.0f);
+	brightness = clamp(size, 0.25f, 1.0f);
+}
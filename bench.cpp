@@ -0,0 +1,406 @@
+/*****************************************
+ *
+ *           Bench.cpp
+ *
+ *  The runner, the allocation counter and
+ *  the cases that stand on their own. The
+ *  Update() cases need the app's globals
+ *  and are added from main.cpp.
+ *
+ ****************************************/
+
+#include "bench.h"
+#include "mesh.h"
+#include "simulation.h"
+#include "arena.h"
+
+#include <SOIL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <random>
+#include <algorithm>
+
+//------------------------------------------------------------------------------------------------ Allocations
+
+// Every operator new in the process goes through here. Relaxed adds, so outside a benchmark it costs next to nothing
+static std::atomic<long long> heapAllocations(0);
+static std::atomic<long long> heapBytes(0);
+
+void* operator new(size_t size)
+{
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	heapBytes.fetch_add((long long)size, std::memory_order_relaxed);
+
+	void* memory = malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+
+long long BenchmarkRunner::Allocations()
+{
+	return heapAllocations.load(std::memory_order_relaxed);
+}
+
+long long BenchmarkRunner::AllocatedBytes()
+{
+	return heapBytes.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------------------------ State
+
+BenchState::BenchState(long long iterations)
+	: iterations(iterations), remaining(iterations), started(false), timing(false)
+{
+	allocationsAtStart = bytesAtStart = 0;
+	seconds = 0.0;
+	allocations = allocatedBytes = 0;
+	itemsProcessed = bytesProcessed = 0;
+}
+
+bool BenchState::KeepRunning()
+{
+	if (!started)
+	{
+		started = true;
+		ResumeTiming();
+	}
+	if (remaining-- > 0)
+		return true;
+
+	PauseTiming();
+	return false;
+}
+
+void BenchState::PauseTiming()
+{
+	if (!timing)
+		return;
+	timing = false;
+	seconds += std::chrono::duration<double>(Clock::now() - start).count();
+	allocations += BenchmarkRunner::Allocations() - allocationsAtStart;
+	allocatedBytes += BenchmarkRunner::AllocatedBytes() - bytesAtStart;
+}
+
+void BenchState::ResumeTiming()
+{
+	if (timing)
+		return;
+	timing = true;
+	allocationsAtStart = BenchmarkRunner::Allocations();
+	bytesAtStart = BenchmarkRunner::AllocatedBytes();
+	start = Clock::now();                                               // <- Last, so the counters aren't timed
+}
+
+//------------------------------------------------------------------------------------------------ Runner
+
+BenchmarkRunner::BenchmarkRunner()
+{
+	minSeconds = 0.5;
+}
+
+void BenchmarkRunner::Add(const std::string& name, const Case& run)
+{
+	Entry entry;
+	entry.name = name;
+	entry.run = run;
+	cases.push_back(entry);
+}
+
+void BenchmarkRunner::Run(const std::string& filter)
+{
+	printf("%-36s %14s %12s %14s %12s %12s\n", "Benchmark", "Time", "Iterations", "Items/s", "MB/s", "Allocs/iter");
+
+	for (size_t c = 0; c < cases.size(); c++)
+	{
+		const Entry& entry = cases[c];
+		if (!filter.empty() && entry.name.find(filter) == std::string::npos)
+			continue;
+
+		// Same growth as Google Benchmark: aim 40% past the minimum from the last run, but never more than 10x at once
+		long long iterations = 1;
+		for (;;)
+		{
+			BenchState state(iterations);
+			entry.run(state);
+
+			if (state.error.empty() && state.seconds < minSeconds && iterations < maxIterations)
+			{
+				double multiplier = state.seconds > minSeconds * 0.1 ? minSeconds * 1.4 / state.seconds : 10.0;
+				long long next = (long long)(iterations * std::min(multiplier, 10.0));
+				iterations = std::min(std::max(next, iterations + 1), maxIterations);
+				continue;
+			}
+
+			Result result;
+			result.name = entry.name;
+			result.iterations = state.iterations;
+			result.nanoseconds = state.seconds * 1e9 / state.iterations;
+			result.itemsPerSecond = state.seconds > 0.0 ? state.itemsProcessed / state.seconds : 0.0;
+			result.bytesPerSecond = state.seconds > 0.0 ? state.bytesProcessed / state.seconds : 0.0;
+			result.allocations = (double)state.allocations / state.iterations;
+			result.allocatedBytes = (double)state.allocatedBytes / state.iterations;
+			result.error = state.error;
+			results.push_back(result);
+
+			if (!result.error.empty())
+				printf("%-36s ERROR: %s\n", result.name.c_str(), result.error.c_str());
+			else
+				printf("%-36s %11.0f ns %12lld %14.4g %12.1f %12.1f\n", result.name.c_str(), result.nanoseconds, result.iterations,
+					result.itemsPerSecond, result.bytesPerSecond / (1024.0 * 1024.0), result.allocations);
+			break;
+		}
+	}
+}
+
+static void WriteJsonString(FILE* file, const char* text)
+{
+	fputc('"', file);
+	for (const char* c = text; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')
+			fprintf(file, "\\%c", *c);
+		else if ((unsigned char)*c < 0x20)
+			fprintf(file, "\\u%04x", (unsigned char)*c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+bool BenchmarkRunner::WriteJSON(const char* path, const char* renderer) const
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+	{
+		printf("can't write benchmark results: %s\n", path);
+		return false;
+	}
+
+	char date[64];
+	time_t now = time(0);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+#if defined(_DEBUG) || !defined(NDEBUG)
+	const char* buildType = "debug";
+#else
+	const char* buildType = "release";
+#endif
+
+	fprintf(file, "{\n  \"context\": {\n    \"date\": \"%s\",\n    \"num_cpus\": %u,\n    \"renderer\": ", date, std::thread::hardware_concurrency());
+	WriteJsonString(file, renderer ? renderer : "");
+	fprintf(file, ",\n    \"library_build_type\": \"%s\"\n  },\n  \"benchmarks\": [", buildType);
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result& result = results[i];
+		fprintf(file, "%s\n    {\n      \"name\": ", i ? "," : "");
+		WriteJsonString(file, result.name.c_str());
+		fprintf(file, ",\n      \"run_name\": ");
+		WriteJsonString(file, result.name.c_str());
+		fprintf(file, ",\n      \"run_type\": \"iteration\",\n      \"iterations\": %lld", result.iterations);
+
+		if (!result.error.empty())
+		{
+			fprintf(file, ",\n      \"error_occurred\": true,\n      \"error_message\": ");
+			WriteJsonString(file, result.error.c_str());
+			fprintf(file, "\n    }");
+			continue;
+		}
+
+		fprintf(file, ",\n      \"real_time\": %.3f,\n      \"time_unit\": \"ns\"", result.nanoseconds);
+		if (result.itemsPerSecond > 0.0)
+			fprintf(file, ",\n      \"items_per_second\": %.6e", result.itemsPerSecond);
+		if (result.bytesPerSecond > 0.0)
+			fprintf(file, ",\n      \"bytes_per_second\": %.6e", result.bytesPerSecond);
+		fprintf(file, ",\n      \"allocs_per_iter\": %.3f,\n      \"alloc_bytes_per_iter\": %.1f\n    }", result.allocations, result.allocatedBytes);
+	}
+
+	fprintf(file, "\n  ]\n}\n");
+	fclose(file);
+	printf("wrote %d benchmark results to %s\n", (int)results.size(), path);
+	return true;
+}
+
+//------------------------------------------------------------------------------------------------ Cases
+
+// Keeps the compiler from dropping work whose result nobody reads
+static volatile float sink;
+
+static void BuildSphereCase(BenchState& state, int nbLong, int nbLat)
+{
+	unsigned int vertices = 0;
+	while (state.KeepRunning())
+	{
+		ScratchScope scratch;
+		ArenaVector<float> interleavedVBO(Arena::Scratch());
+		vertices = Primitive::BuildSphere(nbLong, nbLat, interleavedVBO);
+		sink = interleavedVBO[0];
+	}
+	state.SetItemsProcessed(state.Iterations() * (vertices / 3));           // <- Triangles
+	state.SetBytesProcessed(state.Iterations() * vertices * 8 * (long long)sizeof(float));
+}
+
+// Unindexed, so every corner is its own v, vt and vn line. Returns the file's size, 0 if it couldn't be written
+static long WriteSphereOBJ(const char* path, int nbLong, int nbLat, unsigned int& vertices)
+{
+	ScratchScope scratch;
+	ArenaVector<float> sphere(Arena::Scratch());
+	vertices = Primitive::BuildSphere(nbLong, nbLat, sphere);
+
+	FILE* file = fopen(path, "w");
+	if (!file)
+		return 0;
+
+	fprintf(file, "# %d x %d sphere\no sphere\n", nbLong, nbLat);
+	for (unsigned int v = 0; v < vertices; v++)
+	{
+		const float* corner = &sphere[v * 8];
+		fprintf(file, "v %f %f %f\nvn %f %f %f\nvt %f %f\n", corner[0], corner[1], corner[2], corner[3], corner[4], corner[5], corner[6], corner[7]);
+	}
+	for (unsigned int v = 1; v + 2 <= vertices; v += 3)
+		fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", v, v, v, v + 1, v + 1, v + 1, v + 2, v + 2, v + 2);
+
+	long bytes = ftell(file);
+	fclose(file);
+	return bytes;
+}
+
+static void LoadOBJCase(BenchState& state, const char* fileName, int nbLong, int nbLat)
+{
+	// There are no OBJs in the tree, so the case writes its own and deletes it after
+	unsigned int vertices = 0;
+	long bytes = WriteSphereOBJ(fileName, nbLong, nbLat, vertices);
+	if (bytes == 0)
+	{
+		state.SkipWithError("can't write the OBJ to the working directory");
+		return;
+	}
+
+	while (state.KeepRunning())
+	{
+		std::vector<Mesh> meshes = Mesh::LoadOBJ("", fileName);
+		sink = (float)meshes.size();
+	}
+	state.SetItemsProcessed(state.Iterations() * vertices);
+	state.SetBytesProcessed(state.Iterations() * bytes);
+
+	remove(fileName);
+}
+
+static void TextureDecodeCase(BenchState& state, const char* path)
+{
+	// Straight from memory, so the disk doesn't end up in the numbers
+	std::vector<unsigned char> file;
+	if (FILE* in = fopen(path, "rb"))
+	{
+		fseek(in, 0, SEEK_END);
+		file.resize(ftell(in));
+		fseek(in, 0, SEEK_SET);
+		if (file.empty() || fread(&file[0], 1, file.size(), in) != file.size())
+			file.clear();
+		fclose(in);
+	}
+	if (file.empty())
+	{
+		state.SkipWithError("can't read the texture");
+		return;
+	}
+
+	long long pixels = 0;
+	while (state.KeepRunning())
+	{
+		int w = 0, h = 0, channels = 0;
+		unsigned char* data = SOIL_load_image_from_memory(&file[0], (int)file.size(), &w, &h, &channels, SOIL_LOAD_AUTO);
+		if (data)
+		{
+			pixels = (long long)w * h;
+			sink = data[0];
+			SOIL_free_image_data(data);
+		}
+	}
+	state.SetItemsProcessed(state.Iterations() * pixels);
+	state.SetBytesProcessed(state.Iterations() * (long long)file.size());
+}
+
+static void CollideCase(BenchState& state)
+{
+	// Asteroids over the same square the launches come from, across a year of planet positions
+	static const int stateCount = 256;
+	Simulation simulation;
+	std::vector<SimState> states(stateCount);
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> across(-50.0f, 50.0f);
+	for (int i = 0; i < stateCount; i++)
+	{
+		states[i] = SimState();
+		states[i].earthDays = 365.25 * i / stateCount;
+		states[i].asteroidLaunched = true;
+		states[i].asteroidPosition = glm::vec3(across(rng), 0.0f, across(rng));
+	}
+
+	int hits = 0;
+	long long pass = 0;
+	while (state.KeepRunning())
+	{
+		SimState s = states[pass++ & (stateCount - 1)];
+		simulation.Collide(s);
+		hits += s.destroyed[AST];
+	}
+	sink = (float)hits;
+	state.SetItemsProcessed(state.Iterations());
+}
+
+void AddLibraryBenchmarks(BenchmarkRunner& runner)
+{
+	static const int sphereSizes[][2] = { { 24, 16 }, { 64, 32 }, { 128, 64 }, { 512, 256 } };
+	for (int i = 0; i < 4; i++)
+	{
+		int nbLong = sphereSizes[i][0], nbLat = sphereSizes[i][1];
+		char name[64];
+		sprintf(name, "BM_BuildSphere/%dx%d", nbLong, nbLat);
+		runner.Add(name, [=](BenchState& state) { BuildSphereCase(state, nbLong, nbLat); });
+	}
+
+	// About 2.5 thousand, 28 thousand and 200 thousand corners
+	static const struct { const char* name; const char* file; int nbLong, nbLat; } objs[] =
+	{
+		{ "BM_LoadOBJ/small",  "bench_small.obj",   24,  16 },
+		{ "BM_LoadOBJ/medium", "bench_medium.obj",  96,  48 },
+		{ "BM_LoadOBJ/large",  "bench_large.obj",  256, 128 },
+	};
+	for (int i = 0; i < 3; i++)
+	{
+		const char* file = objs[i].file;
+		int nbLong = objs[i].nbLong, nbLat = objs[i].nbLat;
+		runner.Add(objs[i].name, [=](BenchState& state) { LoadOBJCase(state, file, nbLong, nbLat); });
+	}
+
+	static const char* textures[] =
+	{
+		"earthDiffuse.png", "earthSpecular.png", "moonTexture.png", "mercurymap.jpg", "venusTexture.jpg", "marsTexture.jpg",
+		"jupiterTexture.jpg", "saturnTexture.jpg", "uranusTexture.jpg", "neptuneTexture.jpg", "star_sky/stars.png",
+	};
+	for (int i = 0; i < (int)(sizeof(textures) / sizeof(textures[0])); i++)
+	{
+		std::string path = std::string(ASSETS"textures/") + textures[i];
+		runner.Add(std::string("BM_TextureDecode/") + textures[i], [=](BenchState& state) { TextureDecodeCase(state, path.c_str()); });
+	}
+
+	runner.Add("BM_Collide", CollideCase);
+}
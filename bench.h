@@ -0,0 +1,104 @@
+/**************************************************
+ *
+ *                 Bench.h
+ *
+ *  Microbenchmarks laid out like Google Benchmark.
+ *  A case loops on its state until the timed part
+ *  adds up, heap allocations are counted along the
+ *  way, and the results go out as JSON so runs from
+ *  different commits can be compared.
+ *
+ ***************************************************/
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+
+// Handed to a case. Only the body of while (state.KeepRunning()) is timed
+class BenchState
+{
+public:
+    bool KeepRunning();
+
+    // Per iteration setup (resets, waiting on the GPU) goes in between, it counts towards neither time nor allocations
+    void PauseTiming();
+    void ResumeTiming();
+
+    // Totals over every iteration, reported per second
+    void SetItemsProcessed(long long items) { itemsProcessed = items; }
+    void SetBytesProcessed(long long bytes) { bytesProcessed = bytes; }
+
+    // Reports the case as failed, call it before the loop and return
+    void SkipWithError(const char* message) { error = message; }
+
+    long long Iterations() const { return iterations; }
+
+private:
+    friend class BenchmarkRunner;
+    explicit BenchState(long long iterations);
+
+    typedef std::chrono::steady_clock Clock;
+
+    long long iterations, remaining;
+    bool started, timing;
+    Clock::time_point start;
+    long long allocationsAtStart, bytesAtStart;
+
+    double seconds;
+    long long allocations, allocatedBytes;
+    long long itemsProcessed, bytesProcessed;
+    std::string error;
+};
+
+class BenchmarkRunner
+{
+public:
+    typedef std::function<void(BenchState&)> Case;
+
+    BenchmarkRunner();
+
+    void Add(const std::string& name, const Case& run);
+
+    // Runs the cases with the filter somewhere in their name, all of them for an empty one, and prints a line for each
+    void Run(const std::string& filter = "");
+
+    // Google Benchmark's layout with allocations per iteration added, renderer goes in the context
+    bool WriteJSON(const char* path, const char* renderer) const;
+
+    double minSeconds;              // Iterations go up until the timed part of a run takes this long
+
+    // Everything through operator new on any thread since startup. Arenas and C libraries that malloc don't show up
+    static long long Allocations();
+    static long long AllocatedBytes();
+
+private:
+    struct Entry
+    {
+        std::string name;
+        Case run;
+    };
+
+    struct Result
+    {
+        std::string name;
+        long long iterations;
+        double nanoseconds;                         // Per iteration
+        double itemsPerSecond, bytesPerSecond;      // 0 when the case didn't say
+        double allocations, allocatedBytes;         // Per iteration
+        std::string error;
+    };
+
+    static const long long maxIterations = 1000000000;
+
+    std::vector<Entry> cases;
+    std::vector<Result> results;
+};
+
+// Cases that don't touch the app's state: building spheres, loading OBJs, decoding the textures and the asteroid's collision pass
+void AddLibraryBenchmarks(BenchmarkRunner& runner);
+
+#endif
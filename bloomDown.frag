@@ -0,0 +1,39 @@
+#version 400
+
+in vec2 texcoord;
+
+out vec4 frag_colour;
+
+uniform sampler2D sourceTex;
+uniform vec2 texelSize;	// 1 / size of the level we're reading from
+uniform float threshold;
+uniform int prefilter;	// Only set for the first pass out of the scene target
+
+// Soft knee so pixels fade into the bloom instead of popping in at the threshold
+vec3 Prefilter(vec3 colour)
+{
+	float brightness = max(colour.r, max(colour.g, colour.b));
+	float knee = threshold * 0.5f;
+	float soft = clamp(brightness - threshold + knee, 0.0f, 2.0f * knee);
+	soft = soft * soft / (4.0f * knee + 0.0001f);
+	float contribution = max(soft, brightness - threshold) / max(brightness, 0.0001f);
+	return colour * contribution;
+}
+
+void main()
+{
+	// Dual filter downsample: the centre plus the four diagonal 2x2 blocks,
+	// each fetched with a single bilinear tap
+	vec2 d = texelSize;
+	vec3 sum = texture(sourceTex, texcoord).rgb * 4.0f;
+	sum += texture(sourceTex, texcoord + vec2(-d.x, -d.y)).rgb;
+	sum += texture(sourceTex, texcoord + vec2( d.x, -d.y)).rgb;
+	sum += texture(sourceTex, texcoord + vec2(-d.x,  d.y)).rgb;
+	sum += texture(sourceTex, texcoord + vec2( d.x,  d.y)).rgb;
+
+	vec3 colour = sum / 8.0f;
+	if (prefilter != 0)
+		colour = Prefilter(colour);
+
+	frag_colour = vec4(colour, 1.0f);
+}
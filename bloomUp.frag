@@ -0,0 +1,24 @@
+#version 400
+
+in vec2 texcoord;
+
+out vec4 frag_colour;
+
+uniform sampler2D sourceTex;
+uniform vec2 texelSize;	// 1 / size of the smaller level we're reading from
+
+void main()
+{
+	// Dual filter upsample: a tent made of four edge taps and four diagonal taps
+	vec2 h = texelSize * 0.5f;
+	vec3 sum = texture(sourceTex, texcoord + vec2(-h.x * 2.0f, 0.0f)).rgb;
+	sum += texture(sourceTex, texcoord + vec2( h.x * 2.0f, 0.0f)).rgb;
+	sum += texture(sourceTex, texcoord + vec2(0.0f, -h.y * 2.0f)).rgb;
+	sum += texture(sourceTex, texcoord + vec2(0.0f,  h.y * 2.0f)).rgb;
+	sum += texture(sourceTex, texcoord + vec2(-h.x,  h.y)).rgb * 2.0f;
+	sum += texture(sourceTex, texcoord + vec2( h.x,  h.y)).rgb * 2.0f;
+	sum += texture(sourceTex, texcoord + vec2(-h.x, -h.y)).rgb * 2.0f;
+	sum += texture(sourceTex, texcoord + vec2( h.x, -h.y)).rgb * 2.0f;
+
+	frag_colour = vec4(sum / 12.0f, 1.0f);
+}
@@ -0,0 +1,431 @@
+/*****************************************
+ *
+ *           Capture.cpp
+ *
+ *  Backbuffer reads through pixel pack
+ *  buffers, fenced and mapped a few frames
+ *  later, then encoded on a writer thread.
+ *
+ ****************************************/
+
+#include "capture.h"
+#include "profiler.h"
+#include "glstate.h"
+
+#include <string.h>
+
+//------------------------------------------------------------------------------------------------ PNG
+
+// Stored deflate blocks, so no zlib. The files come out the size of the raw pixels, which is fine for frames
+// that an encoder is going to read straight back in
+
+static bool BuildCrcTable(unsigned int* table)
+{
+	for (unsigned int n = 0; n < 256; n++)
+	{
+		unsigned int c = n;
+		for (int k = 0; k < 8; k++)
+			c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+		table[n] = c;
+	}
+	return true;
+}
+
+static unsigned int Crc(unsigned int crc, const unsigned char* data, size_t size)
+{
+	static unsigned int table[256];
+	static bool built = BuildCrcTable(table);                           // <- Statics are built once even with two threads writing
+	(void)built;
+
+	for (size_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static void PutBigEndian(std::vector<unsigned char>& out, unsigned int value)
+{
+	out.push_back((unsigned char)(value >> 24));
+	out.push_back((unsigned char)(value >> 16));
+	out.push_back((unsigned char)(value >> 8));
+	out.push_back((unsigned char)value);
+}
+
+static void WriteChunk(FILE* file, const char* type, const std::vector<unsigned char>& data)
+{
+	std::vector<unsigned char> header;
+	PutBigEndian(header, (unsigned int)data.size());
+	header.insert(header.end(), type, type + 4);
+	fwrite(&header[0], 1, header.size(), file);
+	if (!data.empty())
+		fwrite(&data[0], 1, data.size(), file);
+
+	unsigned int crc = Crc(0xFFFFFFFFu, (const unsigned char*)type, 4);
+	crc = data.empty() ? crc : Crc(crc, &data[0], data.size());
+	std::vector<unsigned char> footer;
+	PutBigEndian(footer, crc ^ 0xFFFFFFFFu);
+	fwrite(&footer[0], 1, footer.size(), file);
+}
+
+bool WritePNG(const char* path, const unsigned char* rgba, int width, int height)
+{
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, 1, sizeof(signature), file);
+
+	std::vector<unsigned char> header;
+	PutBigEndian(header, width);
+	PutBigEndian(header, height);
+	unsigned char format[5] = { 8, 2, 0, 0, 0 };                        // <- 8 bit RGB, no interlace
+	header.insert(header.end(), format, format + 5);
+	WriteChunk(file, "IHDR", header);
+
+	// Rows top down with a filter byte of 0 in front, the alpha dropped
+	size_t rowBytes = (size_t)width * 3 + 1;
+	std::vector<unsigned char> raw(rowBytes * height);
+	for (int y = 0; y < height; y++)
+	{
+		const unsigned char* row = &rgba[(size_t)(height - 1 - y) * width * 4];
+		unsigned char* out = &raw[rowBytes * y];
+		out[0] = 0;
+		for (int x = 0; x < width; x++)
+		{
+			out[1 + x * 3 + 0] = row[x * 4 + 0];
+			out[1 + x * 3 + 1] = row[x * 4 + 1];
+			out[1 + x * 3 + 2] = row[x * 4 + 2];
+		}
+	}
+
+	// zlib header, stored blocks of up to 64K, adler32 of the raw data
+	std::vector<unsigned char> data;
+	data.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	data.push_back(0x78);
+	data.push_back(0x01);
+	unsigned int a = 1, b = 0;
+	size_t offset = 0;
+	do
+	{
+		size_t size = raw.size() - offset < 65535 ? raw.size() - offset : 65535;
+		bool last = offset + size == raw.size();
+		data.push_back(last ? 1 : 0);
+		data.push_back((unsigned char)size);
+		data.push_back((unsigned char)(size >> 8));
+		data.push_back((unsigned char)~size);
+		data.push_back((unsigned char)(~size >> 8));
+		data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+		for (size_t i = offset; i < offset + size; i++)
+		{
+			a = (a + raw[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		offset += size;
+	} while (offset < raw.size());
+	PutBigEndian(data, (b << 16) | a);
+	WriteChunk(file, "IDAT", data);
+
+	WriteChunk(file, "IEND", std::vector<unsigned char>());
+
+	bool ok = ferror(file) == 0;
+	fclose(file);
+	return ok;
+}
+
+//------------------------------------------------------------------------------------------------ FrameCapture
+
+FrameCapture::FrameCapture()
+{
+	head = pending = 0;
+	active = y4m = false;
+	video = 0;
+	width = height = 0;
+	framesPerSecond = 60;
+	grabbed = skipped = 0;
+	stopping = false;
+	written = 0;
+	for (int i = 0; i < ringSize; i++)
+		ring[i].fence = 0;
+}
+
+FrameCapture::~FrameCapture()
+{
+	// Stop() needs the context for the fences and buffers, by now it's gone
+	if (writer.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		writer.join();
+	}
+	if (video)
+		fclose(video);
+}
+
+bool FrameCapture::Start(const char* capturePath, int captureWidth, int captureHeight, int rate)
+{
+	Stop();
+	if (captureWidth <= 0 || captureHeight <= 0)
+		return false;
+
+	path = capturePath;
+	width = captureWidth;
+	height = captureHeight;
+	framesPerSecond = rate > 0 ? rate : 60;
+
+	size_t dot = path.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : path.substr(dot);
+	y4m = extension == ".y4m" || extension == ".Y4M";
+
+	if (y4m)
+	{
+		video = fopen(path.c_str(), "wb");
+		if (!video)
+		{
+			printf("can't open capture file: %s\n", path.c_str());
+			return false;
+		}
+		fprintf(video, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width & ~1, height & ~1, framesPerSecond);
+	}
+
+	size_t bytes = (size_t)width * height * 4;
+	for (int i = 0; i < ringSize; i++)
+	{
+		ring[i].pbo.Create(MEMORY_BUFFERS);
+		GLState::BindBuffer(GL_PIXEL_PACK_BUFFER, ring[i].pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+		ring[i].pbo.SetBytes(bytes);
+		ring[i].fence = 0;
+	}
+	GLState::BindBuffer(GL_PIXEL_PACK_BUFFER, GL_NONE);
+
+	head = pending = 0;
+	grabbed = skipped = 0;
+	written = 0;
+	stopping = false;
+	active = true;
+	writer = std::thread(&FrameCapture::Run, this);
+
+	printf("capturing %dx%d at %d fps to %s\n", width, height, framesPerSecond, path.c_str());
+	return true;
+}
+
+void FrameCapture::Grab(int frameWidth, int frameHeight)
+{
+	if (!active)
+		return;
+	PROFILE_SCOPE("Capture");
+
+	if (frameWidth != width || frameHeight != height)
+	{
+		if (skipped++ == 0)
+			printf("window is %dx%d, capture is %dx%d, skipping frames until it's back\n", frameWidth, frameHeight, width, height);
+		return;
+	}
+
+	// Every buffer still in flight, the GPU is a whole ring behind. Wait rather than drop the frame
+	if (pending == ringSize)
+		Collect(true);
+
+	Readback& slot = ring[head];
+	GLState::BindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadBuffer(GL_BACK);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);   // <- Into the buffer, returns without waiting
+	GLState::BindBuffer(GL_PIXEL_PACK_BUFFER, GL_NONE);
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	head = (head + 1) % ringSize;
+	pending++;
+	grabbed++;
+
+	Collect(false);
+}
+
+void FrameCapture::Collect(bool wait)
+{
+	size_t bytes = (size_t)width * height * 4;
+	while (pending > 0)
+	{
+		Readback& slot = ring[(head + ringSize - pending) % ringSize];
+
+		GLenum status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+		if (status == GL_TIMEOUT_EXPIRED && wait)
+			continue;
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			break;
+		wait = false;                                                   // <- Only the oldest is worth blocking on
+
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+		pending--;
+
+		// A spare frame to copy into, held back while the writer is too far behind
+		std::vector<unsigned char> frame;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			drained.wait(lock, [this] { return (int)queue.size() < maxQueued; });
+			if (!spare.empty())
+			{
+				frame.swap(spare.back());
+				spare.pop_back();
+			}
+		}
+		frame.resize(bytes);
+
+		GLState::BindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+		void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+		if (pixels)
+		{
+			memcpy(&frame[0], pixels, bytes);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		GLState::BindBuffer(GL_PIXEL_PACK_BUFFER, GL_NONE);
+		if (!pixels)
+			continue;
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back(std::move(frame));
+		}
+		wake.notify_one();
+	}
+}
+
+void FrameCapture::Stop()
+{
+	if (!active)
+		return;
+
+	// Everything the GPU still owes us, then let the writer empty the queue
+	while (pending > 0)
+	{
+		int before = pending;
+		Collect(true);
+		if (pending == before)
+		{
+			printf("capture readback failed, %d frames lost\n", pending);
+			break;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	writer.join();
+
+	for (int i = 0; i < ringSize; i++)
+	{
+		if (ring[i].fence)
+			glDeleteSync(ring[i].fence);
+		ring[i].fence = 0;
+		ring[i].pbo.Reset();
+	}
+	head = pending = 0;
+
+	if (video)
+		fclose(video);
+	video = 0;
+
+	queue.clear();
+	spare.clear();
+	active = false;
+	printf("captured %d frames to %s\n", written, path.c_str());
+}
+
+int FrameCapture::Written() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return written;
+}
+
+int FrameCapture::Queued() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return (int)queue.size() + pending;
+}
+
+void FrameCapture::Run()
+{
+	Profiler::SetThreadName("Capture Writer");
+	for (;;)
+	{
+		std::vector<unsigned char> frame;
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (queue.empty())
+				return;                                                 // <- Only once stopping, and with nothing left to write
+			frame.swap(queue.front());
+			queue.pop_front();
+			index = written;
+		}
+		drained.notify_one();
+
+		WriteFrame(frame, index);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		written++;
+		spare.push_back(std::move(frame));
+	}
+}
+
+void FrameCapture::WriteFrame(const std::vector<unsigned char>& rgba, int index)
+{
+	PROFILE_SCOPE("Write Frame");
+	if (y4m)
+	{
+		WriteY4M(rgba);
+		return;
+	}
+
+	size_t dot = path.find_last_of('.');
+	std::string stem = dot == std::string::npos ? path : path.substr(0, dot);
+	char name[32];
+	sprintf(name, "_%05d.png", index);
+	if (!WritePNG((stem + name).c_str(), &rgba[0], width, height))
+		printf("can't write capture frame: %s%s\n", stem.c_str(), name);
+}
+
+// BT.601 with studio swing, which is what players assume of a Y4M without a colour range tag
+void FrameCapture::WriteY4M(const std::vector<unsigned char>& rgba)
+{
+	int w = width & ~1, h = height & ~1;
+	std::vector<unsigned char> planes((size_t)w * h * 3 / 2);
+	unsigned char* luma = &planes[0];
+	unsigned char* cb = luma + (size_t)w * h;
+	unsigned char* cr = cb + (size_t)(w / 2) * (h / 2);
+
+	for (int y = 0; y < h; y++)
+	{
+		const unsigned char* row = &rgba[(size_t)(height - 1 - y) * width * 4];     // <- GL reads bottom row first
+		for (int x = 0; x < w; x++)
+		{
+			const unsigned char* p = row + x * 4;
+			luma[(size_t)y * w + x] = (unsigned char)(16.5f + 0.257f * p[0] + 0.504f * p[1] + 0.098f * p[2]);
+		}
+	}
+
+	// Chroma from the average of each 2x2 block
+	for (int y = 0; y < h / 2; y++)
+	{
+		const unsigned char* top = &rgba[(size_t)(height - 1 - y * 2) * width * 4];
+		const unsigned char* bottom = &rgba[(size_t)(height - 2 - y * 2) * width * 4];
+		for (int x = 0; x < w / 2; x++)
+		{
+			float r = (top[x * 8 + 0] + top[x * 8 + 4] + bottom[x * 8 + 0] + bottom[x * 8 + 4]) * 0.25f;
+			float g = (top[x * 8 + 1] + top[x * 8 + 5] + bottom[x * 8 + 1] + bottom[x * 8 + 5]) * 0.25f;
+			float b = (top[x * 8 + 2] + top[x * 8 + 6] + bottom[x * 8 + 2] + bottom[x * 8 + 6]) * 0.25f;
+			cb[(size_t)y * (w / 2) + x] = (unsigned char)(128.5f - 0.148f * r - 0.291f * g + 0.439f * b);
+			cr[(size_t)y * (w / 2) + x] = (unsigned char)(128.5f + 0.439f * r - 0.368f * g - 0.071f * b);
+		}
+	}
+
+	fputs("FRAME\n", video);
+	fwrite(&planes[0], 1, planes.size(), video);
+}
@@ -0,0 +1,88 @@
+/**************************************************
+ *
+ *                 Capture.h
+ *
+ *  Records the tonemapped frame without stalling.
+ *  Reads go into a ring of pixel pack buffers, are
+ *  mapped once their fence signals, and a writer
+ *  thread turns them into Y4M video or PNGs.
+ *
+ ***************************************************/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <GL/gl3w.h>
+
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "gpumemory.h"
+
+// 8 bit RGB PNG from RGBA rows bottom up, as glReadPixels hands them over. Alpha is dropped
+bool WritePNG(const char* path, const unsigned char* rgba, int width, int height);
+
+class FrameCapture
+{
+public:
+    FrameCapture();
+    ~FrameCapture();
+
+    // A path ending in .y4m writes one 4:2:0 video, anything else a numbered run of PNGs (shot.png -> shot_00000.png)
+    bool Start(const char* path, int width, int height, int framesPerSecond);
+
+    // Call right after the scene reaches the backbuffer. Queues a read of it, and passes any reads that
+    // have landed on to the writer. Frames of another size than the capture are skipped
+    void Grab(int width, int height);
+
+    // Waits for the reads in flight and the writer to finish, then closes the file
+    void Stop();
+
+    bool Active() const { return active; }
+    int FramesPerSecond() const { return framesPerSecond; }
+    int Grabbed() const { return grabbed; }
+    int Written() const;
+    int Queued() const;
+
+private:
+    struct Readback
+    {
+        BufferHandle pbo;
+        GLsync fence;
+    };
+
+    // Maps the finished reads, oldest first. With wait the oldest one is waited for if it's not done
+    void Collect(bool wait);
+
+    void Run();
+    void WriteFrame(const std::vector<unsigned char>& rgba, int index);
+    void WriteY4M(const std::vector<unsigned char>& rgba);
+
+    static const int ringSize = 4;          // Frames the GPU can be ahead of the map
+    static const int maxQueued = 8;         // Frames waiting on the disk before Grab() holds the main thread up
+
+    Readback ring[ringSize];
+    int head, pending;
+
+    bool active, y4m;
+    std::string path;
+    FILE* video;
+    int width, height;                      // Read size, the video is cropped to even sizes for the chroma planes
+    int framesPerSecond;
+    int grabbed, skipped;
+
+    std::thread writer;
+    mutable std::mutex mutex;
+    std::condition_variable wake, drained;
+    std::deque<std::vector<unsigned char> > queue;
+    std::vector<std::vector<unsigned char> > spare;
+    bool stopping;
+    int written;
+};
+
+#endif
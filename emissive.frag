@@ -7,9 +7,10 @@ in VertexData
 	vec2 texcoord;
 }	inData;
 
-uniform sampler2D emissiveTex;
+// In emissiveShading.frag
+vec4 ShadeSurface(vec3 worldPos, vec3 normal, vec2 texcoord);
 
 void main()
 {
-	frag_colour = texture(emissiveTex, inData.texcoord) * 1.5f;
+	frag_colour = ShadeSurface(vec3(0.0f), vec3(0.0f), inData.texcoord);
 }
\ No newline at end of file
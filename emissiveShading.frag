@@ -0,0 +1,10 @@
+#version 400
+
+uniform sampler2D emissiveTex;
+uniform float emissiveIntensity;	// HDR multiplier, the tonemapper brings it back into range
+
+// Self lit, the position and normal don't come into it
+vec4 ShadeSurface(vec3 worldPos, vec3 normal, vec2 texcoord)
+{
+	return texture(emissiveTex, texcoord) * emissiveIntensity;
+}
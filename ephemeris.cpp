@@ -0,0 +1,260 @@
+/*****************************************
+ *
+ *           Ephemeris.cpp
+ *
+ *  Batched Newton solve of Kepler's
+ *  equation and a chunked, interpolated
+ *  cache of the results.
+ *
+ ****************************************/
+
+#include "ephemeris.h"
+
+#include <GLM/gtc/constants.hpp>
+
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define EPHEMERIS_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace glm;
+
+// Newton steps from E = M + e sin(M), enough for float precision below e = 0.8
+static const int keplerIterations = 6;
+
+// One sample a day, 1024 days to a chunk. Hermite interpolation off the sampled velocities keeps
+// the moon (a quarter turn a week) well under a thousandth of a unit off
+static const double sampleDays = 1.0;
+static const int chunkSamples = 1024;
+static const int maxChunks = 64;
+
+#ifdef EPHEMERIS_SSE2
+
+// sin and cos of four angles, cephes style: reduce to [-pi/4, pi/4] around the nearest quarter turn,
+// then pick and negate the two polynomials by quadrant
+static inline void SinCos(__m128 x, __m128& s, __m128& c)
+{
+	__m128i q = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.636619772f)));
+	__m128 qf = _mm_cvtepi32_ps(q);
+
+	// pi / 2 split in three so the reduction stays exact
+	__m128 r = _mm_sub_ps(x, _mm_mul_ps(qf, _mm_set1_ps(1.5703125f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(qf, _mm_set1_ps(4.837512969970703125e-4f)));
+	r = _mm_sub_ps(r, _mm_mul_ps(qf, _mm_set1_ps(7.54978995489188216e-8f)));
+	__m128 r2 = _mm_mul_ps(r, r);
+
+	__m128 sr = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(-1.9515295891e-4f)), _mm_set1_ps(8.3321608736e-3f));
+	sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(-1.6666654611e-1f));
+	sr = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sr, r2), r), r);
+
+	__m128 cr = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(2.443315711809948e-5f)), _mm_set1_ps(-1.388731625493765e-3f));
+	cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(4.166664568298827e-2f));
+	cr = _mm_mul_ps(_mm_mul_ps(cr, r2), r2);
+	cr = _mm_add_ps(_mm_sub_ps(cr, _mm_mul_ps(r2, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+	// Odd quadrants swap sin and cos, quadrants 2-3 negate sin and 1-2 negate cos
+	__m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+	__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+	__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, two), 30));
+	__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, one), two), 30));
+
+	s = _mm_or_ps(_mm_and_ps(swap, cr), _mm_andnot_ps(swap, sr));
+	c = _mm_or_ps(_mm_and_ps(swap, sr), _mm_andnot_ps(swap, cr));
+	s = _mm_xor_ps(s, sinSign);
+	c = _mm_xor_ps(c, cosSign);
+}
+
+#endif
+
+void SolveKepler(const float* M, const float* e, float* E, int count)
+{
+	int i = 0;
+
+#ifdef EPHEMERIS_SSE2
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 m = _mm_loadu_ps(M + i);
+		__m128 ecc = _mm_loadu_ps(e + i);
+
+		__m128 s, c;
+		SinCos(m, s, c);
+		__m128 x = _mm_add_ps(m, _mm_mul_ps(ecc, s));
+
+		for (int k = 0; k < keplerIterations; k++)
+		{
+			SinCos(x, s, c);
+			__m128 f = _mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(ecc, s)), m);
+			__m128 slope = _mm_sub_ps(one, _mm_mul_ps(ecc, c));
+			x = _mm_sub_ps(x, _mm_div_ps(f, slope));
+		}
+
+		_mm_storeu_ps(E + i, x);
+	}
+#endif
+
+	// Whatever doesn't fill a vector, or everything without SSE2
+	for (; i < count; i++)
+	{
+		float x = M[i] + e[i] * sinf(M[i]);
+		for (int k = 0; k < keplerIterations; k++)
+			x -= (x - e[i] * sinf(x) - M[i]) / (1.0f - e[i] * cosf(x));
+		E[i] = x;
+	}
+}
+
+Ephemeris::Ephemeris()
+{
+	useCounter = 0;
+}
+
+void Ephemeris::SetOrbits(const OrbitElements* elements, int count)
+{
+	orbits.resize(count);
+	chunks.clear();
+
+	for (int i = 0; i < count; i++)
+	{
+		const OrbitElements& el = elements[i];
+		Orbit& orbit = orbits[i];
+
+		float inc = radians(el.inclination);
+		float node = radians(el.node);
+		float peri = radians(el.periapsis);
+
+		// Standard perifocal to ecliptic rotation, with the ecliptic's z turned into our y
+		float cn = cos(node), sn = sin(node);
+		float cp = cos(peri), sp = sin(peri);
+		float ci = cos(inc), si = sin(inc);
+		orbit.p = vec3(cn * cp - sn * sp * ci, sp * si, sn * cp + cn * sp * ci);
+		orbit.q = vec3(-cn * sp - sn * cp * ci, cp * si, -sn * sp + cn * cp * ci);
+
+		orbit.period = el.period;
+		orbit.a = el.semiMajorAxis;
+		orbit.e = el.eccentricity;
+		orbit.b = el.semiMajorAxis * sqrt(1.0f - el.eccentricity * el.eccentricity);
+		orbit.meanAtEpoch = radians(el.meanLongitude - el.node - el.periapsis);
+	}
+}
+
+void Ephemeris::SolveSamples(const double* days, int samples, vec3* positions, vec3* velocities) const
+{
+	int count = (int)orbits.size();
+	int total = samples * count;
+	mean.resize(total);
+	ecc.resize(total);
+	anomaly.resize(total);
+
+	// Whole turns come off in double, so the angle handed to the solver stays small at any date
+	for (int s = 0; s < samples; s++)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			const Orbit& orbit = orbits[i];
+			double turns = orbit.period > 0.0 ? days[s] / orbit.period : 0.0;
+			turns -= floor(turns);
+			double m = orbit.meanAtEpoch + turns * two_pi<double>();
+			mean[s * count + i] = (float)(m - two_pi<double>() * floor(m / two_pi<double>() + 0.5));
+			ecc[s * count + i] = orbit.e;
+		}
+	}
+
+	SolveKepler(&mean[0], &ecc[0], &anomaly[0], total);
+
+	for (int s = 0; s < samples; s++)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			const Orbit& orbit = orbits[i];
+			int n = s * count + i;
+			if (orbit.period <= 0.0)
+			{
+				positions[n] = vec3(0.0f);
+				if (velocities) velocities[n] = vec3(0.0f);
+				continue;
+			}
+
+			float E = anomaly[n];
+			float cE = cos(E), sE = sin(E);
+			positions[n] = orbit.p * (orbit.a * (cE - orbit.e)) + orbit.q * (orbit.b * sE);
+
+			if (velocities)
+			{
+				float rate = (float)(two_pi<double>() / orbit.period) / (1.0f - orbit.e * cE);
+				velocities[n] = (orbit.q * (orbit.b * cE) - orbit.p * (orbit.a * sE)) * rate;
+			}
+		}
+	}
+}
+
+void Ephemeris::Solve(double days, vec3* positions) const
+{
+	if (!orbits.empty())
+		SolveSamples(&days, 1, positions, 0);
+}
+
+Ephemeris::Chunk& Ephemeris::FindChunk(long long index)
+{
+	int oldest = 0;
+	for (int i = 0; i < (int)chunks.size(); i++)
+	{
+		if (chunks[i].index == index)
+		{
+			chunks[i].lastUsed = ++useCounter;
+			return chunks[i];
+		}
+		if (chunks[i].lastUsed < chunks[oldest].lastUsed)
+			oldest = i;
+	}
+
+	if ((int)chunks.size() < maxChunks)
+	{
+		chunks.push_back(Chunk());
+		oldest = (int)chunks.size() - 1;
+	}
+
+	// Both ends are sampled so a chunk never needs its neighbour to interpolate
+	Chunk& chunk = chunks[oldest];
+	chunk.index = index;
+	chunk.lastUsed = ++useCounter;
+	chunk.position.resize((chunkSamples + 1) * orbits.size());
+	chunk.velocity.resize((chunkSamples + 1) * orbits.size());
+
+	std::vector<double> days(chunkSamples + 1);
+	for (int s = 0; s <= chunkSamples; s++)
+		days[s] = (index * chunkSamples + s) * sampleDays;
+	SolveSamples(&days[0], chunkSamples + 1, &chunk.position[0], &chunk.velocity[0]);
+
+	return chunk;
+}
+
+void Ephemeris::Lookup(double days, vec3* positions)
+{
+	if (orbits.empty())
+		return;
+
+	double sample = days / sampleDays;
+	long long index = (long long)floor(sample / chunkSamples);
+	Chunk& chunk = FindChunk(index);
+
+	double local = sample - (double)index * chunkSamples;
+	int s = min((int)local, chunkSamples - 1);
+	float t = (float)(local - s);
+
+	// Cubic Hermite between the two samples, the velocities are per day so they scale by the spacing
+	float t2 = t * t, t3 = t2 * t;
+	float h00 = 2 * t3 - 3 * t2 + 1;
+	float h10 = (t3 - 2 * t2 + t) * (float)sampleDays;
+	float h01 = -2 * t3 + 3 * t2;
+	float h11 = (t3 - t2) * (float)sampleDays;
+
+	int count = (int)orbits.size();
+	const vec3* p0 = &chunk.position[s * count];
+	const vec3* v0 = &chunk.velocity[s * count];
+	const vec3* p1 = p0 + count;
+	const vec3* v1 = v0 + count;
+	for (int i = 0; i < count; i++)
+		positions[i] = p0[i] * h00 + v0[i] * h10 + p1[i] * h01 + v1[i] * h11;
+}
@@ -0,0 +1,78 @@
+/**************************************************
+ *
+ *                 Ephemeris.h
+ *
+ *  Keplerian orbits solved in batches, plus a
+ *  chunked cache of sampled positions for jumping
+ *  around the timeline.
+ *
+ ***************************************************/
+
+#ifndef EPHEMERIS_H
+#define EPHEMERIS_H
+
+#include <GLM/glm.hpp>
+
+#include <vector>
+
+// Angles are in degrees against the plane the old circular orbits used (y up)
+struct OrbitElements
+{
+    double period;          // Days per orbit, 0 for none
+    float semiMajorAxis;
+    float eccentricity;     // Below ~0.8, the solver runs a fixed number of iterations
+    float inclination;
+    float node;             // Longitude of the ascending node
+    float periapsis;        // Argument of periapsis
+    float meanLongitude;    // At day 0
+};
+
+// Solves Kepler's equation M = E - e sin(E) for E, four orbits at a time with SSE2
+void SolveKepler(const float* meanAnomaly, const float* eccentricity, float* eccentricAnomaly, int count);
+
+class Ephemeris
+{
+public:
+    Ephemeris();
+
+    void SetOrbits(const OrbitElements* elements, int count);
+
+    // Offsets from each orbit's focus, solved directly
+    void Solve(double days, glm::vec3* positions) const;
+
+    // Same offsets, interpolated from cached samples. Chunks are built on demand and the least
+    // recently used one is dropped once the cache is full
+    void Lookup(double days, glm::vec3* positions);
+
+    int CachedChunks() const { return (int)chunks.size(); }
+
+private:
+    // Orbit plane axes (towards periapsis and 90 degrees ahead) and the rest of what a solve needs
+    struct Orbit
+    {
+        glm::vec3 p, q;
+        double period;
+        float a, b, e;
+        float meanAtEpoch;
+    };
+
+    struct Chunk
+    {
+        long long index;
+        unsigned long long lastUsed;
+        std::vector<glm::vec3> position, velocity;    // [sample * orbits + orbit]
+    };
+
+    // Solves every orbit at each of the given days, velocities are per day
+    void SolveSamples(const double* days, int samples, glm::vec3* positions, glm::vec3* velocities) const;
+    Chunk& FindChunk(long long index);
+
+    std::vector<Orbit> orbits;
+    std::vector<Chunk> chunks;
+    unsigned long long useCounter;
+
+    // Scratch for the batched solver
+    mutable std::vector<float> mean, ecc, anomaly;
+};
+
+#endif
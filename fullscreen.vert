@@ -0,0 +1,12 @@
+#version 400
+
+layout (location = 0) in vec3 vertexPosition;
+layout (location = 2) in vec2 vertexTexCoord;
+
+out vec2 texcoord;
+
+void main()
+{
+	texcoord = vertexTexCoord;
+	gl_Position = vec4(vertexPosition.xy, 0.0f, 1.0f);
+}
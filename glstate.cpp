@@ -0,0 +1,310 @@
+/*****************************************
+ *
+ *           GLState.cpp
+ *
+ *  Unknown is stored as ~0, so the first
+ *  call after Invalidate() always goes
+ *  through to GL.
+ *
+ ****************************************/
+
+#include "glstate.h"
+
+#include <string.h>
+
+static const GLuint unknown = ~0u;
+
+GLuint GLState::program = unknown;
+GLuint GLState::vao = unknown;
+int GLState::activeUnit = -1;
+GLuint GLState::textures[GLState::maxUnits][GLState::TEX_TARGETS];
+GLuint GLState::buffers[GLState::BUF_TARGETS];
+GLState::Indexed GLState::uniformSlots[GLState::maxIndexed];
+GLState::Indexed GLState::storageSlots[GLState::maxIndexed];
+std::unordered_map<unsigned long long, GLState::UniformValue> GLState::uniforms;
+GLState::Counters GLState::frame = {};
+GLState::Counters GLState::lastFrame = {};
+
+// Static init can't run the loops, so the first use does
+static bool initialized = false;
+
+// Uniform values live in their program and nobody else writes to ours, so only the bindings are forgotten
+void GLState::Invalidate()
+{
+	program = vao = unknown;
+	activeUnit = -1;
+	for (int u = 0; u < maxUnits; u++)
+		for (int t = 0; t < TEX_TARGETS; t++)
+			textures[u][t] = unknown;
+	for (int b = 0; b < BUF_TARGETS; b++)
+		buffers[b] = unknown;
+	for (int i = 0; i < maxIndexed; i++)
+		uniformSlots[i].buffer = storageSlots[i].buffer = unknown;
+	initialized = true;
+}
+
+bool GLState::Bind(GLuint& cached, GLuint value)
+{
+	if (!initialized)
+		Invalidate();
+
+	if (cached == value)
+	{
+		frame.bindsSkipped++;
+		return false;
+	}
+	cached = value;
+	frame.binds++;
+	return true;
+}
+
+int GLState::TextureTarget(GLenum target)
+{
+	switch (target)
+	{
+	case GL_TEXTURE_2D: return TEX_2D;
+	case GL_TEXTURE_CUBE_MAP: return TEX_CUBE;
+	default: return -1;
+	}
+}
+
+int GLState::BufferTarget(GLenum target)
+{
+	// Element arrays belong to the VAO, so they aren't cached here
+	switch (target)
+	{
+	case GL_ARRAY_BUFFER: return BUF_ARRAY;
+	case GL_UNIFORM_BUFFER: return BUF_UNIFORM;
+	case GL_SHADER_STORAGE_BUFFER: return BUF_STORAGE;
+	case GL_COPY_READ_BUFFER: return BUF_COPY_READ;
+	case GL_COPY_WRITE_BUFFER: return BUF_COPY_WRITE;
+	default: return -1;
+	}
+}
+
+GLState::Indexed* GLState::IndexedSlot(GLenum target, GLuint index)
+{
+	if (index >= (GLuint)maxIndexed)
+		return 0;
+	if (target == GL_UNIFORM_BUFFER)
+		return &uniformSlots[index];
+	if (target == GL_SHADER_STORAGE_BUFFER)
+		return &storageSlots[index];
+	return 0;
+}
+
+void GLState::UseProgram(GLuint value)
+{
+	if (Bind(program, value))
+		glUseProgram(value);
+}
+
+void GLState::BindVertexArray(GLuint value)
+{
+	if (Bind(vao, value))
+		glBindVertexArray(value);
+}
+
+void GLState::ActiveTexture(GLenum unit)
+{
+	GLuint cached = (GLuint)activeUnit;
+	if (Bind(cached, unit - GL_TEXTURE0))
+	{
+		activeUnit = (int)cached;
+		glActiveTexture(unit);
+	}
+}
+
+void GLState::BindTexture(GLenum target, GLuint texture)
+{
+	int t = TextureTarget(target);
+	if (t < 0 || activeUnit < 0 || activeUnit >= maxUnits)
+	{
+		frame.binds++;
+		glBindTexture(target, texture);
+		return;
+	}
+
+	if (Bind(textures[activeUnit][t], texture))
+		glBindTexture(target, texture);
+}
+
+void GLState::BindBuffer(GLenum target, GLuint buffer)
+{
+	int b = BufferTarget(target);
+	if (b < 0)
+	{
+		frame.binds++;
+		glBindBuffer(target, buffer);
+		return;
+	}
+
+	if (Bind(buffers[b], buffer))
+		glBindBuffer(target, buffer);
+}
+
+void GLState::BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	BindBufferRange(target, index, buffer, 0, -1);
+}
+
+void GLState::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	if (!initialized)
+		Invalidate();
+
+	Indexed* slot = IndexedSlot(target, index);
+	if (slot && slot->buffer == buffer && slot->offset == offset && slot->size == size)
+	{
+		frame.bindsSkipped++;
+		return;
+	}
+
+	frame.binds++;
+	if (size < 0)
+		glBindBufferBase(target, index, buffer);
+	else
+		glBindBufferRange(target, index, buffer, offset, size);
+
+	if (slot)
+	{
+		slot->buffer = buffer;
+		slot->offset = offset;
+		slot->size = size;
+	}
+
+	// Indexed binds move the generic binding point as well
+	int b = BufferTarget(target);
+	if (b >= 0)
+		buffers[b] = buffer;
+}
+
+bool GLState::UniformChanged(GLint location, const void* value, int size)
+{
+	// Location -1 is silently ignored by GL, so it isn't worth counting either
+	if (location < 0)
+		return false;
+
+	if (!initialized)
+		Invalidate();
+
+	if (size > uniformBytes || program == unknown)
+	{
+		frame.uniforms++;
+		return true;
+	}
+
+	UniformValue& cached = uniforms[((unsigned long long)program << 32) | (unsigned int)location];
+	if (cached.size == size && memcmp(cached.bytes, value, size) == 0)
+	{
+		frame.uniformsSkipped++;
+		return false;
+	}
+
+	memcpy(cached.bytes, value, size);
+	cached.size = size;
+	frame.uniforms++;
+	return true;
+}
+
+void GLState::Uniform1i(GLint location, GLint value)
+{
+	if (UniformChanged(location, &value, sizeof(value)))
+		glUniform1i(location, value);
+}
+
+void GLState::Uniform1f(GLint location, GLfloat value)
+{
+	if (UniformChanged(location, &value, sizeof(value)))
+		glUniform1f(location, value);
+}
+
+void GLState::Uniform2f(GLint location, GLfloat x, GLfloat y)
+{
+	GLfloat value[2] = { x, y };
+	if (UniformChanged(location, value, sizeof(value)))
+		glUniform2f(location, x, y);
+}
+
+void GLState::Uniform3fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	if (UniformChanged(location, value, (int)sizeof(GLfloat) * 3 * count))
+		glUniform3fv(location, count, value);
+}
+
+void GLState::UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	// Transposed uploads are rare enough to always send
+	if (transpose || UniformChanged(location, value, (int)sizeof(GLfloat) * 16 * count))
+		glUniformMatrix4fv(location, count, transpose, value);
+}
+
+void GLState::DrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	frame.draws++;
+	glDrawArrays(mode, first, count);
+}
+
+void GLState::DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+	frame.draws++;
+	glDrawArraysInstanced(mode, first, count, instances);
+}
+
+void GLState::DeleteProgram(GLuint value)
+{
+	if (program == value)
+		program = unknown;
+	for (std::unordered_map<unsigned long long, UniformValue>::iterator it = uniforms.begin(); it != uniforms.end();)
+	{
+		if ((GLuint)(it->first >> 32) == value)
+			it = uniforms.erase(it);
+		else
+			++it;
+	}
+	glDeleteProgram(value);
+}
+
+// GL unbinds whatever it deletes, and a later glGen* may hand the same name straight back
+void GLState::DeleteTextures(GLsizei n, const GLuint* names)
+{
+	for (int i = 0; i < n; i++)
+		for (int u = 0; u < maxUnits; u++)
+			for (int t = 0; t < TEX_TARGETS; t++)
+				if (textures[u][t] == names[i])
+					textures[u][t] = unknown;
+	glDeleteTextures(n, names);
+}
+
+void GLState::DeleteBuffers(GLsizei n, const GLuint* names)
+{
+	for (int i = 0; i < n; i++)
+	{
+		for (int b = 0; b < BUF_TARGETS; b++)
+			if (buffers[b] == names[i])
+				buffers[b] = unknown;
+		for (int s = 0; s < maxIndexed; s++)
+		{
+			if (uniformSlots[s].buffer == names[i])
+				uniformSlots[s].buffer = unknown;
+			if (storageSlots[s].buffer == names[i])
+				storageSlots[s].buffer = unknown;
+		}
+	}
+	glDeleteBuffers(n, names);
+}
+
+void GLState::DeleteVertexArrays(GLsizei n, const GLuint* names)
+{
+	for (int i = 0; i < n; i++)
+		if (vao == names[i])
+			vao = unknown;
+	glDeleteVertexArrays(n, names);
+}
+
+void GLState::EndFrame()
+{
+	lastFrame = frame;
+	frame = Counters();
+	Invalidate();
+}
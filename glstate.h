@@ -0,0 +1,96 @@
+/**************************************************
+ *
+ *                 GLState.h
+ *
+ *  Thin cache over the GL binding state. Calls
+ *  that wouldn't change anything never reach the
+ *  driver, and everything is counted per frame.
+ *
+ ***************************************************/
+
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <GL/gl3w.h>
+
+#include <unordered_map>
+
+// Same names and arguments as the GL calls they stand in for. Anything that binds behind our back
+// (SOIL, ImGui) has to be followed by Invalidate(), deleting through here keeps the cache honest
+class GLState
+{
+public:
+    static void UseProgram(GLuint program);
+    static void BindVertexArray(GLuint vao);
+    static void ActiveTexture(GLenum unit);
+    static void BindTexture(GLenum target, GLuint texture);
+    static void BindBuffer(GLenum target, GLuint buffer);
+    static void BindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    static void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    // Cached per program and location, so the same view matrix for every body only goes up once
+    static void Uniform1i(GLint location, GLint value);
+    static void Uniform1f(GLint location, GLfloat value);
+    static void Uniform2f(GLint location, GLfloat x, GLfloat y);
+    static void Uniform3fv(GLint location, GLsizei count, const GLfloat* value);
+    static void UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+
+    static void DrawArrays(GLenum mode, GLint first, GLsizei count);
+    static void DrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+
+    static void DeleteProgram(GLuint program);
+    static void DeleteTextures(GLsizei n, const GLuint* textures);
+    static void DeleteBuffers(GLsizei n, const GLuint* buffers);
+    static void DeleteVertexArrays(GLsizei n, const GLuint* arrays);
+
+    static void Invalidate();
+
+    struct Counters
+    {
+        int draws;
+        int binds, bindsSkipped;
+        int uniforms, uniformsSkipped;
+    };
+
+    // Rolls this frame's counters over and forgets the bindings, ImGui draws after us with its own state
+    static void EndFrame();
+    static const Counters& LastFrame() { return lastFrame; }
+
+private:
+    static const int maxUnits = 32;
+    static const int maxIndexed = 16;
+    static const int uniformBytes = 64;
+
+    enum { TEX_2D, TEX_CUBE, TEX_TARGETS };
+    enum { BUF_ARRAY, BUF_UNIFORM, BUF_STORAGE, BUF_COPY_READ, BUF_COPY_WRITE, BUF_TARGETS };
+
+    struct Indexed
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;            // -1 for the whole buffer
+    };
+
+    struct UniformValue
+    {
+        unsigned char bytes[uniformBytes];
+        int size;
+    };
+
+    static bool Bind(GLuint& cached, GLuint value);
+    static bool UniformChanged(GLint location, const void* value, int size);
+    static int TextureTarget(GLenum target);
+    static int BufferTarget(GLenum target);
+    static Indexed* IndexedSlot(GLenum target, GLuint index);
+
+    static GLuint program, vao;
+    static int activeUnit;
+    static GLuint textures[maxUnits][TEX_TARGETS];
+    static GLuint buffers[BUF_TARGETS];
+    static Indexed uniformSlots[maxIndexed], storageSlots[maxIndexed];
+    static std::unordered_map<unsigned long long, UniformValue> uniforms;
+
+    static Counters frame, lastFrame;
+};
+
+#endif
@@ -0,0 +1,213 @@
+/*****************************************
+ *
+ *           GpuBelt.cpp
+ *
+ *  Orbits live in one storage buffer and
+ *  a compute pass writes positions into
+ *  another, which the vertex shader reads.
+ *
+ ****************************************/
+
+#include "gpubelt.h"
+#include "minorplanets.h"
+#include "shaders.h"
+#include "profiler.h"
+#include "glstate.h"
+
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+// Bindings for the two storage buffers, matching the shaders
+static const int ORBIT_BINDING = 0;
+static const int POSITION_BINDING = 1;
+
+static const int groupSize = 256;
+static const double maxEpochDays = 3650.0;
+
+bool GpuBelt::available = false;
+BufferHandle GpuBelt::orbitBuffer;
+BufferHandle GpuBelt::positionBuffer;
+VertexArrayHandle GpuBelt::emptyVao;
+GLuint GpuBelt::updateProgram = 0;
+GLuint GpuBelt::drawProgram = 0;
+int GpuBelt::count = 0;
+int GpuBelt::capacity = 0;
+double GpuBelt::epoch = 0.0;
+
+bool GpuBelt::Initialize()
+{
+	available = false;
+	if (!gl3wIsSupported(4, 3))
+	{
+		printf("no compute shaders (needs GL 4.3), the belt stays on the CPU\n");
+		return false;
+	}
+
+	// buildProgram() wants a vertex and fragment shader, a compute program is only the one stage
+	GLuint cs = buildShader(GL_COMPUTE_SHADER, ASSETS"beltUpdate.comp");
+	if (cs)
+	{
+		updateProgram = glCreateProgram();
+		glAttachShader(updateProgram, cs);
+		updateProgram = linkProgram(updateProgram);
+	}
+
+	GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"beltGpu.vert");
+	GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"particles.frag");
+	if (vs && fs)
+		drawProgram = linkProgram(buildProgram(vs, fs, 0));
+
+	if (!updateProgram || !drawProgram)
+	{
+		printf("belt compute shaders failed to build, the belt stays on the CPU\n");
+		Cleanup();
+		return false;
+	}
+
+	orbitBuffer.Create(MEMORY_BUFFERS);
+	positionBuffer.Create(MEMORY_BUFFERS);
+
+	// Points are drawn with no attributes at all, but core profile still wants a VAO bound
+	emptyVao.Create(MEMORY_GEOMETRY);
+
+	count = 0;
+	capacity = 0;
+	epoch = 0.0;
+	available = true;
+	return true;
+}
+
+void GpuBelt::Cleanup()
+{
+	orbitBuffer.Reset();
+	positionBuffer.Reset();
+	emptyVao.Reset();
+	if (updateProgram) GLState::DeleteProgram(updateProgram);
+	if (drawProgram) GLState::DeleteProgram(drawProgram);
+
+	updateProgram = drawProgram = 0;
+	count = capacity = 0;
+	available = false;
+}
+
+void GpuBelt::Reserve(int bodies)
+{
+	if (bodies <= capacity)
+		return;
+
+	// Grow by at least half again so a slider being dragged up doesn't reallocate every frame
+	int newCapacity = bodies;
+	if (newCapacity < capacity + capacity / 2)
+		newCapacity = capacity + capacity / 2;
+
+	GLsizeiptr bytes = (GLsizeiptr)newCapacity * 4 * sizeof(float);
+
+	BufferHandle newOrbits;
+	newOrbits.Create(MEMORY_BUFFERS);
+	GLState::BindBuffer(GL_COPY_WRITE_BUFFER, newOrbits);
+	glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_DYNAMIC_DRAW);
+	newOrbits.SetBytes(bytes);
+	if (count > 0)
+	{
+		GLState::BindBuffer(GL_COPY_READ_BUFFER, orbitBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (GLsizeiptr)count * 4 * sizeof(float));
+		GLState::BindBuffer(GL_COPY_READ_BUFFER, GL_NONE);
+	}
+	GLState::BindBuffer(GL_COPY_WRITE_BUFFER, GL_NONE);
+	orbitBuffer = std::move(newOrbits);
+
+	// Positions are rewritten by the next update, they don't need carrying over
+	GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, positionBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, NULL, GL_DYNAMIC_COPY);
+	positionBuffer.SetBytes(bytes);
+	GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, GL_NONE);
+
+	capacity = newCapacity;
+}
+
+void GpuBelt::Spawn(const MinorPlanets& source, int first, int bodies)
+{
+	if (!available || bodies <= 0)
+		return;
+
+	Reserve(count + bodies);
+
+	std::vector<float> records(bodies * 4);
+	source.CopyOrbits(first, bodies, epoch, &records[0]);
+
+	GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, orbitBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr)count * 4 * sizeof(float), records.size() * sizeof(float), &records[0]);
+	GLState::BindBuffer(GL_SHADER_STORAGE_BUFFER, GL_NONE);
+
+	count += bodies;
+}
+
+void GpuBelt::Despawn(int first, int bodies)
+{
+	if (!available || bodies <= 0 || first >= count)
+		return;
+	if (first + bodies > count)
+		bodies = count - first;
+
+	// Whatever is past the gap fills it from the end, the two ranges never overlap
+	int after = count - (first + bodies);
+	int moved = after < bodies ? after : bodies;
+	if (moved > 0)
+	{
+		const GLsizeiptr stride = 4 * sizeof(float);
+		GLState::BindBuffer(GL_COPY_READ_BUFFER, orbitBuffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_READ_BUFFER, (GLintptr)(count - moved) * stride, (GLintptr)first * stride, moved * stride);
+		GLState::BindBuffer(GL_COPY_READ_BUFFER, GL_NONE);
+	}
+
+	count -= bodies;
+}
+
+void GpuBelt::Update(double days)
+{
+	if (!available || count == 0)
+		return;
+	PROFILE_SCOPE("Belt Compute");
+
+	// Fold the elapsed turns into the stored phases once the time gets big
+	float elapsed = (float)(days - epoch);
+	bool rebase = fabs(days - epoch) > maxEpochDays;
+
+	GLState::UseProgram(updateProgram);
+	GLState::Uniform1f(glGetUniformLocation(updateProgram, "elapsed"), elapsed);
+	GLState::Uniform1i(glGetUniformLocation(updateProgram, "rebase"), rebase);
+	GLState::Uniform1i(glGetUniformLocation(updateProgram, "count"), count);
+
+	GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, ORBIT_BINDING, orbitBuffer);
+	GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, POSITION_BINDING, positionBuffer);
+	glDispatchCompute((count + groupSize - 1) / groupSize, 1, 1);
+
+	// The vertex shader reads what we just wrote
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	GLState::UseProgram(GL_NONE);
+
+	if (rebase)
+		epoch = days;
+}
+
+void GpuBelt::Draw(const glm::mat4& view, const glm::mat4& proj, float pointSize, const glm::vec3& colour)
+{
+	if (!available || count == 0)
+		return;
+
+	GLState::UseProgram(drawProgram);
+	GLState::UniformMatrix4fv(glGetUniformLocation(drawProgram, "view"), 1, GL_FALSE, &view[0][0]);
+	GLState::UniformMatrix4fv(glGetUniformLocation(drawProgram, "proj"), 1, GL_FALSE, &proj[0][0]);
+	GLState::Uniform1f(glGetUniformLocation(drawProgram, "pointSize"), pointSize);
+	GLState::Uniform3fv(glGetUniformLocation(drawProgram, "particleColour"), 1, &colour[0]);
+
+	GLState::BindBufferBase(GL_SHADER_STORAGE_BUFFER, POSITION_BINDING, positionBuffer);
+	glEnable(GL_PROGRAM_POINT_SIZE);
+	GLState::BindVertexArray(emptyVao);
+	GLState::DrawArrays(GL_POINTS, 0, count);
+	GLState::BindVertexArray(GL_NONE);
+	glDisable(GL_PROGRAM_POINT_SIZE);
+
+	GLState::UseProgram(GL_NONE);
+}
@@ -0,0 +1,53 @@
+/**************************************************
+ *
+ *                 GpuBelt.h
+ *
+ *  Asteroid belt kept in storage buffers and moved
+ *  by a compute shader. Only spawns and despawns
+ *  ever come over from the CPU.
+ *
+ ***************************************************/
+
+#ifndef GPUBELT_H
+#define GPUBELT_H
+
+#include <GL/gl3w.h>
+#include <GLM/glm.hpp>
+
+#include "gpumemory.h"
+
+class MinorPlanets;
+
+class GpuBelt
+{
+public:
+    // Returns false without compute shaders and storage buffers (GL 4.3), the CPU belt is the fallback
+    static bool Initialize();
+    static bool Available() { return available; }
+    static void Cleanup();
+
+    // Appends bodies [first, first + count) of the source belt
+    static void Spawn(const MinorPlanets& source, int first, int count);
+
+    // Removes a run of bodies, the ones off the end move down into the gap to keep things packed
+    static void Despawn(int first, int count);
+    static int Count() { return count; }
+
+    // Moves every orbit to the given day, then draws them as points straight out of the position buffer
+    static void Update(double days);
+    static void Draw(const glm::mat4& view, const glm::mat4& proj, float pointSize, const glm::vec3& colour);
+
+private:
+    static void Reserve(int bodies);
+
+    static bool available;
+    static BufferHandle orbitBuffer, positionBuffer;
+    static VertexArrayHandle emptyVao;
+    static GLuint updateProgram, drawProgram;
+    static int count, capacity;
+
+    // Phases on the GPU are at this day, it moves forward now and then so the float time stays small
+    static double epoch;
+};
+
+#endif
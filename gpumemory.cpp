@@ -0,0 +1,193 @@
+/*****************************************
+ *
+ *           GpuMemory.cpp
+ *
+ *  Bytes are what we asked GL for, not
+ *  what the driver actually keeps, so
+ *  padding and mip alignment aren't in it.
+ *
+ ****************************************/
+
+#include "gpumemory.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+size_t GpuMemory::budget = (size_t)512 << 20;
+
+GpuMemory::EntryMap GpuMemory::entries;
+size_t GpuMemory::categoryBytes[MEMORY_CATEGORY_COUNT] = {};
+int GpuMemory::categoryCount[MEMORY_CATEGORY_COUNT] = {};
+unsigned int GpuMemory::frame = 1;
+
+static const char* categoryNames[MEMORY_CATEGORY_COUNT] = { "Textures", "Streamed", "Targets", "Geometry", "Buffers" };
+static const char* typeNames[] = { "texture", "buffer", "vertex array", "renderbuffer" };
+
+GLuint GpuMemory::Create(GpuObjectType type, MemoryCategory category)
+{
+	GLuint name = 0;
+	switch (type)
+	{
+	case GPU_TEXTURE:       glGenTextures(1, &name); break;
+	case GPU_BUFFER:        glGenBuffers(1, &name); break;
+	case GPU_VERTEX_ARRAY:  glGenVertexArrays(1, &name); break;
+	case GPU_RENDERBUFFER:  glGenRenderbuffers(1, &name); break;
+	}
+
+	Adopt(type, name, category);
+	return name;
+}
+
+void GpuMemory::Adopt(GpuObjectType type, GLuint name, MemoryCategory category)
+{
+	if (!name)
+		return;
+
+	Entry entry = { category, 0, 0, NULL, NULL };     // <- Not drawn yet, frame 0 never happens
+	entries[std::make_pair((int)type, name)] = entry;
+	categoryCount[category]++;
+}
+
+void GpuMemory::Destroy(GpuObjectType type, GLuint name)
+{
+	EntryMap::iterator it = entries.find(std::make_pair((int)type, name));
+	if (it != entries.end())
+	{
+		categoryBytes[it->second.category] -= it->second.bytes;
+		categoryCount[it->second.category]--;
+		entries.erase(it);
+	}
+
+	switch (type)
+	{
+	case GPU_TEXTURE:       GLState::DeleteTextures(1, &name); break;
+	case GPU_BUFFER:        GLState::DeleteBuffers(1, &name); break;
+	case GPU_VERTEX_ARRAY:  GLState::DeleteVertexArrays(1, &name); break;
+	case GPU_RENDERBUFFER:  glDeleteRenderbuffers(1, &name); break;
+	}
+}
+
+void GpuMemory::SetBytes(GpuObjectType type, GLuint name, size_t bytes)
+{
+	EntryMap::iterator it = entries.find(std::make_pair((int)type, name));
+	if (it == entries.end())
+		return;
+
+	categoryBytes[it->second.category] += bytes - it->second.bytes;
+	it->second.bytes = bytes;
+}
+
+size_t GpuMemory::TextureBytes(GLenum target, GLuint texture)
+{
+	GLenum faces[6] = { target };
+	int faceCount = 1;
+	if (target == GL_TEXTURE_CUBE_MAP)
+	{
+		for (int i = 0; i < 6; i++)
+			faces[i] = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
+		faceCount = 6;
+	}
+
+	size_t bytes = 0;
+	GLState::BindTexture(target, texture);
+	for (int face = 0; face < faceCount; face++)
+	{
+		for (int level = 0; level < 16; level++)
+		{
+			GLint width = 0, height = 0, compressed = 0;
+			glGetTexLevelParameteriv(faces[face], level, GL_TEXTURE_WIDTH, &width);
+			glGetTexLevelParameteriv(faces[face], level, GL_TEXTURE_HEIGHT, &height);
+			if (width == 0 || height == 0)
+				break;
+
+			// Uncompressed formats are taken as four bytes a texel, close enough for RGB8 and RGBA8
+			glGetTexLevelParameteriv(faces[face], level, GL_TEXTURE_COMPRESSED, &compressed);
+			if (compressed)
+			{
+				GLint size = 0;
+				glGetTexLevelParameteriv(faces[face], level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+				bytes += size;
+			}
+			else
+				bytes += (size_t)width * height * 4;
+		}
+	}
+	GLState::BindTexture(target, GL_NONE);
+	return bytes;
+}
+
+void GpuMemory::SetEvictable(GLuint texture, EvictFunction evict, void* owner)
+{
+	EntryMap::iterator it = entries.find(std::make_pair((int)GPU_TEXTURE, texture));
+	if (it == entries.end())
+		return;
+
+	it->second.evict = evict;
+	it->second.owner = owner;
+}
+
+void GpuMemory::Touch(GLuint texture)
+{
+	EntryMap::iterator it = entries.find(std::make_pair((int)GPU_TEXTURE, texture));
+	if (it != entries.end())
+		it->second.lastUse = frame;
+}
+
+size_t GpuMemory::TotalBytes()
+{
+	size_t total = 0;
+	for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+		total += categoryBytes[i];
+	return total;
+}
+
+size_t GpuMemory::StreamingBudget()
+{
+	size_t fixed = TotalBytes() - categoryBytes[MEMORY_STREAMED];
+	return fixed < budget ? budget - fixed : 0;
+}
+
+static bool LeastRecent(const std::pair<unsigned int, GLuint>& a, const std::pair<unsigned int, GLuint>& b)
+{
+	return a.first < b.first;
+}
+
+void GpuMemory::EndFrame()
+{
+	if (TotalBytes() > budget)
+	{
+		PROFILE_SCOPE("Memory Budget");
+
+		// Anything drawn this frame is left to the streamer, which knows how much detail it's showing
+		ArenaVector<std::pair<unsigned int, GLuint> > victims(Arena::Frame());
+		for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+			if (it->second.evict && it->second.lastUse != frame && it->second.bytes > 0)
+				victims.push_back(std::make_pair(it->second.lastUse, it->first.second));
+		std::sort(victims.begin(), victims.end(), LeastRecent);
+
+		for (size_t i = 0; i < victims.size() && TotalBytes() > budget; i++)
+		{
+			const Entry& entry = entries[std::make_pair((int)GPU_TEXTURE, victims[i].second)];
+			while (TotalBytes() > budget && entry.evict(victims[i].second, entry.owner) > 0)
+				;
+		}
+	}
+
+	frame++;
+}
+
+const char* GpuMemory::CategoryName(MemoryCategory category)
+{
+	return categoryNames[category];
+}
+
+void GpuMemory::ReportLeaks()
+{
+	for (EntryMap::iterator it = entries.begin(); it != entries.end(); ++it)
+		printf("leaked %s %u (%s, %u bytes)\n", typeNames[it->first.first], it->first.second,
+			categoryNames[it->second.category], (unsigned int)it->second.bytes);
+}
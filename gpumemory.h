@@ -0,0 +1,126 @@
+/**************************************************
+ *
+ *                 GpuMemory.h
+ *
+ *  Every texture, buffer, vertex array and render
+ *  buffer we make, with the bytes it holds on the
+ *  GPU, under one budget. Handles delete their GL
+ *  object when they go out of scope.
+ *
+ ***************************************************/
+
+#ifndef GPUMEMORY_H
+#define GPUMEMORY_H
+
+#include <GL/gl3w.h>
+
+#include <map>
+#include <stddef.h>
+
+enum MemoryCategory
+{
+    MEMORY_TEXTURES,            // Loaded once and kept, the skybox
+    MEMORY_STREAMED,            // Planet maps, the only ones that can give memory back
+    MEMORY_TARGETS,             // HDR scene and bloom chain
+    MEMORY_GEOMETRY,            // Vertex buffers and arrays of the primitives and meshes
+    MEMORY_BUFFERS,             // Belt, occluder and other data buffers
+    MEMORY_CATEGORY_COUNT
+};
+
+enum GpuObjectType
+{
+    GPU_TEXTURE,
+    GPU_BUFFER,
+    GPU_VERTEX_ARRAY,
+    GPU_RENDERBUFFER
+};
+
+// Asked to free some of a streamed texture. Returns the bytes it gave back, 0 once there's nothing left to give
+typedef size_t (*EvictFunction)(GLuint texture, void* owner);
+
+class GpuMemory
+{
+public:
+    static size_t budget;       // Bytes for everything, streamed textures get whatever the rest leave
+
+    static GLuint Create(GpuObjectType type, MemoryCategory category);
+    static void Adopt(GpuObjectType type, GLuint name, MemoryCategory category);   // Made by someone else, SOIL
+    static void Destroy(GpuObjectType type, GLuint name);
+    static void SetBytes(GpuObjectType type, GLuint name, size_t bytes);
+
+    // Sums every face and level GL has for the texture, for ones we didn't fill in ourselves
+    static size_t TextureBytes(GLenum target, GLuint texture);
+
+    // Streamed textures. Ones that haven't been drawn for longest are asked to give memory back first
+    static void SetEvictable(GLuint texture, EvictFunction evict, void* owner);
+    static void Touch(GLuint texture);
+
+    // Evicts least recently drawn streamed textures while we're over budget
+    static void EndFrame();
+
+    static size_t Bytes(MemoryCategory category) { return categoryBytes[category]; }
+    static int Count(MemoryCategory category) { return categoryCount[category]; }
+    static size_t TotalBytes();
+    static size_t StreamingBudget();
+    static const char* CategoryName(MemoryCategory category);
+
+    // Anything still alive at shutdown is a leak
+    static void ReportLeaks();
+
+private:
+    struct Entry
+    {
+        MemoryCategory category;
+        size_t bytes;
+        unsigned int lastUse;   // Frame it was last drawn with
+        EvictFunction evict;
+        void* owner;
+    };
+
+    typedef std::map<std::pair<int, GLuint>, Entry> EntryMap;
+    static EntryMap entries;
+    static size_t categoryBytes[MEMORY_CATEGORY_COUNT];
+    static int categoryCount[MEMORY_CATEGORY_COUNT];
+    static unsigned int frame;
+};
+
+// Owns one GL object. Moves, doesn't copy. Anything kept past the GL context has to be Reset() before it goes
+template <GpuObjectType type>
+class GpuHandle
+{
+public:
+    GpuHandle() : name(0) {}
+    ~GpuHandle() { Reset(); }
+
+    GpuHandle(GpuHandle&& other) : name(other.name) { other.name = 0; }
+    GpuHandle& operator=(GpuHandle&& other)
+    {
+        if (this != &other)
+        {
+            Reset();
+            name = other.name;
+            other.name = 0;
+        }
+        return *this;
+    }
+
+    void Create(MemoryCategory category) { Reset(); name = GpuMemory::Create(type, category); }
+    void Adopt(GLuint object, MemoryCategory category) { Reset(); name = object; GpuMemory::Adopt(type, name, category); }
+    void Reset() { if (name) GpuMemory::Destroy(type, name); name = 0; }
+    void SetBytes(size_t bytes) { GpuMemory::SetBytes(type, name, bytes); }
+
+    operator GLuint() const { return name; }
+
+private:
+    GpuHandle(const GpuHandle&);
+    GpuHandle& operator=(const GpuHandle&);
+
+    GLuint name;
+};
+
+typedef GpuHandle<GPU_TEXTURE> TextureHandle;
+typedef GpuHandle<GPU_BUFFER> BufferHandle;
+typedef GpuHandle<GPU_VERTEX_ARRAY> VertexArrayHandle;
+typedef GpuHandle<GPU_RENDERBUFFER> RenderbufferHandle;
+
+#endif
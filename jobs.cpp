@@ -0,0 +1,137 @@
+/*****************************************
+ *
+ *           Jobs.cpp
+ *
+ *  Chunks are handed out through one atomic
+ *  counter. Workers sleep on a condition
+ *  variable between ranges.
+ *
+ ****************************************/
+
+#include "jobs.h"
+#include "profiler.h"
+
+#include <stdio.h>
+
+std::vector<std::thread> Jobs::workers;
+std::mutex Jobs::owner;
+std::mutex Jobs::mutex;
+std::condition_variable Jobs::wake;
+std::condition_variable Jobs::done;
+bool Jobs::quit = false;
+unsigned int Jobs::generation = 0;
+int Jobs::busy = 0;
+
+JobFunction Jobs::function = NULL;
+void* Jobs::functionData = NULL;
+int Jobs::itemCount = 0;
+int Jobs::grainSize = 1;
+std::atomic<int> Jobs::nextChunk(0);
+std::atomic<int> Jobs::chunksLeft(0);
+
+void Jobs::Initialize(int count)
+{
+	if (!workers.empty())
+		return;
+
+	if (count <= 0)
+		count = (int)std::thread::hardware_concurrency() - 1;
+	if (count <= 0)
+		return;                     // Single core, everything runs inline
+
+	quit = false;
+	for (int i = 0; i < count; i++)
+		workers.push_back(std::thread(WorkerLoop, i + 1));
+}
+
+void Jobs::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+}
+
+void Jobs::RunChunks(int worker)
+{
+	int chunks = (itemCount + grainSize - 1) / grainSize;
+	for (int chunk = nextChunk++; chunk < chunks; chunk = nextChunk++)
+	{
+		int begin = chunk * grainSize;
+		int end = begin + grainSize < itemCount ? begin + grainSize : itemCount;
+		function(begin, end, worker, functionData);
+
+		--chunksLeft;
+	}
+}
+
+void Jobs::ParallelFor(int count, int grain, JobFunction fn, void* data)
+{
+	if (grain < 1)
+		grain = 1;
+	// The simulation thread's n-body passes and the render thread's draw recording can overlap,
+	// whoever comes second does its range alone instead of waiting
+	std::unique_lock<std::mutex> ownerLock(owner, std::defer_lock);
+	if (count <= grain || workers.empty() || !ownerLock.try_lock())
+	{
+		if (count > 0)
+			fn(0, count, 0, data);
+		return;
+	}
+
+	PROFILE_SCOPE("Parallel For");
+
+	{
+		// A worker that woke late for the last range may still be reading it
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [] { return busy == 0; });
+
+		function = fn;
+		functionData = data;
+		itemCount = count;
+		grainSize = grain;
+		chunksLeft = (count + grain - 1) / grain;
+		nextChunk = 0;
+		generation++;
+	}
+	wake.notify_all();
+
+	RunChunks(0);
+
+	// Workers that picked up a chunk may still be running it
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [] { return chunksLeft == 0 && busy == 0; });
+}
+
+void Jobs::WorkerLoop(int worker)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "Worker %d", worker);
+	Profiler::SetThreadName(name);
+
+	unsigned int seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+			busy++;
+		}
+
+		RunChunks(worker);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy--;
+		}
+		done.notify_all();
+	}
+}
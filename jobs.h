@@ -0,0 +1,58 @@
+/**************************************************
+ *
+ *                 Jobs.h
+ *
+ *  A small pool of worker threads that split a
+ *  range of items between them. The calling
+ *  thread works on the range too and returns once
+ *  every item is done.
+ *
+ ***************************************************/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+
+// Gets [begin, end) of the range. Worker is 0 on the calling thread and 1..WorkerCount() on the pool,
+// so per-worker output can go in an array without locking
+typedef void (*JobFunction)(int begin, int end, int worker, void* data);
+
+class Jobs
+{
+public:
+    // Zero picks one thread per core, leaving one for the caller
+    static void Initialize(int workers = 0);
+    static void Shutdown();
+
+    // Runs fn over [0, count) in chunks of grain items. Ranges of one chunk or less run inline, and so do
+    // ranges started while the pool is busy with another thread's, so any thread can call it
+    static void ParallelFor(int count, int grain, JobFunction fn, void* data);
+
+    static int WorkerCount() { return (int)workers.size(); }
+
+private:
+    static void WorkerLoop(int worker);
+    static void RunChunks(int worker);
+
+    static std::vector<std::thread> workers;
+    static std::mutex owner;            // Held by the thread whose range the pool is working on
+    static std::mutex mutex;
+    static std::condition_variable wake, done;
+    static bool quit;
+    static unsigned int generation;     // Bumped for every ParallelFor, so sleeping workers know there's work
+    static int busy;                    // Workers inside RunChunks, the range can't change under them
+
+    // The range being worked on
+    static JobFunction function;
+    static void* functionData;
+    static int itemCount, grainSize;
+    static std::atomic<int> nextChunk;
+    static std::atomic<int> chunksLeft;
+};
+
+#endif
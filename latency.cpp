@@ -0,0 +1,115 @@
+/*****************************************
+ *
+ *           Latency.cpp
+ *
+ *  A fence after every swap tells us when
+ *  the GPU got through a frame, which is
+ *  as close to the photons as GL can see.
+ *
+ ****************************************/
+
+#include "latency.h"
+
+#include <string.h>
+
+GLFWkeyfun FrameLatency::previousKey = 0;
+GLFWcursorposfun FrameLatency::previousCursor = 0;
+double FrameLatency::pendingEvent = -1.0;
+
+FrameLatency::FrameLatency()
+{
+	lowLatency = true;
+	measuring = false;
+	latchedEvent = -1.0;
+	sampleCount = 0;
+	memset(history, 0, sizeof(history));
+}
+
+void FrameLatency::Install(GLFWwindow* window)
+{
+	previousKey = glfwSetKeyCallback(window, OnKey);
+	previousCursor = glfwSetCursorPosCallback(window, OnCursor);
+}
+
+// GLFW only hands events over inside glfwPollEvents, so these stamps are the first moment we could have seen them
+void FrameLatency::OnKey(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+	if (pendingEvent < 0.0)
+		pendingEvent = glfwGetTime();
+	if (previousKey)
+		previousKey(window, key, scancode, action, mods);
+}
+
+void FrameLatency::OnCursor(GLFWwindow* window, double x, double y)
+{
+	if (pendingEvent < 0.0)
+		pendingEvent = glfwGetTime();
+	if (previousCursor)
+		previousCursor(window, x, y);
+}
+
+void FrameLatency::Latch()
+{
+	if (latchedEvent < 0.0)
+		latchedEvent = pendingEvent;
+	pendingEvent = -1.0;
+}
+
+void FrameLatency::Retire(Frame& frame, double now)
+{
+	glDeleteSync(frame.fence);
+	if (!measuring || frame.event < 0.0)
+		return;
+
+	memmove(history, history + 1, sizeof(float) * (historySize - 1));
+	history[historySize - 1] = (float)((now - frame.event) * 1000.0);
+	if (sampleCount < historySize)
+		sampleCount++;
+}
+
+void FrameLatency::BeginFrame()
+{
+	// Frames the GPU has already finished. Without a wait we only notice when we look,
+	// so outside low latency mode the numbers are rounded up to the next frame
+	while (!inFlight.empty())
+	{
+		bool wait = lowLatency || (int)inFlight.size() > maxFramesInFlight;
+		GLenum status = glClientWaitSync(inFlight.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+		if (status == GL_TIMEOUT_EXPIRED)          // <- Still running, even after a second's wait it's checked again next frame
+			break;
+
+		if (status == GL_WAIT_FAILED)              // <- Nothing to time against, drop the fence without a sample
+			glDeleteSync(inFlight.front().fence);
+		else
+			Retire(inFlight.front(), glfwGetTime());
+		inFlight.pop_front();
+	}
+}
+
+void FrameLatency::FrameSwapped()
+{
+	Frame frame;
+	frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	frame.event = latchedEvent;
+	inFlight.push_back(frame);
+	latchedEvent = -1.0;
+}
+
+float FrameLatency::AverageMs() const
+{
+	if (sampleCount == 0)
+		return 0.0f;
+
+	float sum = 0.0f;
+	for (int i = historySize - sampleCount; i < historySize; i++)
+		sum += history[i];
+	return sum / sampleCount;
+}
+
+float FrameLatency::WorstMs() const
+{
+	float worst = 0.0f;
+	for (int i = historySize - sampleCount; i < historySize; i++)
+		worst = history[i] > worst ? history[i] : worst;
+	return worst;
+}
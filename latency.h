@@ -0,0 +1,69 @@
+/**************************************************
+ *
+ *                 Latency.h
+ *
+ *  Keeps the CPU from queueing frames ahead of the
+ *  GPU, and times input events against the frame
+ *  that first showed them finishing on the GPU.
+ *
+ ***************************************************/
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+
+#include <deque>
+
+class FrameLatency
+{
+public:
+    FrameLatency();
+
+    // Chains onto whatever key and cursor callbacks are already installed (ImGui's)
+    void Install(GLFWwindow* window);
+
+    // Call before polling input. Retires finished frames, and with lowLatency waits for the last one
+    void BeginFrame();
+
+    // Call whenever the camera samples input, the earliest event it hasn't reported yet joins this frame
+    void Latch();
+
+    // Call right after the swap
+    void FrameSwapped();
+
+    bool lowLatency;                // At most one frame in flight
+    bool measuring;
+
+    float AverageMs() const;
+    float WorstMs() const;
+    int Samples() const { return sampleCount; }
+    const float* History() const { return history; }
+    static const int historySize = 120;
+
+private:
+    struct Frame
+    {
+        GLsync fence;
+        double event;               // When the oldest input this frame shows arrived, -1 for none
+    };
+
+    void Retire(Frame& frame, double now);
+
+    static void OnKey(GLFWwindow* window, int key, int scancode, int action, int mods);
+    static void OnCursor(GLFWwindow* window, double x, double y);
+    static GLFWkeyfun previousKey;
+    static GLFWcursorposfun previousCursor;
+    static double pendingEvent;
+
+    static const int maxFramesInFlight = 4;
+
+    std::deque<Frame> inFlight;
+    double latchedEvent;
+
+    float history[historySize];     // Milliseconds, oldest first
+    int sampleCount;
+};
+
+#endif
@@ -23,10 +23,30 @@
 #include <iostream> // Used for std::cout
 #include <vector>   // Used for std::vector<vec3>
 #include <map>      // Used for std::map
+#include <string.h> // Used for strcmp
+#include <stdlib.h> // Used for strtoul
 
 // Custom headers
 #include "shaders.h"
 #include "mesh.h"
+#include "postprocess.h"
+#include "transform.h"
+#include "simulation.h"
+#include "minorplanets.h"
+#include "gpubelt.h"
+#include "replay.h"
+#include "texturestream.h"
+#include "latency.h"
+#include "profiler.h"
+#include "glstate.h"
+#include "renderqueue.h"
+#include "jobs.h"
+#include "gpumemory.h"
+#include "arena.h"
+#include "starfield.h"
+#include "capture.h"
+#include "regression.h"
+#include "bench.h"
 
 using namespace glm;
 
@@ -36,72 +56,261 @@ GLFWwindow* window;
 int width = 1280, height = 720;
 
 // Shader programs
-GLuint phongProgram, skyboxProgram, emissiveProgram;
+GLuint phongProgram, skyboxProgram, emissiveProgram, particleProgram;
 
 // Variables for uniforms
-mat4 projectionMatrix, viewMatrix, modelMatrix[11];
+mat4 projectionMatrix, viewMatrix, modelMatrix[11], normalMatrix[11];
 vec3 cameraPosition, cameraTarget, lightPosition;
 
 // Solar system variables
-float earthDays = 17.62f;
-float moonRotation = 0.0f;
 float simulationSpeed = 0.01f;
+bool simulationPaused = false;      // Holds the clock whatever the speed slider says, for the regression scenes
+float simulationRate = 240.0f;
 int viewMode = 3;
 
+// Fixed-step simulation, and the blend of its last two steps that we actually draw.
+// When threaded, the worker owns the simulation and hands us finished steps
+Simulation simulation;
+SimulationWorker simulationWorker;
+bool threadedSimulation = true;
+SimState sceneState;
+
+// Orbits for drawing, looked up from cached samples so scrubbing the timeline stays cheap
+Ephemeris sceneEphemeris;
+float jumpYear = 0.0f;
+
+// N-body mode, the belt and the asteroid fall under the planets' gravity instead of moving on rails
+bool nbodyMode = false;
+int beltCount = 20000;
+VertexArrayHandle beltVao;
+BufferHandle beltVbo;
+int beltVertices = 0;
+unsigned long long beltStepUploaded = 0;    // Simulation::BeltSteps() the in-thread path last uploaded
+std::vector<float> beltScratch;
+NBody::Report nbodyReport = {};
+
+// Outside n-body mode the belt just goes round on circular orbits, propagated on this thread
+MinorPlanets kinematicBelt;
+MinorPlanets::Report kernelReports[KERNEL_COUNT];
+int kernelReportCount = 0;
+
+// Where the compute shader path is there, the rails belt lives on the GPU instead
+bool gpuBelt = true;
+const float beltPointSize = 0.1f;
+const vec3 beltColour(0.8f, 0.75f, 0.7f);
+
+// Input recording and playback. Both run the simulation on this thread from a fresh seeded
+// state, so a replay sees exactly the frames the recording did
+InputRecorder recorder;
+InputReplay replay;
+unsigned int simulationSeed = 1;
+const char* replayPath = "replay.bin";
+bool exitAfterReplay = false;
+double replayStartTime = 0.0;
+
+// The free-cam samples input again right before the scene is drawn instead of at the top of
+// the frame, and the CPU is kept from queueing frames ahead of the GPU
+bool lateLatchCamera = true;
+bool cameraDeferred = false;
+FrameInput deferredCamera;
+FrameLatency frameLatency;
+double latencyReportTime = 0.0;
+
+// F9 writes the profiler's rings out as a Chrome trace, --trace also writes one on exit
+const char* tracePath = "trace.json";
+bool traceOnExit = false;
+bool traceKeyDown = false;
+
+// --capture records the tonemapped frames (no GUI) to Y4M or PNGs. While capturing the frame loop runs
+// on video time instead of the clock, so --headless with --frames renders offline as fast as the GPU goes
+FrameCapture capture;
+const char* capturePath = "capture.y4m";
+bool captureOnStart = false;
+bool headless = false;
+int captureFps = 60;
+int captureFrames = 0;              // Frames to capture before closing, 0 to keep going
+
+// --regress renders the fixed scenes against the goldens in the directory and exits non-zero on a
+// failure, --regress-update writes the goldens instead. Meant to run with --headless
+RenderRegression regression;
+const char* regressionPath = "regression";
+bool regressOnStart = false;
+bool regressUpdate = false;
+
+// --bench times Update() and the asset paths, prints the results, writes them as JSON and exits
+const char* benchPath = "bench.json";
+bool benchOnStart = false;
+
+// Planets drawn from tessellated patches, refined wherever their edges get long on screen. Needs GL 4.0
+GLuint phongTessProgram = 0;
+bool tessellatedPlanets = true;
+float pixelsPerEdge = 8.0f;
+
+// Bodies ray traced per pixel on a camera facing quad, exact silhouettes and depth at any distance
+GLuint phongImpostorProgram = 0, emissiveImpostorProgram = 0;
+bool impostorBodies = false;
+
+// HDR brightness of the sun, the bloom picks up anything above the threshold
+float sunIntensity = 6.0f;
+
+// HDR brightness of the cubemap sky, only used when the catalog stars are off
+float skyIntensity = 2.0f;
+
+// Background stars from the catalog as sprites, the cubemap is only loaded if they're switched off
+const char* starCatalogPath = ASSETS"stars.bin";
+bool catalogStars = true;
+
 // Textures
-GLuint skyboxTexture;
+TextureHandle skyboxTexture;
 GLuint diffuseTexture, specularTexture;
 GLuint moonTexture, sunTexture;
 GLuint mercuryTexture, venusTexture, marsTexture, jupiterTexture, saturnTexture, uranusTexture, neptuneTexture;
+GLuint bodyTextures[BODY_COUNT][2];     // Diffuse and specular map of every body
+
+// Draw packets for the frame, sorted by pass, program, distance and texture before they're drawn
+RenderQueue renderQueue;
+GLint planetModelLoc, planetNormLoc;
 
-bool ast = false;
-float astx;
-float astz;
-int multx;
-int multz;
-float valx;
-float valz;
+// Bodies per job when occluders and draw packets are worked out on the job workers. Small
+// scenes stay on the render thread, where handing the work out would cost more than doing it
+int recordGrain = 64;
 
-enum
+// Planet maps start with their small mips and stream detail in as bodies fill more of the screen
+TextureStreamer textureStreamer;
+
+// Eclipse occluders. Every body gets its own aligned slot in one uniform buffer
+const int MAX_OCCLUDERS = 4;
+const int OCCLUDER_BINDING = 0;
+struct OccluderBlock
 {
-	EARTH = 0,
-	SUN = 1,
-	MOON = 2,
-	MERCURY = 3,
-	VENUS = 4,
-	MARS = 5,
-	JUPITER = 6,
-	SATURN = 7,
-	URANUS = 8,
-	NEPTUNE = 9,
-	AST = 10
+	vec4 spheres[MAX_OCCLUDERS];	// xyz = centre, w = radius
+	int count;
+	int padding[3];
 };
+BufferHandle occluderBuffer;
+GLint occluderStride;
 
+// Transform hierarchy. Every body has a frame node that orbits (and carries its moons),
+// and a body node under it that spins and scales
+TransformGraph sceneGraph;
+int frameNode[BODY_COUNT];
+int bodyNode[BODY_COUNT];
 
-bool astDestroyed = false;
-bool moonDestroyed = false;
-bool mercuryDestroyed = false;
-bool venusDestroyed = false;
-bool earthDestroyed = false;
-bool marsDestroyed = false;
-bool jupiterDestroyed = false;
-bool saturnDestroyed = false;
-bool uranusDestroyed = false;
-bool neptuneDestroyed = false;
+void BuildSceneGraph()
+{
+	// Parents go in before children so the graph stays sorted parent-first
+	for (int body = 0; body < BODY_COUNT; body++)
+	{
+		if (bodyInfo[body].parent >= 0)
+			continue;
+		frameNode[body] = sceneGraph.AddNode(-1);
+		bodyNode[body] = sceneGraph.AddNode(frameNode[body]);
+	}
+	for (int body = 0; body < BODY_COUNT; body++)
+	{
+		if (bodyInfo[body].parent < 0)
+			continue;
+		frameNode[body] = sceneGraph.AddNode(frameNode[bodyInfo[body].parent]);
+		bodyNode[body] = sceneGraph.AddNode(frameNode[body]);
+	}
+}
+
+// Moves the graph to a (blended) simulation state. A zero scale gives zero model and
+// normal matrices, which is how destroyed bodies and the unlaunched asteroid disappear
+void PoseScene(const SimState& state)
+{
+	vec3 offsets[BODY_COUNT];
+	sceneEphemeris.Lookup(state.earthDays, offsets);
+
+	for (int body = 0; body < BODY_COUNT; body++)
+	{
+		// Orbits move each body's frame, the moon's frame hangs off the earth's so it follows it around.
+		// Spins live on the body nodes, so a planet's day doesn't drag its moons around with it
+		vec3 offset = body == AST ? state.asteroidPosition : offsets[body];
+		bool visible = !state.destroyed[body] && (body != AST || state.asteroidLaunched);
+
+		sceneGraph.SetTranslation(frameNode[body], offset);
+		if (visible)
+			sceneGraph.SetRotation(bodyNode[body], SpinAngle(body, state.earthDays), vec3(0, 1, 0));
+		sceneGraph.SetScale(bodyNode[body], vec3(visible ? bodyInfo[body].size : 0.0f));
+	}
+
+	sceneGraph.UpdateWorld();
+	for (int i = 0; i < BODY_COUNT; i++)
+	{
+		modelMatrix[i] = sceneGraph.World(bodyNode[i]);
+		normalMatrix[i] = sceneGraph.Normal(bodyNode[i]);
+	}
+}
+
+vec3 BodyPosition(int body)
+{
+	return sceneGraph.WorldPosition(bodyNode[body]);
+}
+
+// Loads in all 6 faces of the skybox cube, only needed when the catalog stars are off
+void LoadSkyboxCubemap()
+{
+	ProfileScope skyboxLoad("Texture Load", ASSETS"textures/star_sky/stars.png");
+	GLuint cubemap = SOIL_load_OGL_cubemap
+	(
+		ASSETS"textures/star_sky/stars.png", // posx
+		ASSETS"textures/star_sky/stars.png", // negx
+		ASSETS"textures/star_sky/stars.png", // posy
+		ASSETS"textures/star_sky/stars.png", // negy
+		ASSETS"textures/star_sky/stars.png", // posz
+		ASSETS"textures/star_sky/stars.png", // negz
+		SOIL_LOAD_RGB,      // This means we're expecting it to have RGB channels
+		SOIL_CREATE_NEW_ID, // This means we want to create a new texture instead of overwriting one 
+		SOIL_FLAG_MIPMAPS   // This means we want it to generate mip-maps.
+	);
+	skyboxLoad.End();
+	GLState::Invalidate();                                                  // <- SOIL binds the cubemap behind the state cache's back
+	skyboxTexture.Adopt(cubemap, MEMORY_TEXTURES);
+	skyboxTexture.SetBytes(GpuMemory::TextureBytes(GL_TEXTURE_CUBE_MAP, skyboxTexture));
+}
 
 void Initialize()
 {
+	PROFILE_SCOPE("Initialize");
+
+	// Workers for the occluder and draw recording jobs
+	Jobs::Initialize();
+
+	// The surface shading is linked into every program that draws that kind of body, meshes and impostors alike
+	GLuint phongShading = buildShader(GL_FRAGMENT_SHADER, ASSETS"phongShading.frag");
+	GLuint emissiveShading = buildShader(GL_FRAGMENT_SHADER, ASSETS"emissiveShading.frag");
+
 	// Make a simple shader for the sphere we're drawing
 	{
+		PROFILE_SCOPE("Build Shaders", "simpleLights");
 		GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"simpleLights.vert");
 		GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"simpleLights.frag");
-		phongProgram = buildProgram(vs, fs, 0);
+		phongProgram = buildProgram(vs, fs, phongShading, 0);
 		phongProgram = linkProgram(phongProgram);
 		dumpProgram(phongProgram, "Simple program for phong lighting");
 	}
 
+	// The same lighting on a sphere that the tessellation stages build from a coarse patch mesh
+	if (gl3wIsSupported(4, 0))
+	{
+		PROFILE_SCOPE("Build Shaders", "sphereTess");
+		GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"sphereTess.vert");
+		GLuint tcs = buildShader(GL_TESS_CONTROL_SHADER, ASSETS"sphereTess.tesc");
+		GLuint tes = buildShader(GL_TESS_EVALUATION_SHADER, ASSETS"sphereTess.tese");
+		GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"simpleLights.frag");
+		if (vs && tcs && tes && fs && phongShading)
+			phongTessProgram = linkProgram(buildProgram(vs, tcs, tes, fs, phongShading, 0));
+	}
+	if (!phongTessProgram)
+	{
+		printf("no tessellation shaders, planets stay on the fixed sphere\n");
+		tessellatedPlanets = false;
+	}
+
 	// Make a simple shader for the skybox
 	{
+		PROFILE_SCOPE("Build Shaders", "skybox");
 		GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"skybox.vert");
 		GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"skybox.frag");
 		skyboxProgram = buildProgram(vs, fs, 0);
@@ -111,139 +320,288 @@ void Initialize()
 
 	// Make a simple shader for the sun
 	{
+		PROFILE_SCOPE("Build Shaders", "emissive");
 		GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"emissive.vert");
 		GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"emissive.frag");
-		emissiveProgram = buildProgram(vs, fs, 0);
+		emissiveProgram = buildProgram(vs, fs, emissiveShading, 0);
 		emissiveProgram = linkProgram(emissiveProgram);
 		dumpProgram(emissiveProgram, "Simple program for the sun");
 	}
 
-	// Load in all 6 faces of the skybox cube
-	skyboxTexture = SOIL_load_OGL_cubemap
-	(
-		ASSETS"textures/star_sky/stars.png", // posx
-		ASSETS"textures/star_sky/stars.png", // negx
-		ASSETS"textures/star_sky/stars.png", // posy
-		ASSETS"textures/star_sky/stars.png", // negy
-		ASSETS"textures/star_sky/stars.png", // posz
-		ASSETS"textures/star_sky/stars.png", // negz
-		SOIL_LOAD_RGB,      // This means we're expecting it to have RGB channels
-		SOIL_CREATE_NEW_ID, // This means we want to create a new texture instead of overwriting one 
-		SOIL_FLAG_MIPMAPS   // This means we want it to generate mip-maps.
-	);
+	// Sphere impostors for the planets and the sun, they share the quad and ray setup and differ in the shading
+	{
+		PROFILE_SCOPE("Build Shaders", "sphereImpostor");
+		GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"sphereImpostor.vert");
+		GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"sphereImpostor.frag");
+		if (vs && fs && phongShading && emissiveShading)
+		{
+			phongImpostorProgram = linkProgram(buildProgram(vs, fs, phongShading, 0));
+			emissiveImpostorProgram = linkProgram(buildProgram(vs, fs, emissiveShading, 0));
+		}
+	}
+	if (!phongImpostorProgram || !emissiveImpostorProgram)
+	{
+		printf("no impostor shaders, bodies stay as meshes\n");
+		impostorBodies = false;
+	}
 
-	diffuseTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/earthDiffuse.png",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_MIPMAPS | SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
+	// Make a point sprite shader for the belt particles
+	{
+		PROFILE_SCOPE("Build Shaders", "particles");
+		GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"particles.vert");
+		GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"particles.frag");
+		particleProgram = buildProgram(vs, fs, 0);
+		particleProgram = linkProgram(particleProgram);
+		dumpProgram(particleProgram, "Simple program for the belt particles");
+	}
 
-	specularTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/earthSpecular.png",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
+	// Compute shader belt, falls back to the CPU one without GL 4.3
+	{
+		PROFILE_SCOPE("Build Shaders", "beltGpu");
+		GpuBelt::Initialize();
+	}
 
-	moonTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/moonTexture.png",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
+	// Positions for the belt, refilled whenever the simulation publishes a step
+	{
+		beltVao.Create(MEMORY_GEOMETRY);
+		beltVbo.Create(MEMORY_BUFFERS);
+		GLState::BindVertexArray(beltVao);
+		GLState::BindBuffer(GL_ARRAY_BUFFER, beltVbo);
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		GLState::BindVertexArray(GL_NONE);
+		GLState::BindBuffer(GL_ARRAY_BUFFER, GL_NONE);
+	}
 
-	mercuryTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/mercurymap.jpg",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
-	venusTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/venusTexture.jpg",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
-	marsTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/marsTexture.jpg",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
-	jupiterTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/jupiterTexture.jpg",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
-	saturnTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/saturnTexture.jpg",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
-	uranusTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/uranusTexture.jpg",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
-	neptuneTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/neptuneTexture.jpg",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
+	// Bloom and tonemapping programs
+	{
+		PROFILE_SCOPE("Build Shaders", "postprocess");
+		PostProcess::Initialize();
+	}
 
-	sunTexture = SOIL_load_OGL_texture
-	(
-		ASSETS"textures/sunTexture.png",
-		SOIL_LOAD_AUTO,
-		SOIL_CREATE_NEW_ID,
-		SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT
-	);
+	// Uniform buffer for the eclipse occluders, one std140 block per body
+	{
+		GLint alignment;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		occluderStride = (GLint)((sizeof(OccluderBlock) + alignment - 1) / alignment) * alignment;
+
+		occluderBuffer.Create(MEMORY_BUFFERS);
+		GLState::BindBuffer(GL_UNIFORM_BUFFER, occluderBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, occluderStride * BODY_COUNT, NULL, GL_DYNAMIC_DRAW);
+		occluderBuffer.SetBytes(occluderStride * BODY_COUNT);
+		GLState::BindBuffer(GL_UNIFORM_BUFFER, GL_NONE);
+
+		glUniformBlockBinding(phongProgram, glGetUniformBlockIndex(phongProgram, "Occluders"), OCCLUDER_BINDING);
+		if (phongTessProgram)
+			glUniformBlockBinding(phongTessProgram, glGetUniformBlockIndex(phongTessProgram, "Occluders"), OCCLUDER_BINDING);
+		if (phongImpostorProgram)
+			glUniformBlockBinding(phongImpostorProgram, glGetUniformBlockIndex(phongImpostorProgram, "Occluders"), OCCLUDER_BINDING);
+	}
+
+	// Catalog stars for the background, when they can't be drawn the cubemap is loaded straight away instead
+	if (!StarField::Initialize(starCatalogPath))
+		LoadSkyboxCubemap();
+
+	diffuseTexture = textureStreamer.Load(ASSETS"textures/earthDiffuse.png");
+	specularTexture = textureStreamer.Load(ASSETS"textures/earthSpecular.png");
+	moonTexture = textureStreamer.Load(ASSETS"textures/moonTexture.png");
+	mercuryTexture = textureStreamer.Load(ASSETS"textures/mercurymap.jpg");
+	venusTexture = textureStreamer.Load(ASSETS"textures/venusTexture.jpg");
+	marsTexture = textureStreamer.Load(ASSETS"textures/marsTexture.jpg");
+	jupiterTexture = textureStreamer.Load(ASSETS"textures/jupiterTexture.jpg");
+	saturnTexture = textureStreamer.Load(ASSETS"textures/saturnTexture.jpg");
+	uranusTexture = textureStreamer.Load(ASSETS"textures/uranusTexture.jpg");
+	neptuneTexture = textureStreamer.Load(ASSETS"textures/neptuneTexture.jpg");
+	sunTexture = textureStreamer.Load(ASSETS"textures/sunTexture.png");
+
+	const GLuint textures[BODY_COUNT][2] =
+	{
+		{ diffuseTexture, specularTexture },    // EARTH
+		{ sunTexture, sunTexture },             // SUN
+		{ moonTexture, moonTexture },           // MOON
+		{ mercuryTexture, mercuryTexture },     // MERCURY
+		{ venusTexture, venusTexture },         // VENUS
+		{ marsTexture, marsTexture },           // MARS
+		{ jupiterTexture, jupiterTexture },     // JUPITER
+		{ saturnTexture, saturnTexture },       // SATURN
+		{ uranusTexture, uranusTexture },       // URANUS
+		{ neptuneTexture, neptuneTexture },     // NEPTUNE
+		{ moonTexture, neptuneTexture },        // AST
+	};
+	memcpy(bodyTextures, textures, sizeof(bodyTextures));
 
 	cameraPosition = vec3(0, 0, -5);
 	cameraTarget = vec3(0, 0, 0);
+
+	BuildSceneGraph();
+	sceneEphemeris.SetOrbits(bodyOrbits, BODY_COUNT);
+
+	// Seeded before the worker takes it over, this thread leaves it alone until the worker stops
+	simulation.Reset(simulationSeed);
+	if (threadedSimulation)
+		simulationWorker.Start(&simulation);
+}
+
+
+void UploadBelt(const std::vector<float>& positions)
+{
+	beltVertices = (int)positions.size() / 3;
+	if (beltVertices == 0)
+		return;
+
+	// Orphan the old storage so we never wait on a draw that's still reading it
+	GLState::BindVertexArray(beltVao);
+	GLState::BindBuffer(GL_ARRAY_BUFFER, beltVbo);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(float), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, positions.size() * sizeof(float), &positions[0]);
+	beltVbo.SetBytes(positions.size() * sizeof(float));
+
+	// Positions come as runs of x, y and z, one attribute each
+	for (int axis = 0; axis < 3; axis++)
+		glVertexAttribPointer(axis, 1, GL_FLOAT, GL_FALSE, 0, (void*)(axis * beltVertices * sizeof(float)));
+
+	GLState::BindVertexArray(GL_NONE);
+	GLState::BindBuffer(GL_ARRAY_BUFFER, GL_NONE);
 }
 
+bool UseGpuBelt()
+{
+	return !nbodyMode && gpuBelt && GpuBelt::Available();
+}
+
+// Everything a frame reads from the keyboard and mouse, in one place so it can be recorded
+FrameInput PollInput(float deltaTime)
+{
+	FrameInput input;
+	input.deltaTime = deltaTime;
+	input.viewMode = (unsigned char)viewMode;
+	input.keys = 0;
+	if (glfwGetKey(window, GLFW_KEY_W)) input.keys |= INPUT_W;
+	if (glfwGetKey(window, GLFW_KEY_S)) input.keys |= INPUT_S;
+	if (glfwGetKey(window, GLFW_KEY_A)) input.keys |= INPUT_A;
+	if (glfwGetKey(window, GLFW_KEY_D)) input.keys |= INPUT_D;
+	if (glfwGetKey(window, GLFW_KEY_P)) input.keys |= INPUT_P;
+
+	POINT p = {};
+	GetCursorPos(&p);
+	input.cursorX = (short)p.x;
+	input.cursorY = (short)p.y;
+
+	frameLatency.Latch();
+	return input;
+}
+
+// Replays have to move the camera with the input they recorded, so they never late latch
+bool LateLatching()
+{
+	return lateLatchCamera && !replay.Playing() && !recorder.Recording();
+}
+
+void JumpToYear(float year)
+{
+	jumpYear = year;
+	double days = year * 365.25;
+	if (simulationWorker.Running())
+		simulationWorker.RequestJump(days);
+	else
+		simulation.JumpTo(days);
+}
+
+ReplaySettings CurrentSettings()
+{
+	ReplaySettings settings;
+	settings.simulationSpeed = simulationSpeed;
+	settings.simulationRate = simulationRate;
+	settings.beltCount = beltCount;
+	settings.nbody = nbodyMode;
+	settings.jumpYear = jumpYear;
+	return settings;
+}
+
+void ApplySettings(const ReplaySettings& settings)
+{
+	simulationSpeed = settings.simulationSpeed;
+	simulationRate = settings.simulationRate;
+	beltCount = settings.beltCount;
+	nbodyMode = settings.nbody != 0;
+
+	// The slider only moves when someone jumps, so a new value is a jump
+	if (settings.jumpYear != jumpYear)
+		JumpToYear(settings.jumpYear);
+}
+
+// The worker steps on wall clock time, so repeatable runs step here off the frame times instead
+void BeginRepeatableRun(unsigned int seed, const mat4& view)
+{
+	simulationWorker.Stop();
+	threadedSimulation = false;
+	simulation.Reset(seed);
+	viewMatrix = view;
+}
+
+void StartRecording()
+{
+	if (!recorder.Start(replayPath, simulationSeed, viewMatrix, CurrentSettings()))
+		return;
+	BeginRepeatableRun(simulationSeed, viewMatrix);
+	printf("recording input to %s\n", replayPath);
+}
 
-mat4 updateCam(float deltaTime)
+void StartReplay()
+{
+	recorder.Stop();
+	if (!replay.Open(replayPath))
+		return;
+	// Recordings start from a reset simulation whatever the slider said, so no jump here
+	jumpYear = replay.Settings().jumpYear;
+	ApplySettings(replay.Settings());
+	BeginRepeatableRun(replay.Seed(), replay.View());
+	replayStartTime = glfwGetTime();
+	printf("replaying %s\n", replayPath);
+}
+
+void StopReplay()
+{
+	double seconds = glfwGetTime() - replayStartTime;
+	printf("replayed %d frames in %.2f s, %.3f ms a frame\n", replay.Frame(), seconds, replay.Frame() > 0 ? seconds * 1000.0 / replay.Frame() : 0.0);
+	replay.Close();
+
+	if (exitAfterReplay)
+		glfwSetWindowShouldClose(window, 1);
+}
+
+// Video time only reaches the simulation when it steps on this thread, the worker runs on the wall clock.
+// Replays and recordings already step here from their own seed
+void StartCapture()
+{
+	if (!capture.Start(capturePath, width, height, captureFps))
+		return;
+	if (!replay.Playing() && !recorder.Recording())
+		BeginRepeatableRun(simulationSeed, viewMatrix);
+}
+
+mat4 updateCam(const FrameInput& input)
 {
 	//using namespace glm;
+	float deltaTime = input.deltaTime;
 
 	auto left = vec3(column(viewMatrix, 0));
 	auto up = vec3(column(viewMatrix, 1));
 	auto forward = vec3(column(viewMatrix, 2));
 	cameraPosition = vec3(column(viewMatrix, 3));
 
-	if (glfwGetKey(window, GLFW_KEY_W)) // Move forward
+	if (input.keys & INPUT_W) // Move forward
 		cameraPosition -= forward * deltaTime * 4.0f;
-	if (glfwGetKey(window, GLFW_KEY_S)) // Move backward
+	if (input.keys & INPUT_S) // Move backward
 		cameraPosition += forward * deltaTime * 4.0f;
-	if (glfwGetKey(window, GLFW_KEY_A)) // Move Left
+	if (input.keys & INPUT_A) // Move Left
 		cameraPosition -= left * deltaTime * 4.0f;
-	if (glfwGetKey(window, GLFW_KEY_D)) // Move right
+	if (input.keys & INPUT_D) // Move right
 		cameraPosition += left * deltaTime * 4.0f;
-	POINT p;
-	if (GetCursorPos(&p))
-	{
-		//cursor position now in p.x and p.y
-	}
 
-	float ox = p.x;
-	float oy = p.y;
+	float ox = input.cursorX;
+	float oy = input.cursorY;
 
 	
 	if (ox<((width / 2)-100))
@@ -287,323 +645,85 @@ mat4 updateCam(float deltaTime)
 
 
 
-void Update(float deltaTime)
+void Update(const FrameInput& frame)
 {
-	mat4 identity, translation, scaling, rotation;
-	identity = mat4(1.0f);
-	const float pi2 = 2.0f * pi<float>();
-
-	// Add to the rotation, in days.
-	earthDays += deltaTime * simulationSpeed;
-
-	float planetRotations = earthDays;
-
-
-
-	// Compute orbits and rotations
-	float earthOrbit = (planetRotations / 365.0f) * pi2;
-	float earthRotate = fract(planetRotations) * pi2;
-	float moonOrbit = (planetRotations / 27.322f) * pi2;
-	float moonRotate = -fract(planetRotations / 27.0f) * pi2;
-
-	float mercuryOrbit = (planetRotations / 87.97f) * pi2;
-	float mercuryRotate = fract(planetRotations / 58.6f) * pi2;
-
-	float venusOrbit = (planetRotations / 224.7f) * pi2;
-	float venusRotate = fract(planetRotations / 243.0f) * pi2;
-
-
-
-	float marsOrbit = (planetRotations / 686.2f) * pi2;
-	float marsRotate = fract(planetRotations / 1.03f) * pi2;
-
-	float jupiterOrbit = (planetRotations / 4328.9f) * pi2;
-	float jupiterRotate = fract(planetRotations / 0.41f) * pi2;
-
-	float saturnOrbit = (planetRotations / 10752.9f) * pi2;
-	float saturnRotate = fract(planetRotations / 0.45f) * pi2;
+	PROFILE_SCOPE("Update");
 
-	float uranusOrbit = (planetRotations / 30663.65f) * pi2;
-	float uranusRotate = fract(planetRotations / 0.72f) * pi2;
+	float deltaTime = frame.deltaTime;
+	viewMode = frame.viewMode;
 
-	float neptuneOrbit = (planetRotations / 60148.35f) * pi2;
-	float neptuneRotate = fract(planetRotations / 0.67f) * pi2;
-
-	vec3 earthPosition = vec3(cos(earthOrbit), 0, sin(earthOrbit)) * 30.0f;
-	vec3 moonPosition = earthPosition + vec3(cos(moonOrbit), 0, sin(moonOrbit)) * 4.0f;
-
-	vec3 mercuryPosition = vec3(cos(mercuryOrbit), 0, sin(mercuryOrbit)) * 10.0f;
-	vec3 venusPosition = vec3(cos(venusOrbit), 0, sin(venusOrbit)) * 20.0f;
-	vec3 marsPosition = vec3(cos(marsOrbit), 0, sin(marsOrbit)) * 40.0f;
-	vec3 jupiterPosition = vec3(cos(jupiterOrbit), 0, sin(jupiterOrbit)) * 50.0f;
-	vec3 saturnPosition = vec3(cos(saturnOrbit), 0, sin(saturnOrbit)) * 60.0f;
-	vec3 uranusPosition = vec3(cos(uranusOrbit), 0, sin(uranusOrbit)) * 70.0f;
-	vec3 neptunePosition = vec3(cos(neptuneOrbit), 0, sin(neptuneOrbit)) * 80.0f;
-
-	if (!earthDestroyed) {
-		translation = translate(identity, earthPosition);
-		scaling = scale(identity, vec3(1)); // The earth stays the same size
-		rotation = rotate(identity, earthRotate, vec3(0, 1, 0));
-		modelMatrix[EARTH] = translation * rotation * scaling;
-	}
-	
-	if (!moonDestroyed) {
-		translation = translate(identity, moonPosition);
-		scaling = scale(identity, vec3(0.27)); // The moon is 27% the size of earth
-		rotation = rotate(identity, moonRotate, vec3(0, 1, 0));
-		modelMatrix[MOON] = translation * rotation * scaling;
-	}
-
-	scaling = scale(identity, vec3(3)); // Make the sun 10 times larger
-	modelMatrix[SUN] = scaling * identity;
-
-	if (!mercuryDestroyed) {
-		translation = translate(identity, mercuryPosition);
-		scaling = scale(identity, vec3(0.3)); // The earth stays the same size
-		rotation = rotate(identity, mercuryRotate, vec3(0, 1, 0));
-		modelMatrix[MERCURY] = translation * rotation * scaling;
-	}
-	if (!venusDestroyed) {
-		translation = translate(identity, venusPosition);
-		scaling = scale(identity, vec3(1)); // The earth stays the same size
-		rotation = rotate(identity, venusRotate, vec3(0, 1, 0));
-		modelMatrix[VENUS] = translation * rotation * scaling;
-	}
-
-	if (!marsDestroyed) {
-		translation = translate(identity, marsPosition);
-		scaling = scale(identity, vec3(0.7)); // The earth stays the same size
-		rotation = rotate(identity, marsRotate, vec3(0, 1, 0));
-		modelMatrix[MARS] = translation * rotation * scaling;
-	}
-
-	if (!jupiterDestroyed) {
-		translation = translate(identity, jupiterPosition);
-		scaling = scale(identity, vec3(5)); // The earth stays the same size
-		rotation = rotate(identity, jupiterRotate, vec3(0, 1, 0));
-		modelMatrix[JUPITER] = translation * rotation * scaling;
+	if (simulationWorker.Running())
+	{
+		// The simulation thread steps on its own, we only feed it input and pick up its newest step
+		if (frame.keys & INPUT_P)
+			simulationWorker.RequestLaunch();
+		simulationWorker.SetSpeed(simulationPaused ? 0.0f : simulationSpeed);
+		simulationWorker.SetRate(simulationRate);
+		simulationWorker.SetGravity(nbodyMode, beltCount);
+		sceneState = simulationWorker.Sample();
+
+		const std::vector<float>* positions;
+		if (simulationWorker.FetchBelt(positions) && nbodyMode)
+			UploadBelt(*positions);
 	}
-
-	if (!saturnDestroyed) {
-		translation = translate(identity, saturnPosition);
-		scaling = scale(identity, vec3(4)); // The earth stays the same size
-		rotation = rotate(identity, saturnRotate, vec3(0, 1, 0));
-		modelMatrix[SATURN] = translation * rotation * scaling;
+	else
+	{
+		// Step the simulation at its fixed rate, then draw a blend of its last two steps
+		SimInput input;
+		input.launchAsteroid = (frame.keys & INPUT_P) != 0;
+		input.simulationSpeed = simulationPaused ? 0.0f : simulationSpeed;
+		input.nbody = nbodyMode;
+		input.beltCount = beltCount;
+
+		simulation.SetRate(simulationRate);
+		float alpha = simulation.Advance(deltaTime, input);
+		sceneState = simulation.Interpolate(alpha);
+
+		// The belt isn't blended and only moves at the belt rate (30 Hz), so it goes up when it has moved
+		if (nbodyMode && (simulation.BeltSteps() != beltStepUploaded || beltVertices != simulation.Belt().Count()))
+		{
+			beltStepUploaded = simulation.BeltSteps();
+			beltScratch.resize(simulation.Belt().Count() * 3);
+			if (!beltScratch.empty())
+				simulation.Belt().CopyPositions(&beltScratch[0]);
+			UploadBelt(beltScratch);
+		}
 	}
 
-	if (!uranusDestroyed) {
-		translation = translate(identity, uranusPosition);
-		scaling = scale(identity, vec3(2)); // The earth stays the same size
-		rotation = rotate(identity, uranusRotate, vec3(0, 1, 0));
-		modelMatrix[URANUS] = translation * rotation * scaling;
-	}
+	ProfileScope beltUpdate("Belt Update");
+	if (UseGpuBelt())
+	{
+		// Only the bodies that come and go cross the bus, the orbits themselves stay on the GPU
+		if (GpuBelt::Count() < beltCount)
+		{
+			if (kinematicBelt.Count() != beltCount)
+				SeedAsteroidBelt(kinematicBelt, beltCount);
+			GpuBelt::Spawn(kinematicBelt, GpuBelt::Count(), beltCount - GpuBelt::Count());
+		}
+		else if (GpuBelt::Count() > beltCount)
+			GpuBelt::Despawn(beltCount, GpuBelt::Count() - beltCount);
 
-	if (!neptuneDestroyed) {
-		translation = translate(identity, neptunePosition);
-		scaling = scale(identity, vec3(3)); // The earth stays the same size
-		rotation = rotate(identity, neptuneRotate, vec3(0, 1, 0));
-		modelMatrix[NEPTUNE] = translation * rotation * scaling;
+		GpuBelt::Update(sceneState.earthDays);
 	}
+	else if (!nbodyMode)
+	{
+		if (kinematicBelt.Count() != beltCount)
+			SeedAsteroidBelt(kinematicBelt, beltCount);
+		kinematicBelt.Update(sceneState.earthDays);
 
-	if (glfwGetKey(window, GLFW_KEY_P)) {
-		ast = true;
-		astx = rand() % 50 + 1;
-		astz = rand() % 50 + 1;
-		multx = rand() % 2 ? 1 : -1;
-		multz = rand() % 2 ? 1 : -1;
-		valx = (rand() % 20) * 0.001;
-		valz = (rand() % 20) * 0.001;
-		astDestroyed = false;
-
+		beltScratch.resize(kinematicBelt.Count() * 3);
+		kinematicBelt.CopyPositions(&beltScratch[0]);
+		UploadBelt(beltScratch);
 	}
-	if (ast&!astDestroyed) {
-		astx += valx*multx;
-		astz += valz*multz;
-		translation = translate(identity, vec3(astx,0.0f,astz));
-		scaling = scale(identity, vec3(0.27));
-		rotation = rotate(identity, moonRotate, vec3(0, 1, 0));
-		modelMatrix[AST] = translation * rotation * scaling;
-		
-
-		/*************/
-		if (!earthDestroyed) {
-			if (((earthPosition[0] - astx) < 1 + 0.5 & (earthPosition[0] - astx) > 0)&((earthPosition[2] - astz) < 1 + 0.5 & (earthPosition[0] - astz) > 0)) {
-				astx -= 0.02;
-				astz -= 0.02;
-			}
-			else if (((earthPosition[0] - astx) > -1 - 0.5 & (earthPosition[0] - astx) < 0)&((earthPosition[2] - astz) > -1 - 0.5 & (earthPosition[0] - astz) < 0)) {
-				astx += 0.02;
-				astz += 0.02;
-			}
-
-			if ((abs(earthPosition[0] - astx) < 1)&(abs(earthPosition[2] - astz) < 1)) {
-				earthDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[EARTH] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				earthPosition = (vec3)0;
-			}
-		}
-		/*************/
-		if (!venusDestroyed) {
-			if (((venusPosition[0] - astx) < 1 + 0.5 & (venusPosition[0] - astx) > 0)&((venusPosition[2] - astz) < 1 + 0.5&(venusPosition[0] - astz) > 0)) {
-				astx -= 0.02;
-				astz -= 0.02;
-			}
-			else if (((venusPosition[0] - astx) > -1 - 0.5 &(venusPosition[0] - astx) < 0)&((venusPosition[2] - astz) > -1 - 0.5&(venusPosition[0] - astz) < 0)) {
-				astx += 0.02;
-				astz += 0.02;
-			}
-
-			if ((abs(venusPosition[0] - astx) < 1)&(abs(venusPosition[2] - astz) < 1)) {
-				venusDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[VENUS] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				venusPosition = (vec3)0;
-			}
-		}
-		/*************/
-		if (!mercuryDestroyed) {
-			if (((mercuryPosition[0] - astx) < 0.3 + 0.5 & (mercuryPosition[0] - astx) > 0)&((mercuryPosition[2] - astz) < 0.3 + 0.5&(mercuryPosition[0] - astz) > 0)) {
-				astx -= 0.02*0.3;
-				astz -= 0.02*0.3;
-			}
-			else if (((mercuryPosition[0] - astx) > -0.3 - 0.5 &(mercuryPosition[0] - astx) < 0)&((mercuryPosition[2] - astz) > -0.3 - 0.5&(mercuryPosition[0] - astz) < 0)) {
-				astx += 0.02*0.3;
-				astz += 0.02*0.3;
-			}
-
-			if ((abs(mercuryPosition[0] - astx) < 0.3)&(abs(mercuryPosition[2] - astz) < 0.3)) {
-				mercuryDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[MERCURY] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				mercuryPosition = (vec3)0;
-			}
-		}
-		/*************/
-		if (!moonDestroyed) {
-			if (((moonPosition[0] - astx) < 0.27 + 0.5 &(moonPosition[0] - astx) > 0)&((moonPosition[2] - astz) < 0.27 + 0.5&(moonPosition[0] - astz) > 0)) {
-				astx -= 0.02*0.27;
-				astz -= 0.02*0.27;
-			}
-			else if (((moonPosition[0] - astx) > -0.27 - 0.5&(moonPosition[0] - astx) < 0)&((moonPosition[2] - astz) > -0.27 - 0.5&(moonPosition[0] - astz) < 0)) {
-				astx += 0.02*0.27;
-				astz += 0.02*0.27;
-			}
-
-			if ((abs(moonPosition[0] - astx) < 0.27)&(abs(moonPosition[2] - astz) < 0.27)) {
-				moonDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[MOON] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				moonPosition = (vec3)0;
-			}
-
-		}
-		/*************/
-		if (!marsDestroyed) {
-			if (((marsPosition[0] - astx) < 0.7 + 0.5&(marsPosition[0] - astx) > 0)&((marsPosition[2] - astz) < 0.7 + 0.5&(marsPosition[0] - astz) > 0)) {
-				astx -= 0.02*0.7;
-				astz -= 0.02*0.7;
-			}
-			else if (((marsPosition[0] - astx) > -0.7 - 0.5&(marsPosition[0] - astx) < 0)&((marsPosition[2] - astz) > -0.7 - 0.5&(marsPosition[0] - astz) < 0)) {
-				astx += 0.02*0.7;
-				astz += 0.02*0.7;
-			}
-
-			if ((abs(marsPosition[0] - astx) < 0.7)&(abs(marsPosition[2] - astz) < 0.7)) {
-				marsDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[MARS] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				marsPosition = (vec3)0;
-			}
 
-		}
-		/*************/
-		if (!jupiterDestroyed) {
-			if (((jupiterPosition[0] - astx) < 5 + 0.5&(jupiterPosition[0] - astx) > 0)&((jupiterPosition[2] - astz) < 5 + 0.5&(jupiterPosition[0] - astz) > 0)) {
-				astx -= 0.02 * 5;
-				astz -= 0.02 * 5;
-			}
-			else if (((jupiterPosition[0] - astx) > -5 - 0.5&(jupiterPosition[0] - astx) < 0)&((jupiterPosition[2] - astz) > -5 - 0.5&(jupiterPosition[0] - astz) < 0)) {
-				astx += 0.02 * 5;
-				astz += 0.02 * 5;
-			}
+	beltUpdate.End();
 
-			if ((abs(jupiterPosition[0] - astx) < 5)&(abs(jupiterPosition[2] - astz) < 5)) {
-				jupiterDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[JUPITER] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				jupiterPosition = (vec3)0;
-			}
-		}
+	PoseScene(sceneState);
 
-		/*************/
-		if (!saturnDestroyed) {
-			if (((saturnPosition[0] - astx) < 4 + 0.5&(saturnPosition[0] - astx) > 0)&((saturnPosition[2] - astz) < 4 + 0.5 && (saturnPosition[0] - astz) > 0)) {
-				astx -= 0.02 * 4;
-				astz -= 0.02 * 4;
-			}
-			else if (((saturnPosition[0] - astx) > -4 - 0.5&(saturnPosition[0] - astx) < 0)&((saturnPosition[2] - astz) > -4 - 0.5&(saturnPosition[0] - astz) < 0)) {
-				astx += 0.02 * 4;
-				astz += 0.02 * 4;
-			}
-
-			if ((abs(saturnPosition[0] - astx) < 4)&(abs(saturnPosition[2] - astz) < 4)) {
-				saturnDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[SATURN] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				saturnPosition = (vec3)0;
-			}
-
-		}
-		/*************/
-		if (!uranusDestroyed) {
-			if (((uranusPosition[0] - astx) < 2 + 0.5&(uranusPosition[0] - astx) > 0)&((uranusPosition[2] - astz) < 2 + 0.5&(uranusPosition[0] - astz) > 0)) {
-				astx -= 0.02 * 2;
-				astz -= 0.02 * 2;
-			}
-			else if (((uranusPosition[0] - astx) > -2 - 0.5&(uranusPosition[0] - astx) < 0)&((uranusPosition[2] - astz) > -2 - 0.5&(uranusPosition[0] - astz) < 0)) {
-				astx += 0.02 * 2;
-				astz += 0.02 * 2;
-			}
-
-			if ((abs(uranusPosition[0] - astx) < 2)&(abs(uranusPosition[2] - astz) < 2)) {
-				uranusDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[URANUS] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				uranusPosition = (vec3)0;
-			}
-
-		}
-		/*************/
-		if (!neptuneDestroyed) {
-			if (((neptunePosition[0] - astx) < 3 + 0.5&(neptunePosition[0] - astx) > 0)&((neptunePosition[2] - astz) < 3 + 0.5&(neptunePosition[0] - astz) > 0)) {
-				astx -= 0.02 * 3;
-				astz -= 0.02 * 3;
-			}
-			else if (((neptunePosition[0] - astx) > -3 - 0.5&(neptunePosition[0] - astx) < 0)&((neptunePosition[2] - astz) > -3 - 0.5&(neptunePosition[0] - astz) < 0)) {
-				astx += 0.02 * 3;
-				astz += 0.02 * 3;
-			}
-
-			if ((abs(neptunePosition[0] - astx) < 3)&(abs(neptunePosition[2] - astz) < 3)) {
-				neptuneDestroyed = true;
-				astDestroyed = true;
-				modelMatrix[NEPTUNE] = (mat4)0;
-				modelMatrix[AST] = (mat4)0;
-				neptunePosition = (vec3)0;
-			}
-		}
-
-
-	}
+	vec3 earthPosition = BodyPosition(EARTH);
+	vec3 moonPosition = BodyPosition(MOON);
+	vec3 mercuryPosition = BodyPosition(MERCURY);
+	vec3 neptunePosition = BodyPosition(NEPTUNE);
 
 	//FreeCam(deltaTime);
 
@@ -626,424 +746,544 @@ void Update(float deltaTime)
 	}
 	else if (viewMode == 4)
 	{   // Static view
-		viewMatrix = updateCam(deltaTime);//inverse(lookAt(moonPosition, (earthPosition), vec3(0, 1, 0)));
+		if (LateLatching())
+		{
+			cameraDeferred = true;                                          // <- Moved in LatchCamera(), just before the scene is drawn
+			deferredCamera = frame;
+		}
+		else
+			viewMatrix = updateCam(frame);//inverse(lookAt(moonPosition, (earthPosition), vec3(0, 1, 0)));
 	}
 
 	//std::cout << planetRotations << std::endl;
 }
 
-void Render()
+// Bodies are unit diameter spheres scaled by their model matrix. Destroyed bodies have a zero matrix
+float BodyRadius(int body)
+{
+	return length(vec3(modelMatrix[body][0])) * 0.5f;
+}
+
+// Picks the spheres that can eclipse each body in [begin, end), into that body's slot of the staging buffer
+void FindOccluders(int begin, int end, int /*worker*/, void* data)
 {
-	//------------------------------------------------------------------------------------------------ Draw Skybox
+	unsigned char* staging = (unsigned char*)data;
+	vec3 sunPos = vec3(modelMatrix[SUN][3]);
+	float sunRadius = BodyRadius(SUN);
 
+	for (int body = begin; body < end; body++)
 	{
-		// Use the special skybox program
-		glUseProgram(skyboxProgram);                                    // <- Use the skybox shader program. This has the vertex and fragment  shader for the skybox
-
-																		// Getting uniform locations  
-		GLuint sLoc = glGetUniformLocation(skyboxProgram, "skybox");    // <- Get the uniform location for the skybox
-		GLuint vLoc = glGetUniformLocation(skyboxProgram, "view");      // <- Get the uniform location for the view matrix
-		GLuint pLoc = glGetUniformLocation(skyboxProgram, "proj");      // <- Get the uniform location for the projection matrix
-
-																		// Binding skybox texture
-		glUniform1i(sLoc, 0);                                           // <- 1) Get the uniform location for the cubemap sampler, and set it to index zero                       
-		glActiveTexture(GL_TEXTURE0);                                   // <- 2) Set the active texture to also be index zero, matching above                             
-		glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);              // <- 3) Bind the skybox texture. This texture is bound to zero, so it will be sampled              
-
-																		// Passing up view-projection matrix
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE,                           // <- Pass through a special version of the view matrix. This has no position information, as
-			&inverse(mat4(mat3(viewMatrix)))[0][0]);                    //    the position was removed by downcasting to mat3, then back up to mat4. It's inverted as well
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]); // <- Pass through the projection matrix here to the vertex shader
-
-																		// Drawing the skybox
-		Primitive::DrawSkybox();                                        // <- Draw the skybox here. It's an inverted cube around the camera                                     
-
-																		// Unbinding the texture and program
-		glBindTexture(GL_TEXTURE_CUBE_MAP, GL_NONE);                    // <- Unbind the texture after we've drawn the skybox here                                  
-		glUseProgram(GL_NONE);                                          // <- Unbind the shader program after we've used it here                                    
+		OccluderBlock* block = (OccluderBlock*)&staging[body * occluderStride];
+		float bodyRadius = BodyRadius(body);
+		if (body == SUN || bodyRadius == 0.0f)
+			continue;
+
+		vec3 bodyPos = vec3(modelMatrix[body][3]);
+		vec3 toSun = sunPos - bodyPos;
+		float sunDistance = length(toSun);
+
+		for (int other = 0; other < BODY_COUNT && block->count < MAX_OCCLUDERS; other++)
+		{
+			float radius = BodyRadius(other);
+			if (other == body || other == SUN || radius == 0.0f)
+				continue;
+
+			// Only spheres between the body and the sun can shadow it
+			vec3 pos = vec3(modelMatrix[other][3]);
+			float t = dot(pos - bodyPos, toSun) / (sunDistance * sunDistance);
+			if (t <= 0.0f || t >= 1.0f)
+				continue;
+
+			// The penumbra cone widens behind the occluder, so the test has to allow for it
+			float penumbra = radius + length(pos - bodyPos) * (sunRadius + radius) / length(sunPos - pos);
+			if (length(bodyPos + toSun * t - pos) > bodyRadius + penumbra)
+				continue;
+
+			block->spheres[block->count++] = vec4(pos, radius);
+		}
 	}
+}
 
-	//------------------------------------------------------------------------------------------------ Draw Models
-
-	{   //----------------------------------------------------------- EARTH ----------------------------------------------------------------------
-		// Use the phong program
-		glUseProgram(phongProgram);                                         // <- Use the phong lighting shader program
-
-																			// Getting uniform locations
-		GLuint dtLoc = glGetUniformLocation(phongProgram, "diffuseTex");    // <- Get the uniform location for the diffuse texture
-		GLuint stLoc = glGetUniformLocation(phongProgram, "specularTex");   // <- Get the uniform location for the diffuse texture
-		GLuint cLoc = glGetUniformLocation(phongProgram, "cameraPos");      // <- Get the uniform location for the projection matrix
-		GLuint mLoc = glGetUniformLocation(phongProgram, "model");          // <- Get the uniform location for the model matrix
-		GLuint vLoc = glGetUniformLocation(phongProgram, "view");           // <- Get the uniform location for the view matrix
-		GLuint pLoc = glGetUniformLocation(phongProgram, "proj");           // <- Get the uniform location for the projection matrix
-		GLuint nLoc = glGetUniformLocation(phongProgram, "norm");           // <- Get the uniform location for the normal matrix
-
-																			// Binding diffuse texture
-		glUniform1i(dtLoc, 0);                                              // <- 1) Get the uniform location for the 2D sampler, and set it to index zero                       
-		glActiveTexture(GL_TEXTURE0);                                       // <- 2) Set the active texture to also be index zero, matching above                             
-		glBindTexture(GL_TEXTURE_2D, diffuseTexture);                       // <- 3) Bind the diffuse texture (bound to index 0)
-
-																			// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, specularTexture);
-
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[EARTH][0][0]);   // <- Pass through the model matrix here to the vertex shader
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);  // <- Pass through the inverse of the view matrix here to the vertex shader
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);     // <- Pass through the projection matrix here to the vertex shader
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,                               // <- Pass through the transpose of the inverse of the model matrix
-			&transpose(inverse(modelMatrix[EARTH]))[0][0]);                 //    so that we correctly transform the normals into world space as well
-
-																			// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);                          // <- Pass through the camera location to the shader
-
-		Primitive::DrawSphere();    // Earth
-
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);                               // <- Set Texture 1 to be active, and then                
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);                      // <- unbind it here
-		glActiveTexture(GL_TEXTURE0);                               // <- Set Texture 0 to be active, and then         
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);                      // <- unbind it here            
-
-																	//----------------------------------------------------------- THE MOON (see above for comments) --------------------------------------------------
-
-																	// Binding diffuse texture
-		glUniform1i(dtLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, moonTexture);
-
-		// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, moonTexture);
-
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[MOON][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-			&transpose(inverse(modelMatrix[MOON]))[0][0]);
-
-		// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);
-
-		Primitive::DrawSphere();    // Moon
-
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-
-
-
-		//-----------------------------------------------------------------------------//
-		// Binding diffuse texture
-		glUniform1i(dtLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, mercuryTexture);
-
-		// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, mercuryTexture);
-
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[MERCURY][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-			&transpose(inverse(modelMatrix[MERCURY]))[0][0]);
-
-		// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);
-
-		Primitive::DrawSphere();    // Mercury
-
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-
-
-
+// Works out who can shadow who this frame and uploads all the lists at once
+void UpdateOccluders()
+{
+	PROFILE_SCOPE("Occluders");
 
+	ArenaVector<unsigned char> staging(occluderStride * BODY_COUNT, 0, Arena::Frame());
+	Jobs::ParallelFor(BODY_COUNT, recordGrain, FindOccluders, &staging[0]);
 
-		//-----------------------------------------------------------------------------//
-		// Binding diffuse texture
-		glUniform1i(dtLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, venusTexture);
+	GLState::BindBuffer(GL_UNIFORM_BUFFER, occluderBuffer);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), &staging[0]);
+	GLState::BindBuffer(GL_UNIFORM_BUFFER, GL_NONE);
+}
 
-		// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, venusTexture);
+// Asks for as much texture detail as each body's size on screen can show
+void RequestTextureDetail()
+{
+	PROFILE_SCOPE("Texture Streaming");
 
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[VENUS][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-			&transpose(inverse(modelMatrix[VENUS]))[0][0]);
+	vec3 eye = vec3(viewMatrix[3]);
+	float pixelsPerUnit = height / (2.0f * tan(radians(20.0f)));  // <- Half of the 40 degree field of view
 
-		// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);
+	for (int body = 0; body < BODY_COUNT; body++)
+	{
+		float radius = BodyRadius(body);
+		if (radius == 0.0f)
+			continue;
+
+		// The map wraps around the whole sphere, so its width covers about twice the visible disc
+		float distance = max(length(vec3(modelMatrix[body][3]) - eye) - radius, 0.1f);
+		float disc = 2.0f * radius / distance * pixelsPerUnit;
+		textureStreamer.Require(bodyTextures[body][0], 2.0f * disc);
+		textureStreamer.Require(bodyTextures[body][1], 2.0f * disc);
+	}
 
-		Primitive::DrawSphere();    // Moon
+	// Streamed maps get whatever the budget has left after everything else
+	textureStreamer.budget = GpuMemory::StreamingBudget();
+	textureStreamer.Update();
+}
 
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
+void BindOccluders(int body)
+{
+	GLState::BindBufferRange(GL_UNIFORM_BUFFER, OCCLUDER_BINDING, occluderBuffer, body * occluderStride, sizeof(OccluderBlock));
+}
 
+bool UseTessellation()
+{
+	return tessellatedPlanets && phongTessProgram;
+}
 
+bool UseImpostors()
+{
+	return impostorBodies && phongImpostorProgram && emissiveImpostorProgram;
+}
 
-		//-----------------------------------------------------------------------------//
-		// Binding diffuse texture
-		glUniform1i(dtLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, marsTexture);
+// The tessellated program takes patches, the plain one triangles and the impostors a bare quad
+void DrawPlanetSphere()
+{
+	if (UseImpostors())
+		Primitive::DrawImpostor();
+	else if (UseTessellation())
+		Primitive::DrawSpherePatches();
+	else
+		Primitive::DrawSphere();
+}
 
-		// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, marsTexture);
+// Samples keys and cursor as late as we can, so the free-cam skips the input lag of Update()
+void LatchCamera()
+{
+	if (!cameraDeferred)
+		return;
+	cameraDeferred = false;
 
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[MARS][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-			&transpose(inverse(modelMatrix[MARS]))[0][0]);
+	glfwPollEvents();
+	FrameInput latest = PollInput(deferredCamera.deltaTime);
+	viewMatrix = updateCam(latest);
+}
 
-		// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);
+//------------------------------------------------------------------------------------------------ Draw packets
 
-		Primitive::DrawSphere();    // Moon
+void SetupSkybox(GLuint program)
+{
+	GLState::Uniform1i(glGetUniformLocation(program, "skybox"), 0);    // <- The cubemap is bound to unit zero by the queue
+	GLState::Uniform1f(glGetUniformLocation(program, "skyIntensity"), skyIntensity);
+	GLState::UniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE,
+		&inverse(mat4(mat3(viewMatrix)))[0][0]);                        // <- No position information, the skybox stays around the camera
+	GLState::UniformMatrix4fv(glGetUniformLocation(program, "proj"), 1, GL_FALSE, &projectionMatrix[0][0]);
+}
 
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
+void DrawSkybox(const DrawPacket& /*packet*/)
+{
+	Primitive::DrawSkybox();                                            // <- Inverted cube around the camera
+}
 
+// The stars bind their own program and blending, one instanced draw for the whole catalog
+// Sprites are sized against the output, like the belt's points, so they keep their size on screen at any render scale
+void DrawStars(const DrawPacket& /*packet*/)
+{
+	StarField::Draw(inverse(viewMatrix), projectionMatrix, width, height);
+}
 
+bool UseStarField()
+{
+	return catalogStars && StarField::Available();
+}
 
+void SetupPlanets(GLuint program)
+{
+	GLState::Uniform1i(glGetUniformLocation(program, "diffuseTex"), 0);
+	GLState::Uniform1i(glGetUniformLocation(program, "specularTex"), 1);
+	GLState::UniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
+	GLState::UniformMatrix4fv(glGetUniformLocation(program, "proj"), 1, GL_FALSE, &projectionMatrix[0][0]);
+	GLState::Uniform3fv(glGetUniformLocation(program, "cameraPos"), 1, &vec3(viewMatrix[3])[0]);   // <- The fixed views never set cameraPosition
+	GLState::Uniform1f(glGetUniformLocation(program, "sunRadius"), BodyRadius(SUN));  // <- The sun's size sets how wide the penumbra is
+	GLState::Uniform1i(glGetUniformLocation(program, "mirrorU"), 1);   // <- Impostor only, the mesh programs flip u in their vertex shader
+
+																		// Tessellation factors, ignored by the plain program
+	GLState::Uniform1f(glGetUniformLocation(program, "viewportHeight"), (float)PostProcess::SceneHeight());
+	GLState::Uniform1f(glGetUniformLocation(program, "pixelsPerEdge"), pixelsPerEdge);
+
+	planetModelLoc = glGetUniformLocation(program, "model");
+	planetNormLoc = glGetUniformLocation(program, "norm");
+}
 
-		//-----------------------------------------------------------------------------//
-		// Binding diffuse texture
-		glUniform1i(dtLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, jupiterTexture);
+void DrawPlanet(const DrawPacket& packet)
+{
+	GLState::UniformMatrix4fv(planetModelLoc, 1, GL_FALSE, &modelMatrix[packet.object][0][0]);
+	GLState::UniformMatrix4fv(planetNormLoc, 1, GL_FALSE,              // <- Transpose of the inverse of the model matrix,
+		&normalMatrix[packet.object][0][0]);                            //    precomputed by the transform graph
 
-		// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, jupiterTexture);
+	BindOccluders(packet.object);
+	DrawPlanetSphere();
+}
 
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[JUPITER][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-			&transpose(inverse(modelMatrix[JUPITER]))[0][0]);
+void SetupSun(GLuint program)
+{
+	GLState::Uniform1i(glGetUniformLocation(program, "emissiveTex"), 0);
+	GLState::Uniform1f(glGetUniformLocation(program, "emissiveIntensity"), sunIntensity);
+	GLState::UniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
+	GLState::UniformMatrix4fv(glGetUniformLocation(program, "proj"), 1, GL_FALSE, &projectionMatrix[0][0]);
+	GLState::Uniform3fv(glGetUniformLocation(program, "cameraPos"), 1, &vec3(viewMatrix[3])[0]);   // <- Only the impostor uses it
+	GLState::Uniform1i(glGetUniformLocation(program, "mirrorU"), 0);   // <- emissive.vert doesn't flip u
+}
 
-		// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);
+void DrawSun(const DrawPacket& packet)
+{
+	GLState::UniformMatrix4fv(glGetUniformLocation(packet.program, "model"), 1, GL_FALSE, &modelMatrix[SUN][0][0]);
+	if (UseImpostors())
+		Primitive::DrawImpostor();
+	else
+		Primitive::DrawSphere();
+}
 
-		Primitive::DrawSphere();    // Moon
+// The belt binds its own program, either the compute belt's or the particle one
+void DrawBelt(const DrawPacket& /*packet*/)
+{
+	float pointSize = beltPointSize * PostProcess::RenderScale();       // <- Sizes are in pixels of the scene target
+	if (UseGpuBelt())
+	{
+		GpuBelt::Draw(inverse(viewMatrix), projectionMatrix, pointSize, beltColour);
+	}
+	else if (beltVertices > 0)
+	{
+		GLState::UseProgram(particleProgram);                           // <- Points are sized in the vertex shader
+
+		GLState::UniformMatrix4fv(glGetUniformLocation(particleProgram, "view"), 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
+		GLState::UniformMatrix4fv(glGetUniformLocation(particleProgram, "proj"), 1, GL_FALSE, &projectionMatrix[0][0]);
+		GLState::Uniform1f(glGetUniformLocation(particleProgram, "pointSize"), pointSize);
+		GLState::Uniform3fv(glGetUniformLocation(particleProgram, "particleColour"), 1, &beltColour[0]);
+
+		glEnable(GL_PROGRAM_POINT_SIZE);
+		GLState::BindVertexArray(beltVao);
+		GLState::DrawArrays(GL_POINTS, 0, beltVertices);
+		GLState::BindVertexArray(GL_NONE);
+		glDisable(GL_PROGRAM_POINT_SIZE);
+	}
+}
 
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
+// What the recording jobs need to know about the frame
+struct RecordContext
+{
+	vec4 planes[6];             // Frustum, normals point inwards
+	vec3 eye;
+	GLuint planetProgram;
+	GLuint sunProgram;
+};
 
+// Culls the bodies in [begin, end) against the frustum and records a packet for each one left
+void RecordBodies(int begin, int end, int worker, void* data)
+{
+	const RecordContext& frame = *(const RecordContext*)data;
+	CommandBuffer& commands = renderQueue.Buffer(worker);
 
+	for (int body = begin; body < end; body++)
+	{
+		float radius = BodyRadius(body);
+		if (radius == 0.0f || (body == AST && !sceneState.asteroidLaunched))
+			continue;
+
+		vec3 centre = vec3(modelMatrix[body][3]);
+		bool visible = true;
+		for (int plane = 0; plane < 6 && visible; plane++)
+			visible = dot(vec3(frame.planes[plane]), centre) + frame.planes[plane].w > -radius;
+		if (!visible)
+			continue;
+
+		float depth = length(centre - frame.eye);
+		if (body == SUN)
+		{
+			DrawPacket sun = { frame.sunProgram, SetupSun, GL_TEXTURE_2D, { sunTexture, GL_NONE }, SUN, DrawSun };
+			commands.Submit(PASS_OPAQUE, depth, sun);
+		}
+		else
+		{
+			DrawPacket planet = { frame.planetProgram, SetupPlanets, GL_TEXTURE_2D, { bodyTextures[body][0], bodyTextures[body][1] }, body, DrawPlanet };
+			commands.Submit(PASS_OPAQUE, depth, planet);
+		}
+	}
+}
 
-		//-----------------------------------------------------------------------------//
-		// Binding diffuse texture
-		glUniform1i(dtLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, saturnTexture);
-
-		// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, saturnTexture);
-
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[SATURN][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-			&transpose(inverse(modelMatrix[SATURN]))[0][0]);
-
-		// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);
+void Render()
+{
+	PROFILE_SCOPE("Render");
 
-		Primitive::DrawSphere();    // Moon
+	// Stream texture detail in or out before anything samples it
+	RequestTextureDetail();
 
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
+	// Last chance for the free-cam to pick up input before the view matrix goes to the GPU
+	LatchCamera();
 
+	// Everything up to the tonemap goes into the HDR target
+	PostProcess::BeginScene();
 
-		//-----------------------------------------------------------------------------//
-		// Binding diffuse texture
-		glUniform1i(dtLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, uranusTexture);
-
-		// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, uranusTexture);
-
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[URANUS][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-			&transpose(inverse(modelMatrix[URANUS]))[0][0]);
-
-		// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);
-
-		Primitive::DrawSphere();    // Moon
-
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-
-
-
-		//-----------------------------------------------------------------------------//
-		// Binding diffuse texture
-		glUniform1i(dtLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, neptuneTexture);
-
-		// Binding specular texture
-		glUniform1i(stLoc, 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, neptuneTexture);
-
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[NEPTUNE][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-		glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-			&transpose(inverse(modelMatrix[NEPTUNE]))[0][0]);
-
-		// Passing up additional information
-		glUniform3fv(cLoc, 1, &cameraPosition[0]);
-
-		Primitive::DrawSphere();    // Moon
-
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
-
-		if (ast) {
-			//-----------------------------------------------------------------------------//
-			// Binding diffuse texture
-			glUniform1i(dtLoc, 0);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, moonTexture);
-
-			// Binding specular texture
-			glUniform1i(stLoc, 1);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, neptuneTexture);
-
-			// Passing MVP matrix
-			glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[AST][0][0]);
-			glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-			glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
-			glUniformMatrix4fv(nLoc, 1, GL_FALSE,
-				&transpose(inverse(modelMatrix[AST]))[0][0]);
-
-			// Passing up additional information
-			glUniform3fv(cLoc, 1, &cameraPosition[0]);
-
-			Primitive::DrawSphere();    // Moon
-
-										// Unbinding textures
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, GL_NONE);
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, GL_NONE);
-		}
-		//----------------------------------------------------------- THE SUN (see above for comments) ----------------------------------------------------
+	//------------------------------------------------------------------------------------------------ Submit
 
-		glUseProgram(emissiveProgram);
+	UpdateOccluders();                                                  // <- Work out who can shadow who this frame
 
-		mLoc = glGetUniformLocation(emissiveProgram, "model");
-		vLoc = glGetUniformLocation(emissiveProgram, "view");
-		pLoc = glGetUniformLocation(emissiveProgram, "proj");
-		GLuint etLoc = glGetUniformLocation(emissiveProgram, "emissiveTex");
+	renderQueue.Clear();
 
-		// Binding emissive texture
-		glUniform1i(etLoc, 0);
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, sunTexture);
+	RecordContext frame;
+	frame.eye = vec3(viewMatrix[3]);
+	if (UseImpostors())
+	{
+		frame.planetProgram = phongImpostorProgram;
+		frame.sunProgram = emissiveImpostorProgram;
+	}
+	else
+	{
+		frame.planetProgram = UseTessellation() ? phongTessProgram : phongProgram;
+		frame.sunProgram = emissiveProgram;
+	}
 
-		// Passing MVP matrix
-		glUniformMatrix4fv(mLoc, 1, GL_FALSE, &modelMatrix[SUN][0][0]);
-		glUniformMatrix4fv(vLoc, 1, GL_FALSE, &inverse(viewMatrix)[0][0]);
-		glUniformMatrix4fv(pLoc, 1, GL_FALSE, &projectionMatrix[0][0]);
+	mat4 clip = transpose(projectionMatrix * inverse(viewMatrix));     // <- Rows of the view-projection give the frustum planes
+	for (int plane = 0; plane < 6; plane++)
+	{
+		vec4 p = clip[3] + (plane & 1 ? -clip[plane / 2] : clip[plane / 2]);
+		frame.planes[plane] = p / length(vec3(p));
+	}
 
-		Primitive::DrawSphere();    // Sun
+	{
+		PROFILE_SCOPE("Record");
+		Jobs::ParallelFor(BODY_COUNT, recordGrain, RecordBodies, &frame);
+	}
 
-									// Unbinding textures
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, GL_NONE);
+	if (UseStarField())
+	{
+		DrawPacket stars = { GL_NONE, NULL, GL_TEXTURE_2D, { GL_NONE, GL_NONE }, 0, DrawStars };
+		renderQueue.Submit(PASS_BACKGROUND, 0.0f, stars);
+	}
+	else
+	{
+		if (!skyboxTexture)
+			LoadSkyboxCubemap();                                        // <- First time the stars are switched off
+		DrawPacket skybox = { skyboxProgram, SetupSkybox, GL_TEXTURE_CUBE_MAP, { skyboxTexture, GL_NONE }, 0, DrawSkybox };
+		renderQueue.Submit(PASS_BACKGROUND, 0.0f, skybox);
+	}
 
-		// unbinding the shader program
-		glUseProgram(GL_NONE);
+	DrawPacket belt = { GL_NONE, NULL, GL_TEXTURE_2D, { GL_NONE, GL_NONE }, 0, DrawBelt };
+	renderQueue.Submit(PASS_OPAQUE, length(vec3(modelMatrix[SUN][3]) - frame.eye), belt);
 
+	//------------------------------------------------------------------------------------------------ Draw
 
+	renderQueue.Sort();
+	renderQueue.Execute();
 
-	}
+	// Bloom the HDR target and tonemap it onto the backbuffer
+	PostProcess::EndScene();
 }
 
 void Cleanup()
 {
+	// Stop the simulation thread before anything it touches goes away
+	simulationWorker.Stop();
+	Jobs::Shutdown();
+
 	// Cleanup the shader programs here
-	glDeleteProgram(skyboxProgram);
-	glDeleteProgram(phongProgram);
+	GLState::DeleteProgram(skyboxProgram);
+	GLState::DeleteProgram(phongProgram);
+	GLState::DeleteProgram(phongTessProgram);
+	GLState::DeleteProgram(emissiveProgram);
+	GLState::DeleteProgram(phongImpostorProgram);
+	GLState::DeleteProgram(emissiveImpostorProgram);
+	GLState::DeleteProgram(particleProgram);
 
 	// Cleanup the textures here
-	glDeleteTextures(1, &skyboxTexture);
-	glDeleteTextures(1, &diffuseTexture);
-	glDeleteTextures(1, &specularTexture);
+	skyboxTexture.Reset();
+	textureStreamer.Cleanup();
+	occluderBuffer.Reset();
+	beltVbo.Reset();
+	beltVao.Reset();
+
+	// Cleanup the HDR and bloom targets
+	PostProcess::Cleanup();
+	GpuBelt::Cleanup();
+	StarField::Cleanup();
+	Primitive::Cleanup();
+
+	// Everything made through GpuMemory should be gone by now
+	GpuMemory::ReportLeaks();
 }
 
 void GUI()
 {
+	PROFILE_SCOPE("GUI");
+
 	ImGui::Begin("Lab 8");
 	{
 		ImGui::Text("%.1f FPS", ImGui::GetIO().Framerate);
+		const GLState::Counters& gl = GLState::LastFrame();
+		ImGui::Text("%d draws, %d binds (%d skipped), %d uniforms (%d skipped)", gl.draws, gl.binds, gl.bindsSkipped, gl.uniforms, gl.uniformsSkipped);
+		const RenderQueue::Stats& queue = renderQueue.LastStats();
+		ImGui::Text("%d packets, %d program changes, %d material changes", queue.packets, queue.programChanges, queue.materialChanges);
+		ImGui::SliderInt("Bodies Per Job", &recordGrain, 1, 64);
+		ImGui::Text("Frame arena %.1f of %.1f KB, high water %.1f KB", Arena::Frame().Used() / 1024.0f, Arena::Frame().Capacity() / 1024.0f, Arena::Frame().HighWater() / 1024.0f);
+		ImGui::SameLine(); ImGui::Text("%d workers", Jobs::WorkerCount());
 
 		ImGui::Spacing();
 		ImGui::DragFloat("Simulation Speed", &simulationSpeed, 0.01f, 100.0f); simulationSpeed = clamp(simulationSpeed, 0.01f, 100.0f);
+		ImGui::SliderFloat("Simulation Rate (Hz)", &simulationRate, 30.0f, 1000.0f);
+		if (ImGui::Checkbox("Threaded Simulation", &threadedSimulation))
+		{
+			if (threadedSimulation)
+				simulationWorker.Start(&simulation);
+			else
+				simulationWorker.Stop();
+		}
+		if (recorder.Recording())
+		{
+			if (ImGui::Button("Stop Recording"))
+				recorder.Stop();
+			ImGui::SameLine();
+			ImGui::Text("%d frames recorded", recorder.Frames());
+		}
+		else if (replay.Playing())
+		{
+			if (ImGui::Button("Stop Replay"))
+				StopReplay();
+			ImGui::SameLine();
+			ImGui::Text("Replaying frame %d", replay.Frame());
+		}
+		else
+		{
+			if (ImGui::Button("Record Input"))
+				StartRecording();
+			ImGui::SameLine();
+			if (ImGui::Button("Replay Input"))
+				StartReplay();
+		}
+		if (capture.Active())
+		{
+			if (ImGui::Button("Stop Capture"))
+				capture.Stop();
+			ImGui::SameLine();
+			ImGui::Text("%d frames written, %d queued", capture.Written(), capture.Queued());
+		}
+		else if (ImGui::Button("Capture Frames"))
+			StartCapture();
+		if (simulationWorker.Running())
+			ImGui::Text("Step %llu", simulationWorker.Latest().step);
+		else
+			ImGui::Text("%d steps this frame", simulation.StepsLastFrame());
+		ImGui::Text("Day %.1f, %d ephemeris chunks cached", sceneState.earthDays, sceneEphemeris.CachedChunks());
+		if (ImGui::SliderFloat("Jump To Year", &jumpYear, -1000.0f, 1000.0f, "%.1f"))
+			JumpToYear(jumpYear);
+		ImGui::Checkbox("N-Body Gravity", &nbodyMode);
+		ImGui::SliderInt("Belt Particles", &beltCount, 1000, 1000000);
+		if (GpuBelt::Available())
+			ImGui::Checkbox("Belt On The GPU", &gpuBelt);
+		if (ImGui::Button("Compare With Direct Sum"))
+		{
+			// A separate belt the same size as the live one, so the simulation thread is left alone
+			NBody test;
+			SeedAsteroidBelt(test, beltCount);
+			nbodyReport = test.CompareWithDirect(256);
+			printf("Barnes-Hut, %d particles on %d threads: build %.2f ms, force %.2f ms\n",
+				nbodyReport.particles, nbodyReport.threads, nbodyReport.treeBuildMs, nbodyReport.treeForceMs);
+			printf("Direct sum, %d samples %.2f ms, full estimate %.2f ms, rms error %g, max error %g\n",
+				nbodyReport.samples, nbodyReport.directSampleMs, nbodyReport.directEstimateMs, nbodyReport.rmsError, nbodyReport.maxError);
+		}
+		if (nbodyReport.particles > 0)
+			ImGui::Text("Tree %.1f ms, direct %.0f ms, rms error %.4f",
+				nbodyReport.treeBuildMs + nbodyReport.treeForceMs, nbodyReport.directEstimateMs, nbodyReport.rmsError);
+		for (int k = 0; k < KERNEL_COUNT; k++)
+		{
+			if (!MinorPlanets::Supported(k))
+				continue;
+			ImGui::RadioButton(MinorPlanets::KernelName(k), &MinorPlanets::kernel, k);
+			ImGui::SameLine();
+		}
+		if (ImGui::Button("Benchmark Orbit Kernels"))
+		{
+			kernelReportCount = MinorPlanets::Benchmark(1000000, kernelReports);
+			for (int i = 0; i < kernelReportCount; i++)
+				printf("%s: %d orbits in %.3f ms, max error %g\n", MinorPlanets::KernelName(kernelReports[i].kernel),
+					kernelReports[i].bodies, kernelReports[i].ms, kernelReports[i].maxError);
+		}
+		for (int i = 0; i < kernelReportCount; i++)
+			ImGui::Text("%s %.2f ms per 1M orbits, error %.1e", MinorPlanets::KernelName(kernelReports[i].kernel),
+				kernelReports[i].ms, kernelReports[i].maxError);
 		ImGui::RadioButton("View 1", &viewMode, 0); ImGui::SameLine();
 		ImGui::RadioButton("View 2", &viewMode, 1); ImGui::SameLine();
 		ImGui::RadioButton("View 3", &viewMode, 2); ImGui::SameLine();
 		ImGui::RadioButton("View 4", &viewMode, 3);
 
 		ImGui::RadioButton("Mouse/keyboard movement", &viewMode, 4);
+
+		ImGui::Spacing();
+		ImGui::SliderFloat("Exposure", &PostProcess::exposure, 0.1f, 4.0f);
+		ImGui::SliderFloat("Sun Intensity", &sunIntensity, 1.0f, 20.0f);
+		ImGui::SliderFloat("Sky Intensity", &skyIntensity, 0.0f, 8.0f);
+		ImGui::SliderFloat("Bloom Strength", &PostProcess::bloomStrength, 0.0f, 2.0f);
+		ImGui::SliderFloat("Bloom Threshold", &PostProcess::bloomThreshold, 0.5f, 4.0f);
+
+		ImGui::Checkbox("Dynamic Resolution", &PostProcess::dynamicResolution);
+		if (PostProcess::dynamicResolution)
+		{
+			ImGui::SliderFloat("GPU Budget (ms)", &PostProcess::targetGpuMs, 4.0f, 33.0f);
+			ImGui::SliderFloat("Minimum Scale", &PostProcess::minScale, 0.25f, 1.0f);
+		}
+		ImGui::Text("Scene %dx%d (%.0f%%), GPU %.2f ms", PostProcess::SceneWidth(), PostProcess::SceneHeight(),
+			PostProcess::RenderScale() * 100.0f, PostProcess::GpuMs());
+
+		if (phongTessProgram)
+		{
+			ImGui::Checkbox("Tessellated Planets", &tessellatedPlanets);
+			ImGui::SliderFloat("Pixels Per Edge", &pixelsPerEdge, 2.0f, 32.0f);
+		}
+		if (phongImpostorProgram && emissiveImpostorProgram)
+			ImGui::Checkbox("Ray Traced Impostors", &impostorBodies);
+
+		if (StarField::Available())
+		{
+			ImGui::Checkbox("Catalog Stars", &catalogStars);
+			if (catalogStars)
+			{
+				ImGui::SliderFloat("Magnitude Limit", &StarField::magnitudeLimit, 0.0f, 12.0f);
+				ImGui::SliderFloat("Star Size", &StarField::starSize, 0.5f, 4.0f);
+				ImGui::SliderFloat("Star Brightness", &StarField::brightness, 0.05f, 4.0f);
+				ImGui::Text("%d of %d stars, %.1f MB", StarField::DrawnCount(), StarField::Count(),
+					StarField::Bytes() / (1024.0f * 1024.0f));
+			}
+		}
+
+		ImGui::Spacing();
+		ImGui::Checkbox("Late Latch Free-Cam", &lateLatchCamera);
+		ImGui::Checkbox("Low Latency (1 Frame In Flight)", &frameLatency.lowLatency);
+		ImGui::Checkbox("Measure Input Latency", &frameLatency.measuring);
+		if (frameLatency.measuring)
+		{
+			ImGui::PlotLines("Input To GPU (ms)", frameLatency.History(), FrameLatency::historySize, 0, 0, 0.0f, 50.0f, ImVec2(0, 40));
+			ImGui::Text("%.1f ms average, %.1f ms worst over %d samples", frameLatency.AverageMs(), frameLatency.WorstMs(), frameLatency.Samples());
+		}
+
+		ImGui::Spacing();
+		int budgetMB = (int)(GpuMemory::budget >> 20);
+		if (ImGui::SliderInt("GPU Memory Budget (MB)", &budgetMB, 32, 4096))
+			GpuMemory::budget = (size_t)budgetMB << 20;
+		ImGui::Text("%.1f MB in use, %.1f MB left for streaming", GpuMemory::TotalBytes() / (1024.0f * 1024.0f), GpuMemory::StreamingBudget() / (1024.0f * 1024.0f));
+		for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++)
+			ImGui::Text("  %-9s %8.2f MB in %d", GpuMemory::CategoryName((MemoryCategory)i), GpuMemory::Bytes((MemoryCategory)i) / (1024.0f * 1024.0f), GpuMemory::Count((MemoryCategory)i));
+		ImGui::Text("Textures %.1f MB resident, %d loads pending", textureStreamer.ResidentBytes() / (1024.0f * 1024.0f), textureStreamer.PendingLoads());
 	}
 	ImGui::End();
 }
@@ -1055,17 +1295,179 @@ void OnWindowResized(GLFWwindow* win, int w, int h)
 	glViewport(0, 0, width, height);
 	float ratio = width / (float)height;
 	projectionMatrix = perspective(radians(40.0f), ratio, 0.1f, 1000.0f);
+
+	// The HDR target and bloom chain follow the window size
+	PostProcess::Resize(width, height);
+}
+
+// Update() on this thread at a few belt sizes, with the belt on rails on the CPU, on the GPU and under gravity.
+// There's a fixed set of bodies, so the belt is what changes. The cases that don't need the app come from bench.cpp
+bool RunBenchmarks(const char* path)
+{
+	// The first loads would otherwise still be decoding on the streamer's thread and show up as allocations
+	double settleUntil = glfwGetTime() + 10.0;
+	while (textureStreamer.PendingLoads() > 0 && glfwGetTime() < settleUntil)
+		textureStreamer.Update();
+
+	BenchmarkRunner runner;
+	AddLibraryBenchmarks(runner);
+
+	static const char* modes[] = { "rails", "gpu", "nbody" };
+	static const int counts[] = { 1000, 20000, 100000 };
+	for (int mode = 0; mode < 3; mode++)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			int count = counts[c];
+			char name[64];
+			sprintf(name, "BM_Update/%s/%d", modes[mode], count);
+			runner.Add(name, [=](BenchState& state)
+			{
+				if (mode == 1 && !GpuBelt::Available())
+				{
+					state.SkipWithError("no compute shaders");
+					return;
+				}
+				nbodyMode = mode == 2;
+				gpuBelt = mode == 1;
+				beltCount = count;
+				BeginRepeatableRun(simulationSeed, viewMatrix);
+
+				FrameInput frame = {};
+				frame.deltaTime = 1.0f / 60.0f;
+				frame.viewMode = 3;
+				Update(frame);                                              // <- Seeds the belt outside the timing
+				glFinish();
+
+				while (state.KeepRunning())
+				{
+					Update(frame);
+					state.PauseTiming();
+					glFinish();                                             // <- The GPU's share of the belt isn't the update's
+					state.ResumeTiming();
+				}
+				state.SetItemsProcessed(state.Iterations() * count);
+			});
+		}
+	}
+
+	runner.Run();
+	return runner.WriteJSON(path, (const char*)glGetString(GL_RENDERER));
 }
 
 
-int main()
+int main(int argc, char** argv)
 {
+	// --record or --replay a log (replay.bin if no file is given), --seed for the asteroid launches.
+	// A replay from the command line closes the app when it's done, for timing runs.
+	// --latency prints the input latency once a second, --trace [file] writes a Chrome trace on exit.
+	// --capture [file] records from the first frame, --fps and --frames set its rate and length,
+	// --headless keeps the window hidden, --regress [dir] and --regress-update [dir] check or write the goldens,
+	// --bench [file] runs the benchmarks and writes their JSON (bench.json if no file is given)
+	bool recordOnStart = false, replayOnStart = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--latency"))
+		{
+			frameLatency.measuring = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "--headless"))
+		{
+			headless = true;
+			continue;
+		}
+
+		const char* value = i + 1 < argc && argv[i + 1][0] != '-' ? argv[i + 1] : 0;
+		if (!strcmp(argv[i], "--trace"))
+		{
+			traceOnExit = true;
+			if (value)
+			{
+				tracePath = value;
+				i++;
+			}
+			continue;
+		}
+		if (!strcmp(argv[i], "--seed") && value)
+		{
+			simulationSeed = (unsigned int)strtoul(value, 0, 10);
+			i++;
+			continue;
+		}
+		if (!strcmp(argv[i], "--capture"))
+		{
+			captureOnStart = true;
+			if (value)
+			{
+				capturePath = value;
+				i++;
+			}
+			continue;
+		}
+		if (!strcmp(argv[i], "--regress") || !strcmp(argv[i], "--regress-update"))
+		{
+			regressOnStart = true;
+			regressUpdate = !strcmp(argv[i], "--regress-update");
+			if (value)
+			{
+				regressionPath = value;
+				i++;
+			}
+			continue;
+		}
+		if (!strcmp(argv[i], "--bench"))
+		{
+			benchOnStart = true;
+			if (value)
+			{
+				benchPath = value;
+				i++;
+			}
+			continue;
+		}
+		if (!strcmp(argv[i], "--fps") && value)
+		{
+			captureFps = atoi(value);
+			i++;
+			continue;
+		}
+		if (!strcmp(argv[i], "--frames") && value)
+		{
+			captureFrames = atoi(value);
+			i++;
+			continue;
+		}
+
+		if (!strcmp(argv[i], "--record"))
+			recordOnStart = true;
+		else if (!strcmp(argv[i], "--replay"))
+			replayOnStart = exitAfterReplay = true;
+		else
+		{
+			printf("unknown argument: %s\n", argv[i]);
+			continue;
+		}
+
+		if (value)
+		{
+			replayPath = value;
+			i++;
+		}
+	}
+
+	Profiler::SetThreadName("Main");
+
 	// start GL context and O/S window using the GLFW helper library
 	if (!glfwInit()) {
 		fprintf(stderr, "ERROR: could not start GLFW3\n");
 		return 1;
 	}
 
+	// Hidden windows still have a backbuffer to render and read back from
+	if (headless)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
 	window = glfwCreateWindow(width, height, "Laboratory 8", NULL, NULL);
 	if (!window) {
 		fprintf(stderr, "ERROR: could not open window with GLFW3\n");
@@ -1084,6 +1486,7 @@ int main()
 
 	// Setup ImGui binding
 	ImGui_ImplGlfwGL3_Init(window, true);
+	frameLatency.Install(window);
 	ImGui::StyleColorsLight();
 
 	// get version info
@@ -1100,10 +1503,41 @@ int main()
 
 	Initialize();
 
+	if (replayOnStart)
+		StartReplay();
+	else if (recordOnStart)
+		StartRecording();
+
+	if (captureOnStart)
+		StartCapture();
+
+	// Same seed, a stopped clock and a fixed resolution, so the only thing that changes a scene is the renderer
+	if (regressOnStart)
+	{
+		BeginRepeatableRun(1, viewMatrix);
+		simulationPaused = true;
+		PostProcess::dynamicResolution = false;
+		regression.Start(regressionPath, regressUpdate);
+	}
+
+	// Runs before the first frame and skips the loop
+	bool benchFailed = false;
+	if (benchOnStart)
+	{
+		benchFailed = !RunBenchmarks(benchPath);
+		glfwSetWindowShouldClose(window, GLFW_TRUE);
+	}
+
 	float oldTime = 0.0f, currentTime = 0.0f, deltaTime = 0.0f;
 	while (!glfwWindowShouldClose(window))
 	{
-		do { currentTime = (float)glfwGetTime(); } while (currentTime - oldTime < 1.0f / 120.0f);
+		bool offline = capture.Active() || regression.Active();
+		do { currentTime = (float)glfwGetTime(); } while (!offline && currentTime - oldTime < 1.0f / 120.0f);
+		ProfileScope frameScope("Frame");
+		Arena::Frame().Reset();                                             // <- Nothing from last frame is still using it
+
+		// Wait out the GPU before sampling input, rather than after
+		frameLatency.BeginFrame();
 
 		//FreeCam(deltaTime);
 		// update other events like input handling 
@@ -1117,22 +1551,82 @@ int main()
 
 		deltaTime = currentTime - oldTime; // Difference in time
 		oldTime = currentTime;
+		if (capture.Active())
+			deltaTime = 1.0f / capture.FramesPerSecond();                   // <- Video time, however long the frame really took
+		if (regression.Active())
+			deltaTime = 0.0f;                                               // <- Nothing moves, however many frames a scene takes to settle
+
+		if (regression.NewScene())
+		{
+			viewMode = regression.Scene().viewMode;
+			JumpToYear((float)(regression.Scene().earthDays / 365.25));
+		}
+
+		// Live input gets recorded, or swapped out for the next frame of a replay
+		FrameInput frame = PollInput(deltaTime);
+		if (replay.Playing())
+		{
+			ReplaySettings settings;
+			bool settingsChanged;
+			if (replay.Next(frame, settings, settingsChanged))
+			{
+				if (settingsChanged)
+					ApplySettings(settings);
+			}
+			else
+				StopReplay();
+		}
+		else if (recorder.Recording())
+			recorder.Record(frame, CurrentSettings());
 
 		// Call the helper functions
-		Update(deltaTime);
+		double cpuStart = glfwGetTime();
+		Update(frame);
 		Render();
+		float cpuMs = (float)((glfwGetTime() - cpuStart) * 1000.0);
+		capture.Grab(width, height);                                        // <- Before the GUI goes on top
+		regression.Grab(width, height);
 		GUI();
 
 		// Finish by drawing the GUI
 		ImGui::Render();
+		GLState::EndFrame();
+		GpuMemory::EndFrame();
+		regression.EndFrame(cpuMs, GLState::LastFrame(), textureStreamer.PendingLoads() == 0);
+		if (regression.Done())
+			glfwSetWindowShouldClose(window, GLFW_TRUE);
 		glfwSwapBuffers(window);
+		frameLatency.FrameSwapped();
+		frameScope.End();
+
+		bool traceKey = glfwGetKey(window, GLFW_KEY_F9) != 0;
+		if (traceKey && !traceKeyDown)
+			Profiler::WriteChromeTrace(tracePath);
+		traceKeyDown = traceKey;
+
+		if (frameLatency.measuring && frameLatency.Samples() > 0 && currentTime - latencyReportTime >= 1.0)
+		{
+			printf("input latency %.2f ms average, %.2f ms worst\n", frameLatency.AverageMs(), frameLatency.WorstMs());
+			latencyReportTime = currentTime;
+		}
+
+		if (capture.Active() && captureFrames > 0 && capture.Grabbed() >= captureFrames)
+			glfwSetWindowShouldClose(window, GLFW_TRUE);
 	}
 
-	// close GL context and any other GLFW resources
-	glfwTerminate();
+	// The reads still in flight need the context
+	capture.Stop();
+
+	if (traceOnExit)
+		Profiler::WriteChromeTrace(tracePath);
+
+	// Every GL object has to go while the context is still current
 	ImGui_ImplGlfwGL3_Shutdown();
 	Cleanup();
-	return 0;
+
+	// close GL context and any other GLFW resources
+	glfwTerminate();
+	return regression.Failures() > 0 || benchFailed ? 1 : 0;
 }
 
 
@@ -1,4 +1,7 @@
 #include "Mesh.h"
+#include "profiler.h"
+#include "glstate.h"
+#include "arena.h"
 
 #include <GLM/glm.hpp>
 
@@ -16,6 +19,7 @@
 
 std::vector<Mesh> Mesh::LoadOBJ(std::string baseLoc, std::string fileName)
 {
+    PROFILE_SCOPE("LoadOBJ", fileName.c_str());
     std::vector<Mesh> meshVector;
         
     {   // We're going to use TinyObjLoader to load in a wavefront OBJ file
@@ -39,9 +43,11 @@ std::vector<Mesh> Mesh::LoadOBJ(std::string baseLoc, std::string fileName)
         {
             Mesh mesh_object;
 
-            std::vector<glm::vec3> vertices;
-            std::vector<glm::vec3> normals;
-            std::vector<glm::vec2> uvs;
+            // Only needed until the VBO is filled, each shape gives them back
+            ScratchScope scratch;
+            ArenaVector<glm::vec3> vertices(Arena::Scratch());
+            ArenaVector<glm::vec3> normals(Arena::Scratch());
+            ArenaVector<glm::vec2> uvs(Arena::Scratch());
 
             int meshCount = 0;
             std::map<int, unsigned int> idRemap;
@@ -90,7 +96,7 @@ std::vector<Mesh> Mesh::LoadOBJ(std::string baseLoc, std::string fileName)
                 ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
                 // 9 because vec3 has 3 parts, and there are 2 vec3s. and a vec2 3x2 + 2 =8
-                std::vector<float> interleavedVBO(8 * vertices.size());
+                ArenaVector<float> interleavedVBO(8 * vertices.size(), Arena::Scratch());
                 // Create an interleaved VBO. This is layout out the following way
                 /*
                 vec3_vertices, vec3_normals, vec2_uvs, vec3_vertices, vec3_normals, vec2_uvs, etc...
@@ -107,12 +113,13 @@ std::vector<Mesh> Mesh::LoadOBJ(std::string baseLoc, std::string fileName)
                     interleavedVBO[i * 8 + 7] = uvs[i].y;
                 }
 
-                glGenVertexArrays(1, &mesh_object.vao);
-                glBindVertexArray(mesh_object.vao);
+                mesh_object.vao.Create(MEMORY_GEOMETRY);
+                GLState::BindVertexArray(mesh_object.vao);
 
-                glGenBuffers(1, &mesh_object.vbo);
-                glBindBuffer(GL_ARRAY_BUFFER, mesh_object.vbo);
+                mesh_object.vbo.Create(MEMORY_GEOMETRY);
+                GLState::BindBuffer(GL_ARRAY_BUFFER, mesh_object.vbo);
                 glBufferData(GL_ARRAY_BUFFER, sizeof(float) * interleavedVBO.size(), &interleavedVBO[0], GL_STATIC_DRAW);
+                mesh_object.vbo.SetBytes(sizeof(float) * interleavedVBO.size());
 
                 // Vertex info
                 glVertexAttribPointer(VERTEX_LOC, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void*)0);
@@ -127,7 +134,7 @@ std::vector<Mesh> Mesh::LoadOBJ(std::string baseLoc, std::string fileName)
                 // Uncomment the line below when you've fixed the code above
                 mesh_object.vertexCount = (unsigned int)vertices.size();
 
-                meshVector.push_back(mesh_object);
+                meshVector.push_back(std::move(mesh_object));
 
             }
         }
@@ -138,136 +145,149 @@ std::vector<Mesh> Mesh::LoadOBJ(std::string baseLoc, std::string fileName)
 
 void Mesh::DrawMesh()
 {
-    glBindVertexArray(vao);
-    glDrawArrays(GL_TRIANGLES, 0, vertexCount);
+    GLState::BindVertexArray(vao);
+    GLState::DrawArrays(GL_TRIANGLES, 0, vertexCount);
 }
 
 bool Primitive::sInit = false;
+bool Primitive::pInit = false;
 bool Primitive::bInit = false;
 bool Primitive::qInit = false;
 bool Primitive::xInit = false;
+bool Primitive::iInit = false;
 
 Primitive Primitive::sphere = Primitive();
+Primitive Primitive::spherePatches = Primitive();
 Primitive Primitive::box = Primitive();
 Primitive Primitive::quad = Primitive();
 Primitive Primitive::skybox = Primitive();
+Primitive Primitive::impostor = Primitive();
 
-void Primitive::DrawSphere()
+unsigned int Primitive::BuildSphere(int nbLong, int nbLat, ArenaVector<float>& interleavedVBO)
 {
-    if (!sInit)
-    {
-        sInit = true;
-        #pragma region Building a procedural sphere
-        const float radius  = 0.5f;
-        const int nbLong    = 24;
-        const int nbLat     = 16;
+    #pragma region Building a procedural sphere
+    const float radius  = 0.5f;
  
-        #pragma region Vertices
-        std::vector<glm::vec3> vertices((nbLong+1) * nbLat + 2);
-        float _pi = 3.1415f;
-        float _2pi = _pi * 2.0f;
+    #pragma region Vertices
+    ArenaVector<glm::vec3> vertices((nbLong+1) * nbLat + 2, Arena::Scratch());
+    float _pi = 3.1415f;
+    float _2pi = _pi * 2.0f;
  
-        vertices[0] = glm::vec3(0,1,0) * radius;
-        for( int lat = 0; lat < nbLat; lat++ )
-        {
-	        float a1 = _pi * (float)(lat+1) / (nbLat+1);
-	        float sin1 = sin(a1);
-	        float cos1 = cos(a1);
+    vertices[0] = glm::vec3(0,1,0) * radius;
+    for( int lat = 0; lat < nbLat; lat++ )
+    {
+	    float a1 = _pi * (float)(lat+1) / (nbLat+1);
+	    float sin1 = sin(a1);
+	    float cos1 = cos(a1);
  
-	        for( int lon = 0; lon <= nbLong; lon++ )
-	        {
-		        float a2 = _2pi * (float)(lon == nbLong ? 0 : lon) / nbLong;
-		        float sin2 = sin(a2);
-		        float cos2 = cos(a2);
+	    for( int lon = 0; lon <= nbLong; lon++ )
+	    {
+		    float a2 = _2pi * (float)(lon == nbLong ? 0 : lon) / nbLong;
+		    float sin2 = sin(a2);
+		    float cos2 = cos(a2);
  
-		        vertices[ lon + lat * (nbLong + 1) + 1] = glm::vec3( sin1 * cos2, cos1, sin1 * sin2 ) * radius;
-	        }
-        }
-        vertices[vertices.size() - 1] = glm::vec3(0,1,0) * -radius;
-        #pragma endregion
+		    vertices[ lon + lat * (nbLong + 1) + 1] = glm::vec3( sin1 * cos2, cos1, sin1 * sin2 ) * radius;
+	    }
+    }
+    vertices[vertices.size() - 1] = glm::vec3(0,1,0) * -radius;
+    #pragma endregion
  
-        #pragma region Normales		
-        std::vector<glm::vec3> normales(vertices.size());
-        for( unsigned int n = 0; n < vertices.size(); n++ )
-	        normales[n] = glm::normalize(vertices[n]);
-        #pragma endregion
+    #pragma region Normales		
+    ArenaVector<glm::vec3> normales(vertices.size(), Arena::Scratch());
+    for( unsigned int n = 0; n < vertices.size(); n++ )
+	    normales[n] = glm::normalize(vertices[n]);
+    #pragma endregion
  
-        #pragma region UVs
-        std::vector<glm::vec2> uvs(vertices.size());
-        uvs[0] = glm::vec2(0,1);
-        uvs[uvs.size()-1] = glm::vec2(0);
-        for( int lat = 0; lat < nbLat; lat++ )
-	        for( int lon = 0; lon <= nbLong; lon++ )
-		        uvs[lon + lat * (nbLong + 1) + 1] = glm::vec2( (float)lon / nbLong, 1.0f - (float)(lat+1) / (nbLat+1) );
-        #pragma endregion
+    #pragma region UVs
+    ArenaVector<glm::vec2> uvs(vertices.size(), Arena::Scratch());
+    uvs[0] = glm::vec2(0,1);
+    uvs[uvs.size()-1] = glm::vec2(0);
+    for( int lat = 0; lat < nbLat; lat++ )
+	    for( int lon = 0; lon <= nbLong; lon++ )
+		    uvs[lon + lat * (nbLong + 1) + 1] = glm::vec2( (float)lon / nbLong, 1.0f - (float)(lat+1) / (nbLat+1) );
+    #pragma endregion
  
-        #pragma region Triangles
-        int nbFaces = (int)vertices.size();
-        int nbTriangles = nbFaces * 2;
-        int nbIndexes = nbTriangles * 3;
-        std::vector<int> triangles(nbIndexes);
+    #pragma region Triangles
+    int nbFaces = (int)vertices.size();
+    int nbTriangles = nbFaces * 2;
+    int nbIndexes = nbTriangles * 3;
+    ArenaVector<int> triangles(nbIndexes, Arena::Scratch());
  
-        //Top Cap
-        int i = 0;
-        for( int lon = 0; lon < nbLong; lon++ )
-        {
-	        triangles[i++] = lon+2;
-	        triangles[i++] = lon+1;
-	        triangles[i++] = 0;
-        }
+    //Top Cap
+    int i = 0;
+    for( int lon = 0; lon < nbLong; lon++ )
+    {
+	    triangles[i++] = lon+2;
+	    triangles[i++] = lon+1;
+	    triangles[i++] = 0;
+    }
  
-        //Middle
-        for( int lat = 0; lat < nbLat - 1; lat++ )
-        {
-	        for( int lon = 0; lon < nbLong; lon++ )
-	        {
-		        int current = lon + lat * (nbLong + 1) + 1;
-		        int next = current + nbLong + 1;
+    //Middle
+    for( int lat = 0; lat < nbLat - 1; lat++ )
+    {
+	    for( int lon = 0; lon < nbLong; lon++ )
+	    {
+		    int current = lon + lat * (nbLong + 1) + 1;
+		    int next = current + nbLong + 1;
  
-		        triangles[i++] = current;
-		        triangles[i++] = current + 1;
-		        triangles[i++] = next + 1;
+		    triangles[i++] = current;
+		    triangles[i++] = current + 1;
+		    triangles[i++] = next + 1;
  
-		        triangles[i++] = current;
-		        triangles[i++] = next + 1;
-		        triangles[i++] = next;
-	        }
-        }
+		    triangles[i++] = current;
+		    triangles[i++] = next + 1;
+		    triangles[i++] = next;
+	    }
+    }
  
-        //Bottom Cap
-        for( int lon = 0; lon < nbLong; lon++ )
-        {
-	        triangles[i++] = (int)vertices.size() - 1;
-	        triangles[i++] = (int)vertices.size() - (lon+2) - 1;
-	        triangles[i++] = (int)vertices.size() - (lon+1) - 1;
-        }
-        #pragma endregion
+    //Bottom Cap
+    for( int lon = 0; lon < nbLong; lon++ )
+    {
+	    triangles[i++] = (int)vertices.size() - 1;
+	    triangles[i++] = (int)vertices.size() - (lon+2) - 1;
+	    triangles[i++] = (int)vertices.size() - (lon+1) - 1;
+    }
+    #pragma endregion
 
-        #pragma region interleavedVBO
+    #pragma region interleavedVBO
 
-        std::vector<float> interleavedVBO(triangles.size() * 8);
-        for (size_t i = 0; i < triangles.size(); i++)
-        {
-            interleavedVBO[i * 8 + 0] = vertices[triangles[i]].x;
-            interleavedVBO[i * 8 + 1] = vertices[triangles[i]].y;
-            interleavedVBO[i * 8 + 2] = vertices[triangles[i]].z;
-            interleavedVBO[i * 8 + 3] = normales[triangles[i]].x;
-            interleavedVBO[i * 8 + 4] = normales[triangles[i]].y;
-            interleavedVBO[i * 8 + 5] = normales[triangles[i]].z;
-            interleavedVBO[i * 8 + 6] = uvs[triangles[i]].x;
-            interleavedVBO[i * 8 + 7] = uvs[triangles[i]].y;
-        }
+    interleavedVBO.resize(triangles.size() * 8);
+    for (size_t i = 0; i < triangles.size(); i++)
+    {
+        interleavedVBO[i * 8 + 0] = vertices[triangles[i]].x;
+        interleavedVBO[i * 8 + 1] = vertices[triangles[i]].y;
+        interleavedVBO[i * 8 + 2] = vertices[triangles[i]].z;
+        interleavedVBO[i * 8 + 3] = normales[triangles[i]].x;
+        interleavedVBO[i * 8 + 4] = normales[triangles[i]].y;
+        interleavedVBO[i * 8 + 5] = normales[triangles[i]].z;
+        interleavedVBO[i * 8 + 6] = uvs[triangles[i]].x;
+        interleavedVBO[i * 8 + 7] = uvs[triangles[i]].y;
+    }
 
-        #pragma endregion
+    #pragma endregion
+    #pragma endregion
+
+    return (unsigned int)(interleavedVBO.size() / 8);
+}
+
+void Primitive::DrawSphere()
+{
+    if (!sInit)
+    {
+        sInit = true;
+        ScratchScope scratch;
+        ArenaVector<float> interleavedVBO(Arena::Scratch());
+        sphere.vertexCount = BuildSphere(24, 16, interleavedVBO);
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-        glGenVertexArrays(1, &sphere.vao);
-        glBindVertexArray(sphere.vao);
+        sphere.vao.Create(MEMORY_GEOMETRY);
+        GLState::BindVertexArray(sphere.vao);
 
-        glGenBuffers(1, &sphere.vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, sphere.vbo);
+        sphere.vbo.Create(MEMORY_GEOMETRY);
+        GLState::BindBuffer(GL_ARRAY_BUFFER, sphere.vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(float) * interleavedVBO.size(), &interleavedVBO[0], GL_STATIC_DRAW);
+        sphere.vbo.SetBytes(sizeof(float) * interleavedVBO.size());
 
         // Vertex info
         glVertexAttribPointer(VERTEX_LOC, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void*)0);
@@ -278,14 +298,63 @@ void Primitive::DrawSphere()
         // UV info
         glVertexAttribPointer(TEXCOORD_LOC, 2, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void*)(sizeof(glm::vec3) * 2));
         glEnableVertexAttribArray(TEXCOORD_LOC);
+    }
 
-        // Uncomment the line below when you've fixed the code above
-        sphere.vertexCount = (unsigned int)triangles.size();
+    GLState::BindVertexArray(sphere.vao);
+    GLState::DrawArrays(GL_TRIANGLES, 0, sphere.vertexCount);
+}
+
+void Primitive::DrawSpherePatches()
+{
+    if (!pInit)
+    {
+        pInit = true;
+        ScratchScope scratch;
+        #pragma region Building a coarse lat/long patch mesh
+        // One quad patch per cell, corners going east then north. The tessellation shaders
+        // put every vertex on the sphere from its UV, so only the UVs matter here
+        const int nbLong    = 16;
+        const int nbLat     = 8;
+
+        ArenaVector<glm::vec2> uvs(Arena::Scratch());
+        for( int lat = 0; lat < nbLat; lat++ )
+        {
+            float v0 = (float)lat / nbLat;
+            float v1 = (float)(lat+1) / nbLat;
+
+            for( int lon = 0; lon < nbLong; lon++ )
+            {
+                float u0 = (float)lon / nbLong;
+                float u1 = (float)(lon+1) / nbLong;
+
+                uvs.push_back(glm::vec2(u0, v0));
+                uvs.push_back(glm::vec2(u1, v0));
+                uvs.push_back(glm::vec2(u1, v1));
+                uvs.push_back(glm::vec2(u0, v1));
+            }
+        }
         #pragma endregion
+
+        ////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+        spherePatches.vao.Create(MEMORY_GEOMETRY);
+        GLState::BindVertexArray(spherePatches.vao);
+
+        spherePatches.vbo.Create(MEMORY_GEOMETRY);
+        GLState::BindBuffer(GL_ARRAY_BUFFER, spherePatches.vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec2) * uvs.size(), &uvs[0], GL_STATIC_DRAW);
+        spherePatches.vbo.SetBytes(sizeof(glm::vec2) * uvs.size());
+
+        // UV info
+        glVertexAttribPointer(TEXCOORD_LOC, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+        glEnableVertexAttribArray(TEXCOORD_LOC);
+
+        spherePatches.vertexCount = (unsigned int)uvs.size();
     }
 
-    glBindVertexArray(sphere.vao);
-    glDrawArrays(GL_TRIANGLES, 0, sphere.vertexCount);
+    glPatchParameteri(GL_PATCH_VERTICES, 4);
+    GLState::BindVertexArray(spherePatches.vao);
+    GLState::DrawArrays(GL_PATCHES, 0, spherePatches.vertexCount);
 }
 
 void Primitive::DrawBox()
@@ -293,6 +362,7 @@ void Primitive::DrawBox()
     if (!bInit)
     {
         bInit = true;
+        ScratchScope scratch;
         #pragma region Building a procedural box
         float length    = 1.0f;
         float width     = 1.0f;
@@ -399,7 +469,7 @@ void Primitive::DrawBox()
         #pragma endregion
 
         #pragma region interleavedVBO
-        std::vector<float> interleavedVBO(triangles.size() * 8);
+        ArenaVector<float> interleavedVBO(triangles.size() * 8, Arena::Scratch());
         for (size_t i = 0; i < triangles.size(); i++)
         {
             interleavedVBO[i * 8 + 0] = vertices[triangles[i]].x;
@@ -415,12 +485,13 @@ void Primitive::DrawBox()
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-        glGenVertexArrays(1, &box.vao);
-        glBindVertexArray(box.vao);
+        box.vao.Create(MEMORY_GEOMETRY);
+        GLState::BindVertexArray(box.vao);
 
-        glGenBuffers(1, &box.vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, box.vbo);
+        box.vbo.Create(MEMORY_GEOMETRY);
+        GLState::BindBuffer(GL_ARRAY_BUFFER, box.vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(float) * interleavedVBO.size(), &interleavedVBO[0], GL_STATIC_DRAW);
+        box.vbo.SetBytes(sizeof(float) * interleavedVBO.size());
 
         // Vertex info
         glVertexAttribPointer(VERTEX_LOC, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void*)0);
@@ -437,8 +508,8 @@ void Primitive::DrawBox()
         #pragma endregion
     }
 
-    glBindVertexArray(box.vao);
-    glDrawArrays(GL_TRIANGLES, 0, box.vertexCount);
+    GLState::BindVertexArray(box.vao);
+    GLState::DrawArrays(GL_TRIANGLES, 0, box.vertexCount);
 }
 
 void Primitive::DrawFullscreenQuad()
@@ -446,6 +517,7 @@ void Primitive::DrawFullscreenQuad()
     if (!qInit)
     {
         qInit = true;
+        ScratchScope scratch;
         #pragma region Building a procedural quad
         float width     = 1.0f;
         float height    = 1.0f;
@@ -483,7 +555,7 @@ void Primitive::DrawFullscreenQuad()
         #pragma endregion
 
         #pragma region interleavedVBO
-        std::vector<float> interleavedVBO(triangles.size() * 8);
+        ArenaVector<float> interleavedVBO(triangles.size() * 8, Arena::Scratch());
         for (size_t i = 0; i < triangles.size(); i++)
         {
             interleavedVBO[i * 8 + 0] = vertices[triangles[i]].x;
@@ -499,12 +571,13 @@ void Primitive::DrawFullscreenQuad()
 
         ////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-        glGenVertexArrays(1, &quad.vao);
-        glBindVertexArray(quad.vao);
+        quad.vao.Create(MEMORY_GEOMETRY);
+        GLState::BindVertexArray(quad.vao);
 
-        glGenBuffers(1, &quad.vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, quad.vbo);
+        quad.vbo.Create(MEMORY_GEOMETRY);
+        GLState::BindBuffer(GL_ARRAY_BUFFER, quad.vbo);
         glBufferData(GL_ARRAY_BUFFER, sizeof(float) * interleavedVBO.size(), &interleavedVBO[0], GL_STATIC_DRAW);
+        quad.vbo.SetBytes(sizeof(float) * interleavedVBO.size());
 
         // Vertex info
         glVertexAttribPointer(VERTEX_LOC, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 8, (void*)0);
@@ -520,8 +593,8 @@ void Primitive::DrawFullscreenQuad()
         quad.vertexCount = (unsigned int)triangles.size();
         #pragma endregion
     }
-    glBindVertexArray(quad.vao);
-    glDrawArrays(GL_TRIANGLES, 0, quad.vertexCount);
+    GLState::BindVertexArray(quad.vao);
+    GLState::DrawArrays(GL_TRIANGLES, 0, quad.vertexCount);
 }
 
 void Primitive::DrawSkybox()
@@ -575,25 +648,47 @@ void Primitive::DrawSkybox()
            10.0f, -10.0f,  10.0f
         };
 
-        GLuint vbo;
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        skybox.vbo.Create(MEMORY_GEOMETRY);
+        GLState::BindBuffer(GL_ARRAY_BUFFER, skybox.vbo);
         glBufferData(GL_ARRAY_BUFFER, 3 * 36 * sizeof(float), &points, GL_STATIC_DRAW);
+        skybox.vbo.SetBytes(3 * 36 * sizeof(float));
 
-        GLuint vao;
-        glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
+        skybox.vao.Create(MEMORY_GEOMETRY);
+        GLState::BindVertexArray(skybox.vao);
         glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        GLState::BindBuffer(GL_ARRAY_BUFFER, skybox.vbo);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-
-        skybox.vao = vao;
-        skybox.vbo = vbo;
     }
 
     glDepthMask(GL_FALSE);
-    glBindVertexArray(skybox.vao);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
+    GLState::BindVertexArray(skybox.vao);
+    GLState::DrawArrays(GL_TRIANGLES, 0, 36);
+    GLState::BindVertexArray(0);
     glDepthMask(GL_TRUE);
 }
+
+void Primitive::DrawImpostor()
+{
+    if (!iInit)
+    {
+        iInit = true;
+
+        // Core profile still wants a vertex array bound, even an empty one
+        impostor.vao.Create(MEMORY_GEOMETRY);
+        impostor.vertexCount = 4;
+    }
+
+    GLState::BindVertexArray(impostor.vao);
+    GLState::DrawArrays(GL_TRIANGLE_STRIP, 0, impostor.vertexCount);
+}
+
+void Primitive::Cleanup()
+{
+    Primitive* shapes[] = { &sphere, &spherePatches, &box, &quad, &skybox, &impostor };
+    for (int i = 0; i < 6; i++)
+    {
+        shapes[i]->vao.Reset();
+        shapes[i]->vbo.Reset();
+    }
+    sInit = pInit = bInit = qInit = xInit = iInit = false;
+}
@@ -7,6 +7,9 @@
 #include <vector>
 #include <GL/gl3w.h>
 
+#include "gpumemory.h"
+#include "arena.h"
+
 class Mesh
 {
 public:
@@ -14,7 +17,8 @@ public:
     void DrawMesh();
 
 private:
-    unsigned int vao, vbo;
+    VertexArrayHandle vao;
+    BufferHandle vbo;
     unsigned int vertexCount;
 };
 
@@ -22,18 +26,32 @@ class Primitive
 {
 public:
     static void DrawSphere();
+    static void DrawSpherePatches();
     static void DrawBox();
     static void DrawFullscreenQuad();
     static void DrawSkybox();
 
+    // A quad strip with no vertex data, the impostor shaders place the corners from gl_VertexID
+    static void DrawImpostor();
+
+    // Latitude-longitude sphere of diameter 1 as unindexed triangles, position, normal and uv interleaved.
+    // DrawSphere() uses 24 x 16. Returns the vertex count
+    static unsigned int BuildSphere(int nbLong, int nbLat, ArenaVector<float>& interleavedVBO);
+
+    // Frees the shapes, the next draw of each one builds it again
+    static void Cleanup();
+
 private:
     static bool sInit; static Primitive sphere;
+    static bool pInit; static Primitive spherePatches;
     static bool bInit; static Primitive box;
     static bool qInit; static Primitive quad;
     static bool xInit; static Primitive skybox;
+    static bool iInit; static Primitive impostor;
 
 private:
-    unsigned int vao, vbo;
+    VertexArrayHandle vao;
+    BufferHandle vbo;
     unsigned int vertexCount;
 };
 
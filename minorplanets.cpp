@@ -0,0 +1,392 @@
+/*****************************************
+ *
+ *           MinorPlanets.cpp
+ *
+ *  Orbit propagation over SoA arrays with
+ *  AVX2, SSE4.1, NEON and scalar kernels
+ *  behind a runtime CPU check.
+ *
+ ****************************************/
+
+#include "minorplanets.h"
+
+#include <GLM/gtc/constants.hpp>
+
+#include <random>
+#include <chrono>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MINORPLANETS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define MINORPLANETS_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and clang only emit the wider instructions inside functions marked for them,
+// MSVC emits whatever intrinsics it's given
+#if defined(MINORPLANETS_X86) && defined(__GNUC__)
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define TARGET_SSE4
+#define TARGET_AVX2
+#endif
+
+// Time since the epoch we let the kernels see before the phases are folded forward.
+// Ten years keeps even the moon's fast orbits to a few hundred turns
+static const double maxEpochDays = 3650.0;
+
+int MinorPlanets::kernel = -1;
+
+// Reduced angles are within a quarter turn of the nearest axis, so the sin and cos polynomials
+// (cephes sinf/cosf) only need to cover [-pi/4, pi/4]
+static const float S1 = -1.6666654611e-1f, S2 = 8.3321608736e-3f, S3 = -1.9515295891e-4f;
+static const float C1 = 4.166664568298827e-2f, C2 = -1.388731625493765e-3f, C3 = 2.443315711809948e-5f;
+
+//------------------------------------------------------------------------------------------------ Kernels
+
+static void PropagateScalar(const float* phase, const float* frequency, const float* radius, float t, float* x, float* z, int begin, int end)
+{
+	for (int i = begin; i < end; i++)
+	{
+		float turns = phase[i] + frequency[i] * t;
+		float angle = (turns - floorf(turns)) * glm::two_pi<float>();
+		x[i] = cosf(angle) * radius[i];
+		z[i] = sinf(angle) * radius[i];
+	}
+}
+
+#ifdef MINORPLANETS_X86
+
+TARGET_SSE4 static void PropagateSSE4(const float* phase, const float* frequency, const float* radius, float t, float* x, float* z, int count)
+{
+	const __m128 vt = _mm_set1_ps(t);
+	const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		// Work in quarter turns, the nearest whole one is the quadrant and what's left is the angle
+		__m128 quarters = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(phase + i), _mm_mul_ps(_mm_loadu_ps(frequency + i), vt)), _mm_set1_ps(4.0f));
+		__m128 nearest = _mm_round_ps(quarters, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m128i q = _mm_cvtps_epi32(nearest);
+		__m128 r = _mm_mul_ps(_mm_sub_ps(quarters, nearest), _mm_set1_ps(glm::half_pi<float>()));
+		__m128 r2 = _mm_mul_ps(r, r);
+
+		__m128 sr = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(S3)), _mm_set1_ps(S2));
+		sr = _mm_add_ps(_mm_mul_ps(sr, r2), _mm_set1_ps(S1));
+		sr = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(sr, r2), r), r);
+
+		__m128 cr = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(C3)), _mm_set1_ps(C2));
+		cr = _mm_add_ps(_mm_mul_ps(cr, r2), _mm_set1_ps(C1));
+		cr = _mm_mul_ps(_mm_mul_ps(cr, r2), r2);
+		cr = _mm_add_ps(_mm_sub_ps(cr, _mm_mul_ps(r2, _mm_set1_ps(0.5f))), _mm_set1_ps(1.0f));
+
+		// Odd quadrants swap sin and cos, quadrants 2-3 negate sin and 1-2 negate cos
+		__m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(q, one), one));
+		__m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, two), 30));
+		__m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(q, one), two), 30));
+		__m128 s = _mm_xor_ps(_mm_blendv_ps(sr, cr, swap), sinSign);
+		__m128 c = _mm_xor_ps(_mm_blendv_ps(cr, sr, swap), cosSign);
+
+		__m128 rad = _mm_loadu_ps(radius + i);
+		_mm_storeu_ps(x + i, _mm_mul_ps(c, rad));
+		_mm_storeu_ps(z + i, _mm_mul_ps(s, rad));
+	}
+
+	PropagateScalar(phase, frequency, radius, t, x, z, i, count);
+}
+
+TARGET_AVX2 static void PropagateAVX2(const float* phase, const float* frequency, const float* radius, float t, float* x, float* z, int count)
+{
+	const __m256 vt = _mm256_set1_ps(t);
+	const __m256i one = _mm256_set1_epi32(1), two = _mm256_set1_epi32(2);
+
+	int i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 quarters = _mm256_mul_ps(_mm256_fmadd_ps(_mm256_loadu_ps(frequency + i), vt, _mm256_loadu_ps(phase + i)), _mm256_set1_ps(4.0f));
+		__m256 nearest = _mm256_round_ps(quarters, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+		__m256i q = _mm256_cvtps_epi32(nearest);
+		__m256 r = _mm256_mul_ps(_mm256_sub_ps(quarters, nearest), _mm256_set1_ps(glm::half_pi<float>()));
+		__m256 r2 = _mm256_mul_ps(r, r);
+
+		__m256 sr = _mm256_fmadd_ps(r2, _mm256_set1_ps(S3), _mm256_set1_ps(S2));
+		sr = _mm256_fmadd_ps(sr, r2, _mm256_set1_ps(S1));
+		sr = _mm256_fmadd_ps(_mm256_mul_ps(sr, r2), r, r);
+
+		__m256 cr = _mm256_fmadd_ps(r2, _mm256_set1_ps(C3), _mm256_set1_ps(C2));
+		cr = _mm256_fmadd_ps(cr, r2, _mm256_set1_ps(C1));
+		cr = _mm256_fmadd_ps(_mm256_mul_ps(cr, r2), r2, _mm256_fnmadd_ps(r2, _mm256_set1_ps(0.5f), _mm256_set1_ps(1.0f)));
+
+		__m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(q, one), one));
+		__m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(q, two), 30));
+		__m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(q, one), two), 30));
+		__m256 s = _mm256_xor_ps(_mm256_blendv_ps(sr, cr, swap), sinSign);
+		__m256 c = _mm256_xor_ps(_mm256_blendv_ps(cr, sr, swap), cosSign);
+
+		__m256 rad = _mm256_loadu_ps(radius + i);
+		_mm256_storeu_ps(x + i, _mm256_mul_ps(c, rad));
+		_mm256_storeu_ps(z + i, _mm256_mul_ps(s, rad));
+	}
+
+	PropagateScalar(phase, frequency, radius, t, x, z, i, count);
+}
+
+#endif
+
+#ifdef MINORPLANETS_NEON
+
+static void PropagateNEON(const float* phase, const float* frequency, const float* radius, float t, float* x, float* z, int count)
+{
+	const float32x4_t vt = vdupq_n_f32(t);
+	const int32x4_t one = vdupq_n_s32(1), two = vdupq_n_s32(2);
+
+	int i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		float32x4_t quarters = vmulq_n_f32(vfmaq_f32(vld1q_f32(phase + i), vld1q_f32(frequency + i), vt), 4.0f);
+		float32x4_t nearest = vrndnq_f32(quarters);
+		int32x4_t q = vcvtq_s32_f32(nearest);
+		float32x4_t r = vmulq_n_f32(vsubq_f32(quarters, nearest), glm::half_pi<float>());
+		float32x4_t r2 = vmulq_f32(r, r);
+
+		float32x4_t sr = vfmaq_f32(vdupq_n_f32(S2), r2, vdupq_n_f32(S3));
+		sr = vfmaq_f32(vdupq_n_f32(S1), sr, r2);
+		sr = vfmaq_f32(r, vmulq_f32(sr, r2), r);
+
+		float32x4_t cr = vfmaq_f32(vdupq_n_f32(C2), r2, vdupq_n_f32(C3));
+		cr = vfmaq_f32(vdupq_n_f32(C1), cr, r2);
+		cr = vfmaq_f32(vfmsq_f32(vdupq_n_f32(1.0f), r2, vdupq_n_f32(0.5f)), vmulq_f32(cr, r2), r2);
+
+		uint32x4_t swap = vceqq_s32(vandq_s32(q, one), one);
+		uint32x4_t sinSign = vreinterpretq_u32_s32(vshlq_n_s32(vandq_s32(q, two), 30));
+		uint32x4_t cosSign = vreinterpretq_u32_s32(vshlq_n_s32(vandq_s32(vaddq_s32(q, one), two), 30));
+		float32x4_t s = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vbslq_f32(swap, cr, sr)), sinSign));
+		float32x4_t c = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(vbslq_f32(swap, sr, cr)), cosSign));
+
+		float32x4_t rad = vld1q_f32(radius + i);
+		vst1q_f32(x + i, vmulq_f32(c, rad));
+		vst1q_f32(z + i, vmulq_f32(s, rad));
+	}
+
+	PropagateScalar(phase, frequency, radius, t, x, z, i, count);
+}
+
+#endif
+
+static void Propagate(int kernel, const float* phase, const float* frequency, const float* radius, float t, float* x, float* z, int count)
+{
+	switch (kernel)
+	{
+#ifdef MINORPLANETS_X86
+	case KERNEL_AVX2: PropagateAVX2(phase, frequency, radius, t, x, z, count); break;
+	case KERNEL_SSE4: PropagateSSE4(phase, frequency, radius, t, x, z, count); break;
+#endif
+#ifdef MINORPLANETS_NEON
+	case KERNEL_NEON: PropagateNEON(phase, frequency, radius, t, x, z, count); break;
+#endif
+	default: PropagateScalar(phase, frequency, radius, t, x, z, 0, count); break;
+	}
+}
+
+//------------------------------------------------------------------------------------------------ Dispatch
+
+bool MinorPlanets::Supported(int k)
+{
+	switch (k)
+	{
+	case KERNEL_SCALAR:
+		return true;
+
+#ifdef MINORPLANETS_X86
+#ifdef _MSC_VER
+	case KERNEL_SSE4:
+	{
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 19)) != 0;
+	}
+	case KERNEL_AVX2:
+	{
+		// The OS also has to save the upper halves of the registers (xgetbv bits 1 and 2)
+		int info[4];
+		__cpuid(info, 1);
+		bool fma = (info[2] & (1 << 12)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if (!fma || !osxsave || (_xgetbv(0) & 6) != 6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+	}
+#else
+	case KERNEL_SSE4:
+		return __builtin_cpu_supports("sse4.1") != 0;
+	case KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+#endif
+
+#ifdef MINORPLANETS_NEON
+	case KERNEL_NEON:
+		return true;
+#endif
+
+	default:
+		return false;
+	}
+}
+
+const char* MinorPlanets::KernelName(int k)
+{
+	static const char* names[KERNEL_COUNT] = { "Scalar", "SSE4.1", "AVX2", "NEON" };
+	return k >= 0 && k < KERNEL_COUNT ? names[k] : "Unknown";
+}
+
+static int BestKernel()
+{
+	for (int k = KERNEL_COUNT - 1; k > KERNEL_SCALAR; k--)
+	{
+		if (MinorPlanets::Supported(k))
+			return k;
+	}
+	return KERNEL_SCALAR;
+}
+
+//------------------------------------------------------------------------------------------------ MinorPlanets
+
+MinorPlanets::MinorPlanets()
+{
+	epoch = 0.0;
+}
+
+void MinorPlanets::Seed(int count, float innerRadius, float outerRadius, float centralGM, unsigned int seed)
+{
+	Clear();
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> distance(innerRadius, outerRadius);
+	std::uniform_real_distribution<float> turn(0.0f, 1.0f);
+	std::normal_distribution<float> height(0.0f, 0.3f);
+
+	phase.resize(count); frequency.resize(count); radius.resize(count);
+	x.resize(count); y.resize(count); z.resize(count);
+
+	for (int i = 0; i < count; i++)
+	{
+		// Kepler's third law, period = 2 pi sqrt(r^3 / gm)
+		float r = distance(rng);
+		radius[i] = r;
+		phase[i] = turn(rng);
+		frequency[i] = sqrt(centralGM / (r * r * r)) / glm::two_pi<float>();
+		y[i] = height(rng);
+	}
+}
+
+void MinorPlanets::Clear()
+{
+	phase.clear(); frequency.clear(); radius.clear();
+	x.clear(); y.clear(); z.clear();
+	epoch = 0.0;
+}
+
+void MinorPlanets::Rebase(double days)
+{
+	// Fold the whole turns since the old epoch away in double, once in a while
+	for (int i = 0; i < Count(); i++)
+	{
+		double turns = phase[i] + frequency[i] * (days - epoch);
+		phase[i] = (float)(turns - floor(turns));
+	}
+	epoch = days;
+}
+
+void MinorPlanets::Update(double days)
+{
+	if (phase.empty())
+		return;
+
+	if (kernel < 0 || !Supported(kernel))
+		kernel = BestKernel();
+
+	if (fabs(days - epoch) > maxEpochDays)
+		Rebase(days);
+
+	Propagate(kernel, &phase[0], &frequency[0], &radius[0], (float)(days - epoch), &x[0], &z[0], Count());
+}
+
+void MinorPlanets::CopyPositions(float* xyz) const
+{
+	if (phase.empty())
+		return;
+
+	size_t bytes = phase.size() * sizeof(float);
+	memcpy(xyz, &x[0], bytes);
+	memcpy(xyz + phase.size(), &y[0], bytes);
+	memcpy(xyz + phase.size() * 2, &z[0], bytes);
+}
+
+void MinorPlanets::CopyOrbits(int first, int count, double atDays, float* records) const
+{
+	for (int i = 0; i < count; i++)
+	{
+		int n = first + i;
+		double turns = phase[n] + frequency[n] * (atDays - epoch);
+		records[i * 4 + 0] = (float)(turns - floor(turns));
+		records[i * 4 + 1] = frequency[n];
+		records[i * 4 + 2] = radius[n];
+		records[i * 4 + 3] = y[n];
+	}
+}
+
+int MinorPlanets::Benchmark(int count, Report* reports)
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// A belt the size of the real one, a few hundred days in so the phases have wrapped a bit
+	MinorPlanets belt;
+	belt.Seed(count, 42.0f, 48.0f, 8.0f, 7);
+	const float t = 345.6f;
+
+	std::vector<double> refX(count), refZ(count);
+	for (int i = 0; i < count; i++)
+	{
+		double turns = (double)belt.phase[i] + (double)belt.frequency[i] * t;
+		double angle = (turns - floor(turns)) * glm::two_pi<double>();
+		refX[i] = cos(angle) * belt.radius[i];
+		refZ[i] = sin(angle) * belt.radius[i];
+	}
+
+	int filled = 0;
+	for (int k = 0; k < KERNEL_COUNT; k++)
+	{
+		if (!Supported(k))
+			continue;
+
+		Report& report = reports[filled++];
+		report.kernel = k;
+		report.bodies = count;
+		report.ms = 1e30;
+		for (int run = 0; run < 5; run++)
+		{
+			Clock::time_point start = Clock::now();
+			Propagate(k, &belt.phase[0], &belt.frequency[0], &belt.radius[0], t, &belt.x[0], &belt.z[0], count);
+			report.ms = std::min(report.ms, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+		}
+
+		report.maxError = 0.0;
+		for (int i = 0; i < count; i++)
+		{
+			double dx = belt.x[i] - refX[i], dz = belt.z[i] - refZ[i];
+			report.maxError = std::max(report.maxError, sqrt(dx * dx + dz * dz));
+		}
+	}
+
+	return filled;
+}
@@ -0,0 +1,71 @@
+/**************************************************
+ *
+ *                 MinorPlanets.h
+ *
+ *  Large batches of bodies on circular orbits,
+ *  propagated with vectorised kernels picked at
+ *  runtime for the CPU we're on.
+ *
+ ***************************************************/
+
+#ifndef MINORPLANETS_H
+#define MINORPLANETS_H
+
+#include <vector>
+
+enum OrbitKernel
+{
+    KERNEL_SCALAR = 0,
+    KERNEL_SSE4,
+    KERNEL_AVX2,
+    KERNEL_NEON,
+    KERNEL_COUNT
+};
+
+class MinorPlanets
+{
+public:
+    MinorPlanets();
+
+    // Bodies on circular orbits around a mass gm at the origin, in a ring between the two radii
+    void Seed(int count, float innerRadius, float outerRadius, float centralGM, unsigned int seed);
+    void Clear();
+
+    // Moves every body to the given day with the current kernel
+    void Update(double days);
+
+    int Count() const { return (int)phase.size(); }
+
+    // Positions as three runs of floats, all the x's then the y's then the z's
+    void CopyPositions(float* xyz) const;
+
+    // Orbits [first, first + count) as (phase in turns at the given day, turns per day, radius, height)
+    void CopyOrbits(int first, int count, double atDays, float* records) const;
+
+    // The fastest kernel this CPU can run is picked on first use, anything supported can be forced
+    static bool Supported(int kernel);
+    static const char* KernelName(int kernel);
+    static int kernel;
+
+    // Times every supported kernel on count bodies and checks them against a double precision
+    // reference. Returns how many reports were filled
+    struct Report
+    {
+        int kernel;
+        int bodies;
+        double ms;          // Best of a few runs
+        double maxError;    // Largest position error, in units
+    };
+    static int Benchmark(int count, Report* reports);
+
+private:
+    // Phases are in turns at the epoch, frequencies in turns per day. The epoch moves along with
+    // the date so the float time the kernels see stays small
+    std::vector<float> phase, frequency, radius;
+    std::vector<float> x, y, z;
+    double epoch;
+
+    void Rebase(double days);
+};
+
+#endif
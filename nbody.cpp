@@ -0,0 +1,474 @@
+/*****************************************
+ *
+ *           NBody.cpp
+ *
+ *  Barnes-Hut gravity on a Morton-ordered
+ *  octree, split across all cores, with a
+ *  leapfrog integrator on top.
+ *
+ ****************************************/
+
+#include "nbody.h"
+#include "jobs.h"
+
+#include <GLM/gtc/constants.hpp>
+
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <math.h>
+
+// Particles per leaf before a cell gets split, and the deepest we go (10 bits per axis)
+static const int leafSize = 8;
+static const int maxLevel = 10;
+
+// Fewest items worth handing to another thread
+static const int minGrain = 256;
+
+template <class F>
+static void RunRange(int begin, int end, int /*worker*/, void* data)
+{
+	(*(F*)data)(begin, end);
+}
+
+// Runs fn(begin, end) over [0, count) on the job pool, a few chunks per thread so uneven ones even out
+template <class F>
+static void ParallelFor(int count, F fn)
+{
+	int grain = std::max(minGrain, count / ((Jobs::WorkerCount() + 1) * 4));
+	Jobs::ParallelFor(count, grain, RunRange<F>, &fn);
+}
+
+// Spreads the low 10 bits out so there are two zero bits between each one
+static unsigned int ExpandBits(unsigned int v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+// LSD radix sort of (key, index) pairs, 8 bits a pass
+static void RadixSort(std::vector<unsigned int>& keys, std::vector<int>& values)
+{
+	std::vector<unsigned int> keyTemp(keys.size());
+	std::vector<int> valueTemp(values.size());
+
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		size_t offsets[257] = { 0 };
+		for (size_t i = 0; i < keys.size(); i++)
+			offsets[((keys[i] >> shift) & 0xFF) + 1]++;
+		for (int b = 0; b < 256; b++)
+			offsets[b + 1] += offsets[b];
+
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			size_t dst = offsets[(keys[i] >> shift) & 0xFF]++;
+			keyTemp[dst] = keys[i];
+			valueTemp[dst] = values[i];
+		}
+		keys.swap(keyTemp);
+		values.swap(valueTemp);
+	}
+}
+
+NBody::NBody()
+{
+	theta = 0.6f;
+	softening = 0.05f;
+}
+
+void NBody::Clear()
+{
+	px.clear(); py.clear(); pz.clear();
+	vx.clear(); vy.clear(); vz.clear();
+	ax.clear(); ay.clear(); az.clear();
+	gm.clear();
+	nodes.clear();
+}
+
+void NBody::SeedBelt(int count, float innerRadius, float outerRadius, float centralGM, float beltGM, unsigned int seed)
+{
+	Clear();
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> radius(innerRadius, outerRadius);
+	std::uniform_real_distribution<float> angle(0.0f, glm::two_pi<float>());
+	std::normal_distribution<float> height(0.0f, 0.3f);
+
+	px.resize(count); py.resize(count); pz.resize(count);
+	vx.resize(count); vy.resize(count); vz.resize(count);
+	ax.resize(count); ay.resize(count); az.resize(count);
+	gm.assign(count, count > 0 ? beltGM / count : 0.0f);
+
+	for (int i = 0; i < count; i++)
+	{
+		float r = radius(rng);
+		float a = angle(rng);
+		float speed = sqrt(centralGM / r);     // Circular orbit speed
+
+		px[i] = cos(a) * r;
+		py[i] = height(rng);
+		pz[i] = sin(a) * r;
+
+		// Same direction of travel as the planets, which go from +x towards +z
+		vx[i] = -sin(a) * speed;
+		vy[i] = 0.0f;
+		vz[i] = cos(a) * speed;
+	}
+
+	ComputeAccelerations();
+}
+
+void NBody::SetAttractors(const glm::vec3* positions, const float* attractorGm, int count)
+{
+	attractorPositions.assign(positions, positions + count);
+	attractorGM.assign(attractorGm, attractorGm + count);
+}
+
+glm::vec3 NBody::AttractorAcceleration(const glm::vec3& position) const
+{
+	glm::vec3 acceleration(0.0f);
+	float eps2 = softening * softening;
+
+	for (size_t a = 0; a < attractorPositions.size(); a++)
+	{
+		glm::vec3 d = attractorPositions[a] - position;
+		float d2 = glm::dot(d, d) + eps2;
+		acceleration += d * (attractorGM[a] / (d2 * sqrt(d2)));
+	}
+	return acceleration;
+}
+
+void NBody::Step(float dt)
+{
+	const int count = Count();
+	if (count == 0)
+		return;
+
+	float half = dt * 0.5f;
+
+	// Kick and drift
+	ParallelFor(count, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			vx[i] += ax[i] * half; vy[i] += ay[i] * half; vz[i] += az[i] * half;
+			px[i] += vx[i] * dt;   py[i] += vy[i] * dt;   pz[i] += vz[i] * dt;
+		}
+	});
+
+	ComputeAccelerations();
+
+	// Kick
+	ParallelFor(count, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			vx[i] += ax[i] * half; vy[i] += ay[i] * half; vz[i] += az[i] * half;
+		}
+	});
+}
+
+void NBody::CopyPositions(float* xyz) const
+{
+	const int count = Count();
+	std::copy(px.begin(), px.end(), xyz);
+	std::copy(py.begin(), py.end(), xyz + count);
+	std::copy(pz.begin(), pz.end(), xyz + count * 2);
+}
+
+void NBody::BuildTree()
+{
+	const int count = Count();
+	nodes.clear();
+	leaves.clear();
+	if (count == 0)
+		return;
+
+	// Bounding cube of everything
+	float minX = px[0], minY = py[0], minZ = pz[0];
+	float maxX = px[0], maxY = py[0], maxZ = pz[0];
+	for (int i = 1; i < count; i++)
+	{
+		minX = std::min(minX, px[i]); maxX = std::max(maxX, px[i]);
+		minY = std::min(minY, py[i]); maxY = std::max(maxY, py[i]);
+		minZ = std::min(minZ, pz[i]); maxZ = std::max(maxZ, pz[i]);
+	}
+	float size = std::max(maxX - minX, std::max(maxY - minY, maxZ - minZ)) * 1.001f + 1e-6f;
+
+	// Morton keys, then sort so every cell is a contiguous range
+	keys.resize(count);
+	order.resize(count);
+	float toGrid = 1024.0f / size;
+	ParallelFor(count, [&](int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			unsigned int x = std::min(1023u, (unsigned int)((px[i] - minX) * toGrid));
+			unsigned int y = std::min(1023u, (unsigned int)((py[i] - minY) * toGrid));
+			unsigned int z = std::min(1023u, (unsigned int)((pz[i] - minZ) * toGrid));
+			keys[i] = ExpandBits(x) * 4 + ExpandBits(y) * 2 + ExpandBits(z);
+			order[i] = i;
+		}
+	});
+	RadixSort(keys, order);
+
+	tx.resize(count); ty.resize(count); tz.resize(count); tm.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		tx[i] = px[order[i]];
+		ty[i] = py[order[i]];
+		tz[i] = pz[order[i]];
+		tm[i] = gm[order[i]];
+	}
+
+	nodes.reserve(count / leafSize * 2 + 1);
+	nodes.push_back(Node());
+	BuildNode(0, 0, count, 0, minX, minY, minZ, size);
+}
+
+void NBody::BuildNode(int slot, int start, int end, int level, float x, float y, float z, float size)
+{
+	Node node;
+	node.first = start;
+	node.count = end - start;
+	node.size = size;
+	node.firstChild = -1;
+	node.childCount = 0;
+	node.cx = node.cy = node.cz = node.mass = 0.0f;
+
+	if (node.count <= leafSize || level >= maxLevel)
+	{
+		leaves.push_back(slot);
+		for (int i = start; i < end; i++)
+		{
+			node.cx += tx[i] * tm[i];
+			node.cy += ty[i] * tm[i];
+			node.cz += tz[i] * tm[i];
+			node.mass += tm[i];
+		}
+	}
+	else
+	{
+		// The keys are sorted, so each octant is a run of the range
+		int shift = 27 - 3 * level;
+		int bounds[9];
+		int i = start;
+		for (int octant = 0; octant < 8; octant++)
+		{
+			bounds[octant] = i;
+			while (i < end && (int)((keys[i] >> shift) & 7) == octant)
+				i++;
+		}
+		bounds[8] = end;
+
+		for (int octant = 0; octant < 8; octant++)
+			if (bounds[octant + 1] > bounds[octant])
+				node.childCount++;
+
+		node.firstChild = (int)nodes.size();
+		nodes.resize(nodes.size() + node.childCount);
+
+		float half = size * 0.5f;
+		int child = node.firstChild;
+		for (int octant = 0; octant < 8; octant++)
+		{
+			if (bounds[octant + 1] == bounds[octant])
+				continue;
+
+			BuildNode(child, bounds[octant], bounds[octant + 1], level + 1,
+				x + ((octant >> 2) & 1) * half,
+				y + ((octant >> 1) & 1) * half,
+				z + (octant & 1) * half,
+				half);
+
+			const Node& c = nodes[child++];
+			node.cx += c.cx * c.mass;
+			node.cy += c.cy * c.mass;
+			node.cz += c.cz * c.mass;
+			node.mass += c.mass;
+		}
+	}
+
+	if (node.mass > 0.0f)
+	{
+		node.cx /= node.mass;
+		node.cy /= node.mass;
+		node.cz /= node.mass;
+	}
+	nodes[slot] = node;
+}
+
+void NBody::DirectAcceleration(float x, float y, float z, float& outX, float& outY, float& outZ) const
+{
+	float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+	float eps2 = softening * softening;
+
+	for (int i = 0; i < Count(); i++)
+	{
+		float ex = px[i] - x, ey = py[i] - y, ez = pz[i] - z;
+		float e2 = ex * ex + ey * ey + ez * ez + eps2;
+		float s = gm[i] / (e2 * sqrt(e2));
+		sumX += ex * s; sumY += ey * s; sumZ += ez * s;
+	}
+
+	outX = sumX; outY = sumY; outZ = sumZ;
+}
+
+void NBody::LeafAccelerations(int leaf, std::vector<int>& cells, std::vector<int>& bodies)
+{
+	const Node& group = nodes[leaf];
+	float theta2 = theta * theta;
+	float eps2 = softening * softening;
+
+	// Radius of the leaf's particles around its centre of mass (or middle, if it has no mass)
+	float gx = group.cx, gy = group.cy, gz = group.cz;
+	if (group.mass <= 0.0f)
+	{
+		gx = tx[group.first]; gy = ty[group.first]; gz = tz[group.first];
+	}
+	float radius = 0.0f;
+	for (int i = group.first; i < group.first + group.count; i++)
+	{
+		float dx = tx[i] - gx, dy = ty[i] - gy, dz = tz[i] - gz;
+		radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+	}
+	radius = sqrt(radius);
+
+	// One walk for the whole leaf. A cell is only used as a point mass when it is far enough
+	// away from every particle in the leaf, so the result holds for all of them
+	cells.clear();
+	bodies.clear();
+
+	int stack[128];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		int index = stack[--top];
+		const Node& node = nodes[index];
+
+		float dx = node.cx - gx, dy = node.cy - gy, dz = node.cz - gz;
+		float d = sqrt(dx * dx + dy * dy + dz * dz) - radius;
+
+		if (index != leaf && d > 0.0f && node.size * node.size < theta2 * d * d)
+			cells.push_back(index);
+		else if (node.childCount == 0)
+			for (int i = node.first; i < node.first + node.count; i++)
+				bodies.push_back(i);
+		else
+			for (int c = 0; c < node.childCount; c++)
+				stack[top++] = node.firstChild + c;
+	}
+
+	for (int j = group.first; j < group.first + group.count; j++)
+	{
+		float x = tx[j], y = ty[j], z = tz[j];
+		float sumX = 0.0f, sumY = 0.0f, sumZ = 0.0f;
+
+		for (size_t c = 0; c < cells.size(); c++)
+		{
+			const Node& node = nodes[cells[c]];
+			float ex = node.cx - x, ey = node.cy - y, ez = node.cz - z;
+			float e2 = ex * ex + ey * ey + ez * ez + eps2;
+			float s = node.mass / (e2 * sqrt(e2));
+			sumX += ex * s; sumY += ey * s; sumZ += ez * s;
+		}
+
+		// Our own particle is in here too, but it adds nothing since its offset is zero
+		for (size_t b = 0; b < bodies.size(); b++)
+		{
+			int i = bodies[b];
+			float ex = tx[i] - x, ey = ty[i] - y, ez = tz[i] - z;
+			float e2 = ex * ex + ey * ey + ez * ez + eps2;
+			float s = tm[i] / (e2 * sqrt(e2));
+			sumX += ex * s; sumY += ey * s; sumZ += ez * s;
+		}
+
+		glm::vec3 heavy = AttractorAcceleration(glm::vec3(x, y, z));
+		int i = order[j];
+		ax[i] = sumX + heavy.x;
+		ay[i] = sumY + heavy.y;
+		az[i] = sumZ + heavy.z;
+	}
+}
+
+void NBody::ComputeAccelerations()
+{
+	BuildTree();
+
+	// Leaves are handed out in Morton order, so each thread works through one region of space
+	ParallelFor((int)leaves.size(), [&](int begin, int end)
+	{
+		std::vector<int> cells, bodies;
+		for (int l = begin; l < end; l++)
+			LeafAccelerations(leaves[l], cells, bodies);
+	});
+}
+
+NBody::Report NBody::CompareWithDirect(int samples)
+{
+	typedef std::chrono::high_resolution_clock clock;
+	const int count = Count();
+
+	Report report = Report();
+	report.particles = count;
+	report.samples = samples = std::min(samples, count);
+	report.threads = Jobs::WorkerCount() + 1;
+	if (count == 0)
+		return report;
+
+	clock::time_point t0 = clock::now();
+	BuildTree();
+	clock::time_point t1 = clock::now();
+
+	// Same path the integrator uses, with the attractors switched off so only the tree is compared
+	std::vector<glm::vec3> heavyPositions;
+	std::vector<float> heavyGM;
+	heavyPositions.swap(attractorPositions);
+	heavyGM.swap(attractorGM);
+
+	ParallelFor((int)leaves.size(), [&](int begin, int end)
+	{
+		std::vector<int> cells, bodies;
+		for (int l = begin; l < end; l++)
+			LeafAccelerations(leaves[l], cells, bodies);
+	});
+	clock::time_point t2 = clock::now();
+
+	heavyPositions.swap(attractorPositions);
+	heavyGM.swap(attractorGM);
+	const std::vector<float>& treeX = ax;
+	const std::vector<float>& treeY = ay;
+	const std::vector<float>& treeZ = az;
+
+	// Direct sums for an evenly spread sample, on one thread so the timing is per core
+	double sumError = 0.0;
+	int stride = std::max(1, count / samples);
+	for (int s = 0; s < samples; s++)
+	{
+		int i = s * stride;
+		float x, y, z;
+		DirectAcceleration(px[i], py[i], pz[i], x, y, z);
+
+		float ex = treeX[i] - x, ey = treeY[i] - y, ez = treeZ[i] - z;
+		float direct2 = x * x + y * y + z * z;
+		double error = direct2 > 0.0f ? sqrt((ex * ex + ey * ey + ez * ez) / direct2) : 0.0;
+		sumError += error * error;
+		report.maxError = std::max(report.maxError, error);
+	}
+	clock::time_point t3 = clock::now();
+
+	report.treeBuildMs = std::chrono::duration<double, std::milli>(t1 - t0).count();
+	report.treeForceMs = std::chrono::duration<double, std::milli>(t2 - t1).count();
+	report.directSampleMs = std::chrono::duration<double, std::milli>(t3 - t2).count();
+	report.directEstimateMs = report.directSampleMs * count / samples / report.threads;
+	report.rmsError = sqrt(sumError / samples);
+
+	// Put the attractors back into the accelerations the integrator carries between steps
+	ComputeAccelerations();
+	return report;
+}
@@ -0,0 +1,84 @@
+/**************************************************
+ *
+ *                 NBody.h
+ *
+ *  Particle system integrated with leapfrog under
+ *  its own gravity (Barnes-Hut octree) plus a few
+ *  heavy attractors that move on their own.
+ *
+ ***************************************************/
+
+#ifndef NBODY_H
+#define NBODY_H
+
+#include <GLM/glm.hpp>
+
+#include <vector>
+
+class NBody
+{
+public:
+    NBody();
+
+    // Particles on circular orbits around a mass gm at the origin, in a ring between the two radii.
+    // beltGM is the whole ring's gm, shared evenly between the particles
+    void SeedBelt(int count, float innerRadius, float outerRadius, float centralGM, float beltGM, unsigned int seed);
+    void Clear();
+
+    // Heavy bodies that pull on the particles but are moved by someone else (the planets)
+    void SetAttractors(const glm::vec3* positions, const float* gm, int count);
+    glm::vec3 AttractorAcceleration(const glm::vec3& position) const;
+
+    // One kick-drift-kick leapfrog step, symplectic so orbits don't spiral in or out
+    void Step(float dt);
+
+    int Count() const { return (int)px.size(); }
+    void CopyPositions(float* xyz) const;     // All the x's, then the y's, then the z's
+
+    // Accuracy and speed of the tree against direct O(N^2) summation. The direct sum only runs
+    // for the sampled particles, the full cost is extrapolated from that
+    struct Report
+    {
+        int particles, samples, threads;
+        double treeBuildMs, treeForceMs;
+        double directSampleMs, directEstimateMs;
+        double rmsError, maxError;
+    };
+    Report CompareWithDirect(int samples);
+
+    float theta;        // Opening angle, smaller is more accurate and slower
+    float softening;    // Keeps close encounters from blowing up
+
+private:
+    struct Node
+    {
+        float cx, cy, cz, mass;     // Centre of mass and total gm
+        float size;                 // Cell edge length
+        int first, count;           // Range of sorted particles under this cell
+        int firstChild, childCount; // Children are contiguous, leaves have none
+    };
+
+    void BuildTree();
+    void BuildNode(int slot, int start, int end, int level, float x, float y, float z, float size);
+    void LeafAccelerations(int leaf, std::vector<int>& cells, std::vector<int>& bodies);
+    void DirectAcceleration(float x, float y, float z, float& ax, float& ay, float& az) const;
+    void ComputeAccelerations();
+
+    // Particle state, structure of arrays
+    std::vector<float> px, py, pz;
+    std::vector<float> vx, vy, vz;
+    std::vector<float> ax, ay, az;
+    std::vector<float> gm;
+
+    // Tree, with the particles copied out in Morton order so leaves are contiguous in memory
+    std::vector<Node> nodes;
+    std::vector<int> leaves;
+    std::vector<unsigned int> keys;
+    std::vector<int> order;
+    std::vector<float> tx, ty, tz, tm;
+
+    std::vector<glm::vec3> attractorPositions;
+    std::vector<float> attractorGM;
+};
+
+#endif
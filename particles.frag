@@ -0,0 +1,18 @@
+#version 400
+
+in float brightness;
+
+out vec4 fragColor;
+
+uniform vec3 particleColour;
+
+void main()
+{
+	// Round the square point off into a soft dot
+	vec2 offset = gl_PointCoord * 2.0f - 1.0f;
+	float falloff = 1.0f - dot(offset, offset);
+	if (falloff <= 0.0f)
+		discard;
+
+	fragColor = vec4(particleColour * brightness * falloff, 1.0f);
+}
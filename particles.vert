@@ -0,0 +1,23 @@
+#version 400
+
+// Positions come in as separate runs of x, y and z
+layout (location = 0) in float positionX;
+layout (location = 1) in float positionY;
+layout (location = 2) in float positionZ;
+
+out float brightness;
+
+uniform mat4 view;
+uniform mat4 proj;
+uniform float pointSize;
+
+void main()
+{
+	vec4 viewPosition = view * vec4(positionX, positionY, positionZ, 1.0f);
+	gl_Position = proj * viewPosition;
+
+	// Shrink with distance, but never below a pixel so far away belts don't vanish
+	float size = pointSize * 100.0f / max(-viewPosition.z, 1.0f);
+	gl_PointSize = max(size, 1.0f);
+	brightness = clamp(size, 0.25f, 1.0f);
+}
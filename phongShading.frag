@@ -0,0 +1,88 @@
+#version 400
+
+#define MAX_OCCLUDERS 4
+#define PI 3.14159265f
+
+uniform sampler2D diffuseTex;
+uniform sampler2D specularTex; // It's already here
+
+// Spheres that may sit between this body and the sun, picked on the CPU per body
+layout (std140) uniform Occluders
+{
+	vec4 occluders[MAX_OCCLUDERS];	// xyz = centre, w = radius
+	int occluderCount;
+};
+
+uniform float sunRadius;
+uniform vec3 cameraPos;
+
+vec3 sunPosition = vec3(0); // Sun is at the origin
+
+// Area where two discs of radius r1 and r2, whose centres are d apart, overlap
+float DiscOverlap(float r1, float r2, float d)
+{
+	if (d >= r1 + r2)
+		return 0.0f;
+	if (d <= abs(r1 - r2))
+		return PI * min(r1, r2) * min(r1, r2);
+
+	float a = r1 * r1 * acos(clamp((d * d + r1 * r1 - r2 * r2) / (2.0f * d * r1), -1.0f, 1.0f));
+	float b = r2 * r2 * acos(clamp((d * d + r2 * r2 - r1 * r1) / (2.0f * d * r2), -1.0f, 1.0f));
+	float c = 0.5f * sqrt(max(0.0f, (-d + r1 + r2) * (d + r1 - r2) * (d - r1 + r2) * (d + r1 + r2)));
+	return a + b - c;
+}
+
+// Fraction of the sun's disc visible from this fragment. Every occluder is a sphere, so the
+// umbra and penumbra fall out of the overlap between the sun's and the occluder's angular discs
+float SunVisibility(vec3 position)
+{
+	vec3 toSun = sunPosition - position;
+	float sunDistance = length(toSun);
+	vec3 sunDir = toSun / sunDistance;
+	float sunAngle = asin(min(1.0f, sunRadius / sunDistance));
+
+	float visibility = 1.0f;
+	for (int i = 0; i < occluderCount; i++)
+	{
+		vec3 toOccluder = occluders[i].xyz - position;
+		float occluderDistance = length(toOccluder);
+		if (occluderDistance >= sunDistance || occluderDistance <= occluders[i].w)
+			continue;
+
+		vec3 occluderDir = toOccluder / occluderDistance;
+		if (dot(occluderDir, sunDir) <= 0.0f)
+			continue;
+
+		float occluderAngle = asin(occluders[i].w / occluderDistance);
+		float separation = acos(clamp(dot(occluderDir, sunDir), -1.0f, 1.0f));
+
+		float covered = DiscOverlap(sunAngle, occluderAngle, separation) / (PI * sunAngle * sunAngle);
+		visibility *= 1.0f - clamp(covered, 0.0f, 1.0f);
+	}
+	return visibility;
+}
+
+// Phong lighting with eclipse shadows. Linked in with whichever stage works out where the surface is
+vec4 ShadeSurface(vec3 worldPos, vec3 normal, vec2 texcoord)
+{
+	float luminance = 1.2f;
+	vec3 light = normalize(sunPosition - worldPos);
+	normal = normalize(normal);
+	float NoL = max(0.0f, dot(normal, light));
+	vec3 V = normalize(worldPos - cameraPos);
+
+	vec4 diffuseTexture = texture(diffuseTex, texcoord);
+
+	// Eclipses only matter on the lit side
+	float shadow = NoL > 0.0f ? SunVisibility(worldPos) : 1.0f;
+
+	// Do diffuse light
+	vec3 diffuse = diffuseTexture.rgb * vec3(NoL) * luminance * shadow;
+	
+	// Do specular light
+	vec3 R = normalize(reflect(-light, normal));
+	float VoR = max(0.0f, dot(-V, R));
+	vec3 specular = vec3(1.0f) * pow(VoR, 20.0f) * (NoL > 0.0 ? 1.0 : 0.0) * shadow;
+
+	return vec4(diffuse + specular, 1.0f);
+}
\ No newline at end of file
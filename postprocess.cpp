@@ -0,0 +1,307 @@
+/*****************************************
+ *
+ *           PostProcess.cpp
+ *
+ *  The scene is rendered into a half-float
+ *  target, bloomed through a dual-filter
+ *  pyramid and tonemapped to the backbuffer.
+ *
+ ****************************************/
+
+#include "postprocess.h"
+#include "shaders.h"
+#include "mesh.h"
+#include "profiler.h"
+#include "glstate.h"
+
+#include <stdio.h>
+#include <math.h>
+
+float PostProcess::exposure = 1.0f;
+float PostProcess::bloomStrength = 0.6f;
+float PostProcess::bloomThreshold = 1.0f;
+
+PostProcess::Target PostProcess::scene = {};
+PostProcess::Target PostProcess::bloom[PostProcess::maxBloomLevels] = {};
+int PostProcess::bloomLevels = 0;
+int PostProcess::outWidth = 0;
+int PostProcess::outHeight = 0;
+
+bool PostProcess::dynamicResolution = true;
+float PostProcess::targetGpuMs = 14.0f;
+float PostProcess::minScale = 0.5f;
+
+const float PostProcess::scaleStep = 0.05f;
+float PostProcess::renderScale = 1.0f;
+float PostProcess::wantedScale = 1.0f;
+float PostProcess::gpuMs = 0.0f;
+int PostProcess::settling = 0;
+
+GLuint PostProcess::timers[PostProcess::maxTimers] = {};
+int PostProcess::timerHead = 0;
+int PostProcess::timersPending = 0;
+bool PostProcess::timing = false;
+
+GLuint PostProcess::downProgram = 0;
+GLuint PostProcess::upProgram = 0;
+GLuint PostProcess::tonemapProgram = 0;
+
+void PostProcess::Initialize()
+{
+	GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"fullscreen.vert");
+
+	GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"bloomDown.frag");
+	downProgram = linkProgram(buildProgram(vs, fs, 0));
+
+	fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"bloomUp.frag");
+	upProgram = linkProgram(buildProgram(vs, fs, 0));
+
+	fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"tonemap.frag");
+	tonemapProgram = linkProgram(buildProgram(vs, fs, 0));
+
+	glGenQueries(maxTimers, timers);
+	timerHead = timersPending = 0;
+}
+
+void PostProcess::CreateTarget(Target& target, int w, int h, GLenum format, bool withDepth)
+{
+	target.width = w;
+	target.height = h;
+
+	target.colour.Create(MEMORY_TARGETS);
+	GLState::BindTexture(GL_TEXTURE_2D, target.colour);
+	glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+	target.colour.SetBytes((size_t)w * h * (format == GL_RGBA16F ? 8 : 4));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	GLState::BindTexture(GL_TEXTURE_2D, GL_NONE);
+
+	glGenFramebuffers(1, &target.fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.colour, 0);
+
+	target.depth.Reset();
+	if (withDepth)
+	{
+		target.depth.Create(MEMORY_TARGETS);
+		glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+		target.depth.SetBytes((size_t)w * h * 4);   // <- 24-bit depth is padded out to 32
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, GL_NONE);
+	}
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		printf("framebuffer incomplete: %dx%d\n", w, h);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, GL_NONE);
+}
+
+void PostProcess::DestroyTarget(Target& target)
+{
+	if (target.fbo) glDeleteFramebuffers(1, &target.fbo);
+	target = Target();
+}
+
+void PostProcess::Resize(int width, int height)
+{
+	outWidth = width;
+	outHeight = height;
+
+	// Minimised windows report a zero size, keep the old targets around
+	if (width <= 0 || height <= 0)
+		return;
+
+	CreateTargets();
+}
+
+void PostProcess::CreateTargets()
+{
+	DestroyTarget(scene);
+	for (int i = 0; i < bloomLevels; i++)
+		DestroyTarget(bloom[i]);
+
+	int width = (int)(outWidth * renderScale + 0.5f);
+	int height = (int)(outHeight * renderScale + 0.5f);
+	if (width < 1) width = 1;
+	if (height < 1) height = 1;
+
+	// RGBA16F for the scene so the sun and stars can go above 1.0
+	CreateTarget(scene, width, height, GL_RGBA16F, true);
+
+	// R11G11B10F for the bloom chain, it needs no alpha and is half the bandwidth
+	bloomLevels = 0;
+	int w = width / 2, h = height / 2;
+	while (bloomLevels < maxBloomLevels && w >= minBloomSize && h >= minBloomSize)
+	{
+		CreateTarget(bloom[bloomLevels++], w, h, GL_R11F_G11F_B10F, false);
+		w /= 2; h /= 2;
+	}
+}
+
+void PostProcess::UpdateScale()
+{
+	// Oldest first, and stop at the first one the GPU hasn't got to
+	bool measured = false;
+	while (timersPending > 0)
+	{
+		GLuint query = timers[(timerHead + maxTimers - timersPending) % maxTimers];
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			break;
+
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+		gpuMs = (float)(nanoseconds / 1.0e6);
+		timersPending--;
+		measured = true;
+	}
+
+	if (settling > 0 && measured)
+		settling--;
+	if (!measured || settling > 0)
+		return;
+
+	float wanted = 1.0f;
+	if (dynamicResolution)
+	{
+		// Fill rate goes with the square of the scale, so that's the scale that would just fit the budget
+		wanted = renderScale * sqrt(targetGpuMs / (gpuMs > 0.1f ? gpuMs : 0.1f));
+		wanted = wanted < minScale ? minScale : (wanted > 1.0f ? 1.0f : wanted);
+	}
+
+	// Eased, so one slow frame doesn't throw the resolution around
+	wantedScale += (wanted - wantedScale) * 0.25f;
+	float stepped = floor(wantedScale / scaleStep + 0.5f) * scaleStep;
+	if (!dynamicResolution)
+		stepped = wantedScale = 1.0f;
+
+	if (fabs(stepped - renderScale) < scaleStep * 0.5f)
+		return;
+
+	renderScale = stepped;
+	settling = settleFrames;
+	if (outWidth > 0 && outHeight > 0)
+		CreateTargets();
+}
+
+void PostProcess::BeginScene()
+{
+	// Resolution for this frame from the times that have come back so far
+	UpdateScale();
+
+	// Skipped when every query is still in flight, a weak GPU can fall that far behind
+	timing = timers[0] && timersPending < maxTimers;
+	if (timing)
+		glBeginQuery(GL_TIME_ELAPSED, timers[timerHead]);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, scene.fbo);
+	glViewport(0, 0, scene.width, scene.height);
+	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void PostProcess::EndScene()
+{
+	PROFILE_SCOPE("Post Process");
+
+	glDisable(GL_DEPTH_TEST);
+	GLState::ActiveTexture(GL_TEXTURE0);
+
+	//------------------------------------------------------------------------------------------------ Downsample
+
+	GLState::UseProgram(downProgram);
+	GLState::Uniform1i(glGetUniformLocation(downProgram, "sourceTex"), 0);
+	GLState::Uniform1f(glGetUniformLocation(downProgram, "threshold"), bloomThreshold);
+	GLint texelLoc = glGetUniformLocation(downProgram, "texelSize");
+	GLint prefilterLoc = glGetUniformLocation(downProgram, "prefilter");
+
+	const Target* source = &scene;
+	for (int i = 0; i < bloomLevels; i++)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, bloom[i].fbo);
+		glViewport(0, 0, bloom[i].width, bloom[i].height);
+
+		GLState::Uniform2f(texelLoc, 1.0f / source->width, 1.0f / source->height);
+		GLState::Uniform1i(prefilterLoc, i == 0);               // <- Only the first pass cuts out the dim pixels
+		GLState::BindTexture(GL_TEXTURE_2D, source->colour);
+
+		Primitive::DrawFullscreenQuad();
+		source = &bloom[i];
+	}
+
+	//------------------------------------------------------------------------------------------------ Upsample
+
+	GLState::UseProgram(upProgram);
+	GLState::Uniform1i(glGetUniformLocation(upProgram, "sourceTex"), 0);
+	texelLoc = glGetUniformLocation(upProgram, "texelSize");
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);                                    // <- Each level accumulates the blurred level below it
+	for (int i = bloomLevels - 2; i >= 0; i--)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, bloom[i].fbo);
+		glViewport(0, 0, bloom[i].width, bloom[i].height);
+
+		GLState::Uniform2f(texelLoc, 1.0f / bloom[i + 1].width, 1.0f / bloom[i + 1].height);
+		GLState::BindTexture(GL_TEXTURE_2D, bloom[i + 1].colour);
+
+		Primitive::DrawFullscreenQuad();
+	}
+	glDisable(GL_BLEND);
+
+	//------------------------------------------------------------------------------------------------ Tonemap
+
+	glBindFramebuffer(GL_FRAMEBUFFER, GL_NONE);
+	glViewport(0, 0, outWidth, outHeight);
+
+	GLState::UseProgram(tonemapProgram);
+	GLState::Uniform1i(glGetUniformLocation(tonemapProgram, "sceneTex"), 0);
+	GLState::Uniform1i(glGetUniformLocation(tonemapProgram, "bloomTex"), 1);
+	GLState::Uniform1f(glGetUniformLocation(tonemapProgram, "exposure"), exposure);
+	GLState::Uniform1f(glGetUniformLocation(tonemapProgram, "bloomStrength"), bloomLevels > 0 ? bloomStrength : 0.0f);
+
+	GLState::ActiveTexture(GL_TEXTURE1);
+	GLState::BindTexture(GL_TEXTURE_2D, bloomLevels > 0 ? bloom[0].colour : GL_NONE);
+	GLState::ActiveTexture(GL_TEXTURE0);
+	GLState::BindTexture(GL_TEXTURE_2D, scene.colour);
+
+	Primitive::DrawFullscreenQuad();
+
+	GLState::ActiveTexture(GL_TEXTURE1);
+	GLState::BindTexture(GL_TEXTURE_2D, GL_NONE);
+	GLState::ActiveTexture(GL_TEXTURE0);
+	GLState::BindTexture(GL_TEXTURE_2D, GL_NONE);
+	GLState::UseProgram(GL_NONE);
+
+	glEnable(GL_DEPTH_TEST);
+
+	if (timing)
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		timerHead = (timerHead + 1) % maxTimers;
+		timersPending++;
+		timing = false;
+	}
+}
+
+void PostProcess::Cleanup()
+{
+	DestroyTarget(scene);
+	for (int i = 0; i < bloomLevels; i++)
+		DestroyTarget(bloom[i]);
+	bloomLevels = 0;
+
+	GLState::DeleteProgram(downProgram);
+	GLState::DeleteProgram(upProgram);
+	GLState::DeleteProgram(tonemapProgram);
+
+	if (timers[0])
+		glDeleteQueries(maxTimers, timers);
+	for (int i = 0; i < maxTimers; i++)
+		timers[i] = 0;
+	timerHead = timersPending = 0;
+}
@@ -0,0 +1,82 @@
+/**************************************************
+ *
+ *                 PostProcess.h
+ *
+ *  HDR scene target, dual-filter bloom pyramid and
+ *  the tonemap resolve onto the backbuffer. The
+ *  scene target shrinks when the GPU runs late.
+ *
+ ***************************************************/
+
+#ifndef POSTPROCESS_H
+#define POSTPROCESS_H
+
+#include <GL/gl3w.h>
+
+#include "gpumemory.h"
+
+class PostProcess
+{
+public:
+    static void Initialize();
+    static void Resize(int width, int height);
+    static void BeginScene();
+    static void EndScene();
+    static void Cleanup();
+
+    static float exposure;
+    static float bloomStrength;
+    static float bloomThreshold;
+
+    // Scene resolution follows the GPU time of the scene and post passes, the tonemap scales it back up
+    static bool dynamicResolution;
+    static float targetGpuMs;
+    static float minScale;
+
+    static float RenderScale() { return renderScale; }
+    static float GpuMs() { return gpuMs; }
+    static int SceneWidth() { return scene.width; }
+    static int SceneHeight() { return scene.height; }
+
+private:
+    struct Target
+    {
+        GLuint fbo;
+        TextureHandle colour;
+        RenderbufferHandle depth;
+        int width, height;
+    };
+
+    static void CreateTarget(Target& target, int w, int h, GLenum format, bool withDepth);
+    static void DestroyTarget(Target& target);
+    static void CreateTargets();
+
+    // Reads back whichever timer queries have finished and steers the scale from them
+    static void UpdateScale();
+
+    // The pyramid starts at half resolution, so the cost stays bounded at 4K
+    static const int maxBloomLevels = 6;
+    static const int minBloomSize = 16;
+
+    static Target scene;
+    static Target bloom[maxBloomLevels];
+    static int bloomLevels;
+    static int outWidth, outHeight;
+
+    // Scale moves in steps, every change reallocates the targets
+    static const float scaleStep;
+    static const int settleFrames = 8;          // Results still in flight were timed at the old size
+    static float renderScale, wantedScale;
+    static float gpuMs;
+    static int settling;
+
+    // Timed frames in flight, read back a few frames later so the CPU never waits on them
+    static const int maxTimers = 4;
+    static GLuint timers[maxTimers];
+    static int timerHead, timersPending;
+    static bool timing;
+
+    static GLuint downProgram, upProgram, tonemapProgram;
+};
+
+#endif
@@ -0,0 +1,173 @@
+/*****************************************
+ *
+ *           Profiler.cpp
+ *
+ *  Writers only ever touch their own ring.
+ *  The dump reads every ring while they
+ *  keep writing, and drops what got lapped.
+ *
+ ****************************************/
+
+#include "profiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+std::atomic<bool> Profiler::enabled(true);
+std::atomic<Profiler::Ring*> Profiler::rings(0);
+std::atomic<int> Profiler::ringCount(0);
+
+thread_local Profiler::RingOwner Profiler::threadRing;
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+long long Profiler::Now()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+Profiler::RingOwner::~RingOwner()
+{
+	if (ring)
+		ring->inUse = false;
+}
+
+Profiler::Ring* Profiler::ThreadRing()
+{
+	if (threadRing.ring)
+		return threadRing.ring;
+
+	// Take over the ring of a thread that's gone (the simulation thread restarts with every replay)
+	for (Ring* ring = rings.load(std::memory_order_acquire); ring; ring = ring->next)
+	{
+		bool free = false;
+		if (ring->inUse.compare_exchange_strong(free, true))
+		{
+			snprintf(ring->threadName, sizeof(ring->threadName), "Thread %d", ring->tid);
+			return threadRing.ring = ring;
+		}
+	}
+
+	Ring* ring = new Ring;
+	ring->head = 0;
+	ring->inUse = true;
+	ring->tid = ++ringCount;
+	snprintf(ring->threadName, sizeof(ring->threadName), "Thread %d", ring->tid);
+
+	ring->next = rings.load(std::memory_order_relaxed);
+	while (!rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed));
+
+	return threadRing.ring = ring;
+}
+
+void Profiler::SetThreadName(const char* name)
+{
+	Ring* ring = ThreadRing();
+	snprintf(ring->threadName, sizeof(ring->threadName), "%s", name);
+}
+
+void Profiler::Record(const char* name, const char* detail, long long start, long long end)
+{
+	Ring* ring = ThreadRing();
+	unsigned int head = ring->head.load(std::memory_order_relaxed);
+
+	Event& event = ring->events[head & (ringSize - 1)];
+	event.name = name;
+	event.start = start;
+	event.end = end;
+	event.detail[0] = 0;
+	if (detail)
+	{
+		// Keep the end of long details, for paths that's the file name
+		size_t length = strlen(detail);
+		if (length >= detailSize)
+			detail += length - (detailSize - 1);
+		memcpy(event.detail, detail, std::min(length, (size_t)detailSize - 1) + 1);
+	}
+
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+static void WriteJsonString(FILE* file, const char* text)
+{
+	fputc('"', file);
+	for (; *text; text++)
+	{
+		if (*text == '"' || *text == '\\')
+			fputc('\\', file);
+		if ((unsigned char)*text >= 0x20)
+			fputc(*text, file);
+	}
+	fputc('"', file);
+}
+
+bool Profiler::WriteChromeTrace(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (!file)
+	{
+		printf("can't write trace: %s\n", path);
+		return false;
+	}
+
+	fprintf(file, "{\"traceEvents\":[\n");
+	bool first = true;
+	int written = 0;
+
+	std::vector<Event> copy(ringSize);
+	for (Ring* ring = rings.load(std::memory_order_acquire); ring; ring = ring->next)
+	{
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", ring->tid);
+		WriteJsonString(file, ring->threadName);
+		fprintf(file, "}}");
+		first = false;
+
+		// Copy while the owner keeps writing, then keep only what can't have been lapped during the copy.
+		// The slot after the newest one may be half written, so that goes too
+		unsigned int before = ring->head.load(std::memory_order_acquire);
+		unsigned int begin = before > (unsigned int)ringSize ? before - ringSize : 0;
+		for (unsigned int i = begin; i < before; i++)
+			copy[i & (ringSize - 1)] = ring->events[i & (ringSize - 1)];
+		unsigned int after = ring->head.load(std::memory_order_acquire);
+		if (after - begin >= (unsigned int)ringSize)
+			begin = after - ringSize + 1;
+
+		for (unsigned int i = begin; i < before; i++)
+		{
+			const Event& event = copy[i & (ringSize - 1)];
+			fprintf(file, ",\n{\"name\":");
+			WriteJsonString(file, event.name);
+			fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", ring->tid, event.start / 1000.0, (event.end - event.start) / 1000.0);
+			if (event.detail[0])
+			{
+				fprintf(file, ",\"args\":{\"detail\":");
+				WriteJsonString(file, event.detail);
+				fprintf(file, "}");
+			}
+			fprintf(file, "}");
+			written++;
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	printf("wrote %d trace events to %s\n", written, path);
+	return true;
+}
+
+ProfileScope::ProfileScope(const char* name, const char* detail)
+	: name(name), detail(detail), start(0), open(Profiler::enabled.load(std::memory_order_relaxed))
+{
+	if (open)
+		start = Profiler::Now();
+}
+
+void ProfileScope::End()
+{
+	if (!open)
+		return;
+	open = false;
+	Profiler::Record(name, detail, start, Profiler::Now());
+}
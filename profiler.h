@@ -0,0 +1,86 @@
+/**************************************************
+ *
+ *                 Profiler.h
+ *
+ *  Scoped CPU timings into a ring buffer per
+ *  thread, dumped as Chrome trace events for
+ *  chrome://tracing or Perfetto.
+ *
+ ***************************************************/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+
+class Profiler
+{
+public:
+    // Scopes are two clock reads and a ring write when on, one branch when off
+    static std::atomic<bool> enabled;
+
+    // Shows up as the track name in the trace
+    static void SetThreadName(const char* name);
+
+    // Everything still in the rings, as {"traceEvents": [...]}
+    static bool WriteChromeTrace(const char* path);
+
+    static long long Now();
+    static void Record(const char* name, const char* detail, long long start, long long end);
+
+private:
+    // Per thread, so the writer never shares a cache line or a lock with anyone
+    static const int ringSize = 1 << 14;
+    static const int detailSize = 40;
+
+    struct Event
+    {
+        const char* name;           // Must outlive the trace, string literals
+        long long start, end;       // Nanoseconds since the profiler started
+        char detail[detailSize];    // Copied, so it can come from a temporary
+    };
+
+    struct Ring
+    {
+        Event events[ringSize];
+        std::atomic<unsigned int> head;     // Events ever written, the writer publishes with a release store
+        std::atomic<bool> inUse;            // Cleared when the thread exits so the next new thread can take it over
+        char threadName[32];
+        int tid;
+        Ring* next;
+    };
+
+    struct RingOwner
+    {
+        Ring* ring;
+        RingOwner() : ring(0) {}
+        ~RingOwner();
+    };
+
+    static Ring* ThreadRing();
+    static thread_local RingOwner threadRing;
+
+    static std::atomic<Ring*> rings;        // Pushed onto, never removed from
+    static std::atomic<int> ringCount;
+};
+
+// Times the enclosing block. End() closes it early for passes that don't have a block of their own
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name, const char* detail = 0);
+    ~ProfileScope() { End(); }
+    void End();
+
+private:
+    const char* name;
+    const char* detail;
+    long long start;
+    bool open;
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_SCOPE(...) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(__VA_ARGS__)
+
+#endif
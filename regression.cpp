@@ -0,0 +1,249 @@
+/*****************************************
+ *
+ *           Regression.cpp
+ *
+ *  Each scene is held until texture
+ *  streaming goes quiet, measured over a
+ *  few frames, then the last one is read
+ *  back and diffed against its golden.
+ *
+ ****************************************/
+
+#include "regression.h"
+#include "capture.h"
+
+#include <GL/gl3w.h>
+#include <SOIL.h>
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+// The fixed views at the start date, about a third of an orbit on, and ten years on. The budgets here are
+// loose ceilings for a tree with no baselines yet (every body, the sky, the belt and a full bloom chain come
+// to about 25 draws), once --regress-update has measured a scene its baseline plus the margins takes over
+const RegressionScene RenderRegression::scenes[] =
+{
+	{ "view0_day0",    0,    0.0, 40, 600, 40.0f },
+	{ "view1_day0",    1,    0.0, 40, 600, 40.0f },
+	{ "view2_day0",    2,    0.0, 40, 600, 40.0f },
+	{ "view3_day0",    3,    0.0, 40, 600, 40.0f },
+	{ "view0_day120",  0,  120.0, 40, 600, 40.0f },
+	{ "view1_day120",  1,  120.0, 40, 600, 40.0f },
+	{ "view2_day120",  2,  120.0, 40, 600, 40.0f },
+	{ "view3_day120",  3,  120.0, 40, 600, 40.0f },
+	{ "view0_day3652", 0, 3652.5, 40, 600, 40.0f },
+	{ "view3_day3652", 3, 3652.5, 40, 600, 40.0f },
+};
+const int RenderRegression::sceneCount = sizeof(scenes) / sizeof(scenes[0]);
+
+// What a scene measured when its golden was written
+struct Baseline
+{
+	int draws, stateChanges;
+	float cpuMs;
+};
+
+static bool ReadBaseline(const std::string& path, Baseline& baseline)
+{
+	FILE* file = fopen(path.c_str(), "r");
+	if (!file)
+		return false;
+	bool ok = fscanf(file, " draws %d state_changes %d cpu_ms %f", &baseline.draws, &baseline.stateChanges, &baseline.cpuMs) == 3;
+	fclose(file);
+	return ok;
+}
+
+static bool WriteBaseline(const std::string& path, const Baseline& baseline)
+{
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file)
+		return false;
+	fprintf(file, "draws %d\nstate_changes %d\ncpu_ms %.3f\n", baseline.draws, baseline.stateChanges, baseline.cpuMs);
+	fclose(file);
+	return true;
+}
+
+RenderRegression::RenderRegression()
+{
+	pixelThreshold = 12.0f;
+	maxDifferentFraction = 0.002f;
+	drawMargin = 0.1f;
+	stateChangeMargin = 0.25f;
+	cpuMargin = 0.5f;
+
+	active = update = false;
+	scene = frame = quiet = measured = 0;
+	started = measuring = false;
+	failures = 0;
+	worst = GLState::Counters();
+	pixelWidth = pixelHeight = 0;
+}
+
+void RenderRegression::Start(const char* goldenDirectory, bool updateGoldens)
+{
+	directory = goldenDirectory;
+	update = updateGoldens;
+	active = true;
+	scene = 0;
+	started = false;
+	failures = 0;
+	printf("regression: %d scenes, %s %s\n", sceneCount, update ? "writing goldens to" : "comparing against", directory.c_str());
+}
+
+bool RenderRegression::NewScene()
+{
+	if (!active || Done() || started)
+		return false;
+
+	started = true;
+	measuring = false;
+	frame = quiet = measured = 0;
+	cpuSamples.clear();
+	worst = GLState::Counters();
+	pixels.clear();
+	return true;
+}
+
+const RegressionScene& RenderRegression::Scene() const
+{
+	return scenes[scene < sceneCount ? scene : sceneCount - 1];
+}
+
+void RenderRegression::Grab(int width, int height)
+{
+	if (!active || Done() || !measuring || measured != measureFrames - 1)
+		return;
+
+	// One synchronous read per scene, the stall doesn't land in any measured frame
+	pixelWidth = width;
+	pixelHeight = height;
+	pixels.resize((size_t)width * height * 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadBuffer(GL_BACK);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+}
+
+void RenderRegression::EndFrame(float cpuMs, const GLState::Counters& counters, bool settled)
+{
+	if (!active || Done() || !started)
+		return;
+	frame++;
+
+	if (!measuring)
+	{
+		quiet = settled ? quiet + 1 : 0;
+		if (frame >= maxSettleFrames)
+			printf("regression: %s never settled, measuring it anyway\n", Scene().name);
+		measuring = (frame >= minSettleFrames && quiet >= quietFrames) || frame >= maxSettleFrames;
+		return;
+	}
+
+	cpuSamples.push_back(cpuMs);
+	worst.draws = std::max(worst.draws, counters.draws);
+	worst.binds = std::max(worst.binds, counters.binds);
+	worst.uniforms = std::max(worst.uniforms, counters.uniforms);
+
+	if (++measured < measureFrames)
+		return;
+
+	Finish();
+	scene++;
+	started = false;
+
+	if (Done())
+		printf("regression: %d of %d scenes failed\n", failures, sceneCount);
+}
+
+void RenderRegression::Finish()
+{
+	const RegressionScene& s = Scene();
+	bool passed = true;
+
+	std::sort(cpuSamples.begin(), cpuSamples.end());
+	float cpuMs = cpuSamples[cpuSamples.size() / 2];
+	int stateChanges = worst.binds + worst.uniforms;
+
+	// Against the scene's own baseline where there is one, the table's ceilings otherwise
+	std::string budgetPath = directory + "/" + s.name + ".budget";
+	int maxDraws = s.maxDraws, maxStateChanges = s.maxStateChanges;
+	float maxCpuMs = s.maxCpuMs;
+	Baseline baseline;
+	bool measuredBudgets = !update && ReadBaseline(budgetPath, baseline);
+	if (measuredBudgets)
+	{
+		maxDraws = baseline.draws + std::max(1, (int)ceil(baseline.draws * drawMargin));
+		maxStateChanges = baseline.stateChanges + std::max(1, (int)ceil(baseline.stateChanges * stateChangeMargin));
+		maxCpuMs = baseline.cpuMs * (1.0f + cpuMargin) + 1.0f;
+	}
+
+	passed = passed && worst.draws <= maxDraws;
+	passed = passed && stateChanges <= maxStateChanges;
+	passed = passed && cpuMs <= maxCpuMs;
+
+	std::string path = directory + "/" + s.name + ".png";
+	char image[128] = "";
+	if (pixels.empty())
+	{
+		sprintf(image, "no readback");
+		passed = false;
+	}
+	else if (update)
+	{
+		Baseline measured = { worst.draws, stateChanges, cpuMs };
+		bool written = WritePNG(path.c_str(), &pixels[0], pixelWidth, pixelHeight) && WriteBaseline(budgetPath, measured);
+		sprintf(image, written ? "golden written" : "can't write golden");
+		passed = passed && written;
+	}
+	else
+	{
+		int w = 0, h = 0, channels = 0;
+		unsigned char* golden = SOIL_load_image(path.c_str(), &w, &h, &channels, SOIL_LOAD_RGB);
+		if (!golden)
+		{
+			sprintf(image, "no golden");
+			passed = false;
+		}
+		else if (w != pixelWidth || h != pixelHeight)
+		{
+			sprintf(image, "golden is %dx%d, frame is %dx%d", w, h, pixelWidth, pixelHeight);
+			passed = false;
+		}
+		else
+		{
+			// Y'CbCr of the stored sRGB values, which are already close to perceptually even.
+			// The eye is less fussy about colour than brightness, so chroma counts for half
+			int different = 0;
+			float largest = 0.0f;
+			for (int y = 0; y < h; y++)
+			{
+				const unsigned char* expected = golden + (size_t)y * w * 3;
+				const unsigned char* actual = &pixels[(size_t)(h - 1 - y) * w * 4];
+				for (int x = 0; x < w; x++)
+				{
+					float r = (float)actual[x * 4 + 0] - expected[x * 3 + 0];
+					float g = (float)actual[x * 4 + 1] - expected[x * 3 + 1];
+					float b = (float)actual[x * 4 + 2] - expected[x * 3 + 2];
+					float luma = 0.299f * r + 0.587f * g + 0.114f * b;
+					float cb = -0.169f * r - 0.331f * g + 0.5f * b;
+					float cr = 0.5f * r - 0.419f * g - 0.081f * b;
+					float distance = sqrt(luma * luma + 0.25f * (cb * cb + cr * cr));
+
+					largest = std::max(largest, distance);
+					if (distance > pixelThreshold)
+						different++;
+				}
+			}
+			SOIL_free_image_data(golden);
+
+			float fraction = (float)different / ((float)w * h);
+			sprintf(image, "%.3f%% of pixels differ, largest %.1f", fraction * 100.0f, largest);
+			passed = passed && fraction <= maxDifferentFraction;
+		}
+	}
+
+	printf("%-14s %s  draws %d/%d, state changes %d/%d, cpu %.2f/%.1f ms (%s), %s\n", s.name, passed ? "pass" : "FAIL",
+		worst.draws, maxDraws, stateChanges, maxStateChanges, cpuMs, maxCpuMs, measuredBudgets ? "baseline" : "ceiling", image);
+	if (!passed)
+		failures++;
+}
@@ -0,0 +1,86 @@
+/**************************************************
+ *
+ *                 Regression.h
+ *
+ *  Renders a fixed list of scenes, compares each
+ *  one against a stored golden image and checks
+ *  its draw, state change and CPU time budgets.
+ *
+ ***************************************************/
+
+#ifndef REGRESSION_H
+#define REGRESSION_H
+
+#include <vector>
+#include <string>
+
+#include "glstate.h"
+
+struct RegressionScene
+{
+    const char* name;           // Golden image is <directory>/<name>.png, its baseline <name>.budget
+    int viewMode;
+    double earthDays;
+
+    // Budgets until a baseline has been written with the goldens, a scene over any of them fails even if it looks right
+    int maxDraws;
+    int maxStateChanges;        // Binds and uniform uploads that reached GL
+    float maxCpuMs;             // Median of the measured frames, Update() and Render() only
+};
+
+class RenderRegression
+{
+public:
+    RenderRegression();
+
+    // With update the goldens and the measured baselines are written out instead of compared against
+    void Start(const char* goldenDirectory, bool update);
+    bool Active() const { return active; }
+    bool Done() const { return active && scene >= sceneCount; }
+    int Failures() const { return failures; }
+
+    // True on the first frame of a scene, the caller sets its view and day before Update()
+    bool NewScene();
+    const RegressionScene& Scene() const;
+
+    // After Render(), before the GUI. Reads the backbuffer on the last measured frame of the scene
+    void Grab(int width, int height);
+
+    // After GLState::EndFrame(). Settled is when nothing is left to stream in, so the frame is final
+    void EndFrame(float cpuMs, const GLState::Counters& counters, bool settled);
+
+    // Perceptual tolerance. Pixels further apart than the threshold (0-255 in Y'CbCr, chroma at half
+    // weight) count as different, and at most the given fraction of them may be
+    float pixelThreshold;
+    float maxDifferentFraction;
+
+    // Headroom over a scene's baseline, as a fraction of it. Draws and state changes get at least one more,
+    // the CPU time a millisecond more since it moves around with whatever else the machine is doing
+    float drawMargin;
+    float stateChangeMargin;
+    float cpuMargin;
+
+private:
+    void Finish();
+
+    static const int minSettleFrames = 10;
+    static const int quietFrames = 4;
+    static const int maxSettleFrames = 600;
+    static const int measureFrames = 5;
+
+    static const RegressionScene scenes[];
+    static const int sceneCount;
+
+    bool active, update;
+    std::string directory;
+    int scene, frame, quiet, measured;
+    bool started, measuring;
+    int failures;
+
+    std::vector<float> cpuSamples;
+    GLState::Counters worst;
+    std::vector<unsigned char> pixels;      // RGBA, bottom row first
+    int pixelWidth, pixelHeight;
+};
+
+#endif
@@ -0,0 +1,192 @@
+/*****************************************
+ *
+ *           RenderQueue.cpp
+ *
+ *  Least significant byte first radix sort
+ *  of (key, packet) pairs. Bytes that are
+ *  the same in every key are skipped.
+ *
+ *  Keys only use the GL names, so command
+ *  buffers can be filled on any thread with
+ *  no shared lookup tables.
+ *
+ ****************************************/
+
+#include "renderqueue.h"
+#include "glstate.h"
+#include "profiler.h"
+#include "jobs.h"
+#include "gpumemory.h"
+
+#include <math.h>
+#include <string.h>
+
+static const char* passNames[PASS_COUNT] = { "Background Pass", "Opaque Pass", "Transparent Pass" };
+
+static unsigned int DepthBits(float depth)
+{
+	// Non-negative floats sort the same as their bit patterns
+	if (!(depth > 0.0f))
+		depth = 0.0f;
+	unsigned int bits;
+	memcpy(&bits, &depth, sizeof(bits));
+	return bits;
+}
+
+unsigned long long CommandBuffer::MakeKey(RenderPass pass, const DrawPacket& packet, float depth)
+{
+	unsigned long long key = (unsigned long long)pass << 60;
+	unsigned long long p = (unsigned long long)(packet.program & 0xFF);
+
+	// Folding the texture names together only has to keep different materials apart most of the time,
+	// a collision costs a rebind, never a wrong one
+	unsigned int material = packet.textures[0] * 2 + (packet.textureTarget == GL_TEXTURE_CUBE_MAP);
+	unsigned long long m = (unsigned long long)((material ^ (packet.textures[1] << 7)) & 0xFFFF);
+
+	if (pass == PASS_TRANSPARENT)
+		return key | ((unsigned long long)~DepthBits(depth) << 28) | (p << 20) | (m << 4);
+
+	// A coarse distance bucket ahead of the material keeps near bodies drawing first for early-z,
+	// while bodies at about the same distance still share their texture binds
+	int bucket = pass == PASS_OPAQUE ? (int)log2f(fmaxf(depth, 0.0f) + 1.0f) : 0;
+	bucket = bucket < 0 ? 0 : bucket > 15 ? 15 : bucket;
+	return key | (p << 52) | ((unsigned long long)bucket << 48) | (m << 32) | DepthBits(depth);
+}
+
+void CommandBuffer::Submit(RenderPass pass, float depth, const DrawPacket& packet)
+{
+	keys.push_back(MakeKey(pass, packet, depth));
+	packets.push_back(packet);
+}
+
+void RenderQueue::Clear()
+{
+	buffers.resize(Jobs::WorkerCount() + 1);
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		buffers[i].keys.clear();
+		buffers[i].packets.clear();
+	}
+}
+
+void RenderQueue::Sort()
+{
+	packets.clear();
+	keys.clear();
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		packets.insert(packets.end(), buffers[i].packets.begin(), buffers[i].packets.end());
+		keys.insert(keys.end(), buffers[i].keys.begin(), buffers[i].keys.end());
+	}
+
+	size_t count = keys.size();
+	order.resize(count);
+	sortedOrder.resize(count);
+	sortedKeys.resize(count);
+	for (size_t i = 0; i < count; i++)
+		order[i] = (unsigned int)i;
+
+	// All eight histograms in one read of the keys
+	unsigned int histograms[8][256];
+	memset(histograms, 0, sizeof(histograms));
+	for (size_t i = 0; i < count; i++)
+		for (int b = 0; b < 8; b++)
+			histograms[b][(keys[i] >> (b * 8)) & 0xFF]++;
+
+	for (int b = 0; b < 8; b++)
+	{
+		unsigned int* histogram = histograms[b];
+		if (count == 0 || histogram[(keys[0] >> (b * 8)) & 0xFF] == count)
+			continue;
+
+		unsigned int offset = 0;
+		for (int d = 0; d < 256; d++)
+		{
+			unsigned int n = histogram[d];
+			histogram[d] = offset;
+			offset += n;
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			unsigned int slot = histogram[(keys[i] >> (b * 8)) & 0xFF]++;
+			sortedKeys[slot] = keys[i];
+			sortedOrder[slot] = order[i];
+		}
+		keys.swap(sortedKeys);
+		order.swap(sortedOrder);
+	}
+}
+
+void RenderQueue::Execute()
+{
+	stats = Stats();
+	stats.packets = (int)packets.size();
+
+	GLuint program = ~0u;
+	const DrawPacket* material = NULL;
+
+	size_t i = 0;
+	while (i < order.size())
+	{
+		RenderPass pass = (RenderPass)(keys[i] >> 60);
+		PROFILE_SCOPE(passNames[pass]);
+
+		glDepthMask(pass == PASS_OPAQUE ? GL_TRUE : GL_FALSE);
+		if (pass == PASS_TRANSPARENT)
+		{
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+		}
+
+		for (; i < order.size() && (RenderPass)(keys[i] >> 60) == pass; i++)
+		{
+			const DrawPacket& packet = packets[order[i]];
+
+			if (packet.program != program)
+			{
+				program = packet.program;
+				material = NULL;
+				stats.programChanges++;
+				if (program)
+				{
+					GLState::UseProgram(program);
+					if (packet.setup)
+						packet.setup(program);
+				}
+			}
+
+			if (!material || packet.textureTarget != material->textureTarget ||
+				packet.textures[0] != material->textures[0] || packet.textures[1] != material->textures[1])
+			{
+				material = &packet;
+				stats.materialChanges++;
+				for (int unit = 0; unit < 2; unit++)
+				{
+					if (!packet.textures[unit])
+						continue;
+					GLState::ActiveTexture(GL_TEXTURE0 + unit);
+					GLState::BindTexture(packet.textureTarget, packet.textures[unit]);
+					GpuMemory::Touch(packet.textures[unit]);            // <- Drawn this frame, last in line for eviction
+				}
+			}
+
+			packet.draw(packet);
+
+			// A draw function with its own program leaves ours unknown
+			if (!packet.program)
+				program = ~0u;
+		}
+
+		if (pass == PASS_TRANSPARENT)
+			glDisable(GL_BLEND);
+	}
+
+	glDepthMask(GL_TRUE);
+	GLState::ActiveTexture(GL_TEXTURE1);
+	GLState::BindTexture(GL_TEXTURE_2D, GL_NONE);
+	GLState::ActiveTexture(GL_TEXTURE0);
+	GLState::BindTexture(GL_TEXTURE_2D, GL_NONE);
+	GLState::BindTexture(GL_TEXTURE_CUBE_MAP, GL_NONE);
+	GLState::UseProgram(GL_NONE);
+}
@@ -0,0 +1,95 @@
+/**************************************************
+ *
+ *                 RenderQueue.h
+ *
+ *  Passes submit draw packets with a 64-bit sort
+ *  key, from any worker into its own command
+ *  buffer. The queue merges and radix sorts them
+ *  and draws them with as few state changes as
+ *  it can.
+ *
+ ***************************************************/
+
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <GL/gl3w.h>
+
+#include <vector>
+
+// Buckets, drawn in this order. Each sets its own blend and depth write state
+enum RenderPass
+{
+    PASS_BACKGROUND,        // Skybox, no depth writes
+    PASS_OPAQUE,            // By program, then roughly front to back, then material
+    PASS_TRANSPARENT,       // Back to front, premultiplied alpha, no depth writes
+    PASS_COUNT
+};
+
+struct DrawPacket;
+typedef void (*DrawFunction)(const DrawPacket& packet);
+typedef void (*ProgramSetup)(GLuint program);
+
+struct DrawPacket
+{
+    GLuint program;             // GL_NONE if the draw function binds its own
+    ProgramSetup setup;         // Per frame uniforms, called once each time the queue switches to the program
+    GLenum textureTarget;
+    GLuint textures[2];         // Units 0 and 1, GL_NONE leaves the unit as it is
+    int object;                 // Whatever the draw function wants to know which thing it's drawing
+    DrawFunction draw;
+};
+
+// Packets recorded by one thread. Own cache lines, so workers appending side by side don't fight over them
+class alignas(64) CommandBuffer
+{
+public:
+    // Depth is the distance from the camera, it only has to be comparable within a frame
+    void Submit(RenderPass pass, float depth, const DrawPacket& packet);
+
+private:
+    friend class RenderQueue;
+
+    // Opaque:      pass:4 | program:8 | depth bucket:4 | material:16 | depth:32
+    // Transparent: pass:4 | far to near depth:32 | program:8 | material:16 | 0:4
+    static unsigned long long MakeKey(RenderPass pass, const DrawPacket& packet, float depth);
+
+    std::vector<unsigned long long> keys;
+    std::vector<DrawPacket> packets;
+};
+
+class RenderQueue
+{
+public:
+    // Empties every buffer and makes one for each job worker. Not while anyone is recording
+    void Clear();
+
+    // Worker is the index the job system hands out, 0 on the render thread
+    CommandBuffer& Buffer(int worker) { return buffers[worker]; }
+
+    // Into the render thread's buffer
+    void Submit(RenderPass pass, float depth, const DrawPacket& packet) { buffers[0].Submit(pass, depth, packet); }
+
+    void Sort();
+    void Execute();
+
+    struct Stats
+    {
+        int packets;
+        int programChanges;
+        int materialChanges;
+    };
+    const Stats& LastStats() const { return stats; }
+
+private:
+    std::vector<CommandBuffer> buffers;
+
+    // Every buffer merged, in worker order
+    std::vector<DrawPacket> packets;
+    std::vector<unsigned long long> keys, sortedKeys;
+    std::vector<unsigned int> order, sortedOrder;
+
+    Stats stats;
+};
+
+#endif
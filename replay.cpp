@@ -0,0 +1,192 @@
+/*****************************************
+ *
+ *           Replay.cpp
+ *
+ *  Binary input log. Fields are written
+ *  one by one so struct padding never
+ *  ends up in the file.
+ *
+ ****************************************/
+
+#include "replay.h"
+
+#include <string.h>
+
+static const char magic[4] = { 'S', 'S', 'R', 'P' };
+static const unsigned int version = 1;
+
+// Set on the keys byte when a settings block follows the frame
+static const unsigned char SETTINGS_FOLLOW = 0x80;
+
+template <class T>
+static void Write(FILE* file, const T& value)
+{
+	fwrite(&value, sizeof(T), 1, file);
+}
+
+template <class T>
+static bool Read(FILE* file, T& value)
+{
+	return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+static void WriteSettings(FILE* file, const ReplaySettings& settings)
+{
+	Write(file, settings.simulationSpeed);
+	Write(file, settings.simulationRate);
+	Write(file, settings.beltCount);
+	Write(file, settings.nbody);
+	Write(file, settings.jumpYear);
+}
+
+static bool ReadSettings(FILE* file, ReplaySettings& settings)
+{
+	return Read(file, settings.simulationSpeed) && Read(file, settings.simulationRate)
+		&& Read(file, settings.beltCount) && Read(file, settings.nbody) && Read(file, settings.jumpYear);
+}
+
+static bool SameSettings(const ReplaySettings& a, const ReplaySettings& b)
+{
+	return a.simulationSpeed == b.simulationSpeed && a.simulationRate == b.simulationRate
+		&& a.beltCount == b.beltCount && a.nbody == b.nbody && a.jumpYear == b.jumpYear;
+}
+
+//------------------------------------------------------------------------------------------------ Recorder
+
+InputRecorder::InputRecorder()
+{
+	file = 0;
+	frames = 0;
+}
+
+InputRecorder::~InputRecorder()
+{
+	Stop();
+}
+
+bool InputRecorder::Start(const char* path, unsigned int seed, const glm::mat4& view, const ReplaySettings& settings)
+{
+	Stop();
+
+	file = fopen(path, "wb");
+	if (!file)
+	{
+		printf("can't open replay file for writing: %s\n", path);
+		return false;
+	}
+
+	fwrite(magic, 1, sizeof(magic), file);
+	Write(file, version);
+	Write(file, seed);
+	for (int c = 0; c < 4; c++)
+		for (int r = 0; r < 4; r++)
+			Write(file, view[c][r]);
+	WriteSettings(file, settings);
+
+	frames = 0;
+	last = settings;
+	return true;
+}
+
+void InputRecorder::Record(const FrameInput& input, const ReplaySettings& settings)
+{
+	if (!file)
+		return;
+
+	bool changed = !SameSettings(settings, last);
+
+	Write(file, (unsigned char)(input.keys | (changed ? SETTINGS_FOLLOW : 0)));
+	Write(file, input.viewMode);
+	Write(file, input.cursorX);
+	Write(file, input.cursorY);
+	Write(file, input.deltaTime);
+	if (changed)
+	{
+		WriteSettings(file, settings);
+		last = settings;
+	}
+
+	frames++;
+}
+
+void InputRecorder::Stop()
+{
+	if (file)
+		fclose(file);
+	file = 0;
+}
+
+//------------------------------------------------------------------------------------------------ Replay
+
+InputReplay::InputReplay()
+{
+	file = 0;
+	frame = 0;
+	seed = 0;
+}
+
+InputReplay::~InputReplay()
+{
+	Close();
+}
+
+bool InputReplay::Open(const char* path)
+{
+	Close();
+
+	file = fopen(path, "rb");
+	if (!file)
+	{
+		printf("can't open replay file: %s\n", path);
+		return false;
+	}
+
+	char fileMagic[4];
+	unsigned int fileVersion = 0;
+	bool ok = fread(fileMagic, 1, sizeof(fileMagic), file) == sizeof(fileMagic) && memcmp(fileMagic, magic, sizeof(magic)) == 0
+		&& Read(file, fileVersion) && fileVersion == version && Read(file, seed);
+	for (int c = 0; c < 4 && ok; c++)
+		for (int r = 0; r < 4 && ok; r++)
+			ok = Read(file, view[c][r]);
+	ok = ok && ReadSettings(file, settings);
+
+	if (!ok)
+	{
+		printf("not a replay file (or an old one): %s\n", path);
+		Close();
+		return false;
+	}
+
+	frame = 0;
+	return true;
+}
+
+void InputReplay::Close()
+{
+	if (file)
+		fclose(file);
+	file = 0;
+}
+
+bool InputReplay::Next(FrameInput& input, ReplaySettings& changedSettings, bool& settingsChanged)
+{
+	if (!file)
+		return false;
+
+	unsigned char keys;
+	if (!Read(file, keys) || !Read(file, input.viewMode) || !Read(file, input.cursorX)
+		|| !Read(file, input.cursorY) || !Read(file, input.deltaTime))
+		return false;
+
+	input.keys = keys & ~SETTINGS_FOLLOW;
+	settingsChanged = (keys & SETTINGS_FOLLOW) != 0;
+	if (settingsChanged)
+	{
+		if (!ReadSettings(file, settings))
+			return false;
+		changedSettings = settings;
+	}
+
+	frame++;
+	return true;
+}
@@ -0,0 +1,95 @@
+/**************************************************
+ *
+ *                 Replay.h
+ *
+ *  Records everything a frame reads from the user
+ *  into a small binary log, and plays it back so
+ *  runs repeat frame for frame.
+ *
+ ***************************************************/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <GLM/glm.hpp>
+
+#include <stdio.h>
+
+// Keys the frame looks at, one bit each
+enum
+{
+    INPUT_W = 1 << 0,
+    INPUT_S = 1 << 1,
+    INPUT_A = 1 << 2,
+    INPUT_D = 1 << 3,
+    INPUT_P = 1 << 4
+};
+
+// One frame of input, this is all Update() gets to see of the outside world
+struct FrameInput
+{
+    float deltaTime;
+    unsigned char keys;
+    unsigned char viewMode;
+    short cursorX, cursorY;
+};
+
+// GUI settings that change what the simulation does. Stored up front and again whenever they change
+struct ReplaySettings
+{
+    float simulationSpeed;
+    float simulationRate;
+    int beltCount;
+    unsigned char nbody;
+    float jumpYear;
+};
+
+// The log is a header (seed, starting camera, settings) followed by 10 bytes a frame,
+// plus a settings block on the frames where something changed
+class InputRecorder
+{
+public:
+    InputRecorder();
+    ~InputRecorder();
+
+    bool Start(const char* path, unsigned int seed, const glm::mat4& view, const ReplaySettings& settings);
+    void Record(const FrameInput& input, const ReplaySettings& settings);
+    void Stop();
+
+    bool Recording() const { return file != 0; }
+    int Frames() const { return frames; }
+
+private:
+    FILE* file;
+    int frames;
+    ReplaySettings last;
+};
+
+class InputReplay
+{
+public:
+    InputReplay();
+    ~InputReplay();
+
+    bool Open(const char* path);
+    void Close();
+
+    // Fills in the next frame, and the settings when they changed on it. False at the end of the log
+    bool Next(FrameInput& input, ReplaySettings& settings, bool& settingsChanged);
+
+    bool Playing() const { return file != 0; }
+    int Frame() const { return frame; }
+
+    unsigned int Seed() const { return seed; }
+    const glm::mat4& View() const { return view; }
+    const ReplaySettings& Settings() const { return settings; }
+
+private:
+    FILE* file;
+    int frame;
+    unsigned int seed;
+    glm::mat4 view;
+    ReplaySettings settings;
+};
+
+#endif
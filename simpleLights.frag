@@ -10,29 +10,10 @@ in VertexData
 	vec2 texcoord;
 }	inData;
 
-uniform sampler2D diffuseTex;
-uniform sampler2D specularTex; // It's already here
-
-vec3 sunPosition = vec3(0); // Sun is at the origin
+// In phongShading.frag
+vec4 ShadeSurface(vec3 worldPos, vec3 normal, vec2 texcoord);
 
 void main()
 {
-	float luminance = 1.2f;
-	vec3 light = normalize(sunPosition - inData.worldPos);
-	vec3 normal = normalize(inData.normal);
-	float NoL = max(0.0f, dot(normal, light));
-	vec3 V = normalize(inData.worldPos - inData.eyePos);
-
-	vec4 diffuseTexture = texture(diffuseTex, inData.texcoord);
-
-	// Do diffuse light
-	vec3 diffuse = diffuseTexture.rgb * vec3(NoL) * luminance;
-	
-	// Do specular light
-	vec3 R = normalize(reflect(-light, normal));
-	float VoR = max(0.0f, dot(-V, R));
-	vec3 specular = vec3(1.0f) * pow(VoR, 20.0f) * (NoL > 0.0 ? 1.0 : 0.0);
-
-	frag_colour.rgb = diffuse + specular;
-	frag_colour.a = 1.0f;
+	frag_colour = ShadeSurface(inData.worldPos, inData.normal, inData.texcoord);
 }
\ No newline at end of file
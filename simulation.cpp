@@ -0,0 +1,440 @@
+/*****************************************
+ *
+ *           Simulation.cpp
+ *
+ *  Orbits, the asteroid and its collisions,
+ *  stepped at a fixed rate so the result
+ *  doesn't depend on the frame rate.
+ *
+ ****************************************/
+
+#include "simulation.h"
+#include "profiler.h"
+
+#include <GLM/gtc/constants.hpp>
+
+#include <math.h>
+#include <chrono>
+
+using namespace glm;
+
+const BodyInfo bodyInfo[BODY_COUNT] =
+{
+	//  parent  spin    size    mass
+	{   -1,     1.0f,   1.0f,   3.0e-6f     },  // EARTH, the earth stays the same size
+	{   -1,     0.0f,   3.0f,   1.0f        },  // SUN
+	{   EARTH,  -27.0f, 0.27f,  3.7e-8f     },  // MOON, the moon is 27% the size of earth
+	{   -1,     58.6f,  0.3f,   1.66e-7f    },  // MERCURY
+	{   -1,     243.0f, 1.0f,   2.45e-6f    },  // VENUS
+	{   -1,     1.03f,  0.7f,   3.2e-7f     },  // MARS
+	{   -1,     0.41f,  5.0f,   9.55e-4f    },  // JUPITER
+	{   -1,     0.45f,  4.0f,   2.86e-4f    },  // SATURN
+	{   -1,     0.72f,  2.0f,   4.37e-5f    },  // URANUS
+	{   -1,     0.67f,  3.0f,   5.15e-5f    },  // NEPTUNE
+	{   -1,     -27.0f, 0.27f,  0.0f        }   // AST, moves on its own and tumbles like the moon
+};
+
+// Real periods, eccentricities and angles on the old spaced out radii. Every mean longitude starts
+// at zero, so day 0 still lines the planets up along +x like the circular orbits did
+const OrbitElements bodyOrbits[BODY_COUNT] =
+{
+	//  period      axis    ecc.        incl.   node    peri.   longitude
+	{   365.0,      30.0f,  0.0167f,    0.0f,   0.0f,   102.9f, 0.0f    },  // EARTH
+	{   0.0,        0.0f,   0.0f,       0.0f,   0.0f,   0.0f,   0.0f    },  // SUN
+	{   27.322,     4.0f,   0.0549f,    5.14f,  125.1f, 318.2f, 0.0f    },  // MOON
+	{   87.97,      10.0f,  0.2056f,    7.0f,   48.3f,  29.1f,  0.0f    },  // MERCURY
+	{   224.7,      20.0f,  0.0068f,    3.39f,  76.7f,  54.9f,  0.0f    },  // VENUS
+	{   686.2,      40.0f,  0.0934f,    1.85f,  49.6f,  286.5f, 0.0f    },  // MARS
+	{   4328.9,     50.0f,  0.0489f,    1.30f,  100.5f, 273.9f, 0.0f    },  // JUPITER
+	{   10752.9,    60.0f,  0.0565f,    2.49f,  113.7f, 339.4f, 0.0f    },  // SATURN
+	{   30663.65,   70.0f,  0.0457f,    0.77f,  74.0f,  96.9f,  0.0f    },  // URANUS
+	{   60148.35,   80.0f,  0.0113f,    1.77f,  131.8f, 276.3f, 0.0f    },  // NEPTUNE
+	{   0.0,        0.0f,   0.0f,       0.0f,   0.0f,   0.0f,   0.0f    }   // AST
+};
+
+// The asteroid's speeds and pushes used to be per frame against the 120 Hz limiter
+static const float legacyFrameRate = 120.0f;
+
+// G * M of the sun in scene units per day, (2 pi / 365)^2 * 30^3 is what keeps the earth on its orbit
+static const float sunGM = 8.0f;
+
+// The belt sits between mars and jupiter. It's heavier than the real one (~1e-9 suns)
+// so its own gravity actually shows up over a long run
+static const float beltInner = 42.0f;
+static const float beltOuter = 48.0f;
+static const float beltMass = 1.0e-6f;
+static const unsigned int beltSeed = 1;
+
+// The belt is far heavier than the rest of a step, so it steps at its own lower rate with the days
+// gathered in between. Its orbits take hundreds of days, a fraction of a day per step is plenty
+static const float beltRate = 30.0f;
+
+// Longest frame we'll try to catch up on, so a stall doesn't turn into thousands of steps
+static const float maxFrameTime = 0.25f;
+
+float SpinAngle(int body, double days)
+{
+	const BodyInfo& info = bodyInfo[body];
+	if (info.spinPeriod == 0.0f)
+		return 0.0f;
+
+	double turns = days / info.spinPeriod;
+	return (float)(turns - floor(turns)) * two_pi<float>();
+}
+
+void Simulation::BodyPositions(const SimState& state, vec3* positions) const
+{
+	// Parents come before their moons in the body list
+	ephemeris.Solve(state.earthDays, positions);
+	for (int body = 0; body < BODY_COUNT; body++)
+	{
+		if (body == AST)
+			positions[body] = state.asteroidPosition;
+		else if (bodyInfo[body].parent >= 0)
+			positions[body] += positions[bodyInfo[body].parent];
+	}
+}
+
+Simulation::Simulation()
+{
+	ephemeris.SetOrbits(bodyOrbits, BODY_COUNT);
+	SetRate(240.0f);
+	beltSteps = 0;
+	Reset(1);
+}
+
+void Simulation::Reset(unsigned int seed)
+{
+	current = SimState();
+	current.earthDays = 17.62;
+	previous = current;
+
+	belt.Clear();
+	rng.seed(seed);
+
+	accumulator = 0.0;
+	beltTime = 0.0f;
+	beltDays = 0.0f;
+	stepsLastFrame = 0;
+	stepCount = 0;
+}
+
+void Simulation::SetRate(float hz)
+{
+	stepSize = 1.0f / hz;
+}
+
+float Simulation::Advance(float frameTime, const SimInput& input)
+{
+	accumulator += min(frameTime, maxFrameTime);
+
+	// Input is sampled once per frame, so only the first step gets to act on it
+	SimInput stepInput = input;
+	stepsLastFrame = 0;
+	while (accumulator >= stepSize)
+	{
+		Step(stepInput);
+		stepInput.launchAsteroid = false;
+		accumulator -= stepSize;
+		stepsLastFrame++;
+	}
+
+	return (float)(accumulator / stepSize);
+}
+
+void Simulation::Step(const SimInput& input)
+{
+	previous = current;
+	stepCount++;
+
+	// Add to the rotation, in days.
+	float days = stepSize * input.simulationSpeed;
+	current.earthDays += days;
+
+	if (input.launchAsteroid)
+		LaunchAsteroid(current);
+
+	if (input.nbody)
+		StepGravity(input, days);
+	else if (belt.Count() > 0)
+		belt.Clear();
+
+	if (current.asteroidLaunched && !current.destroyed[AST])
+	{
+		current.asteroidPosition += current.asteroidVelocity * stepSize;
+		Collide(current);
+	}
+}
+
+void SeedAsteroidBelt(NBody& belt, int count)
+{
+	belt.SeedBelt(count, beltInner, beltOuter, sunGM, beltMass * sunGM, beltSeed);
+}
+
+void SeedAsteroidBelt(MinorPlanets& belt, int count)
+{
+	belt.Seed(count, beltInner, beltOuter, sunGM, beltSeed);
+}
+
+void Simulation::StepGravity(const SimInput& input, float days)
+{
+	// The planets stay on their orbits and pull on everything else. Real masses can't hold the moon
+	// 4 units out with a 27 day month (the earth would have to be ~40% of the sun), so they aren't
+	// integrated themselves
+	vec3 bodies[BODY_COUNT];
+	BodyPositions(current, bodies);
+
+	vec3 positions[BODY_COUNT];
+	float gm[BODY_COUNT];
+	int count = 0;
+	for (int body = 0; body < BODY_COUNT; body++)
+	{
+		if (body == AST || current.destroyed[body])
+			continue;
+		positions[count] = bodies[body];
+		gm[count] = bodyInfo[body].mass * sunGM;
+		count++;
+	}
+	belt.SetAttractors(positions, gm, count);
+
+	if (belt.Count() != input.beltCount)
+		SeedAsteroidBelt(belt, input.beltCount);
+
+	beltTime += stepSize;
+	beltDays += days;
+	if (beltTime >= 1.0f / beltRate)
+	{
+		belt.Step(beltDays);
+		beltSteps++;
+		beltTime = 0.0f;
+		beltDays = 0.0f;
+	}
+
+	// The asteroid's velocity is per real second, so the pull (per day squared) scales with the speed squared
+	if (current.asteroidLaunched && !current.destroyed[AST])
+	{
+		vec3 pull = belt.AttractorAcceleration(current.asteroidPosition);
+		current.asteroidVelocity += pull * (input.simulationSpeed * input.simulationSpeed * stepSize);
+	}
+}
+
+void Simulation::LaunchAsteroid(SimState& state)
+{
+	// Same ranges rand() used to give, from a generator that's the same on every platform
+	float astx = rng() % 50 + 1;
+	float astz = rng() % 50 + 1;
+	int multx = rng() % 2 ? 1 : -1;
+	int multz = rng() % 2 ? 1 : -1;
+	float valx = (rng() % 20) * 0.001f;
+	float valz = (rng() % 20) * 0.001f;
+
+	state.asteroidLaunched = true;
+	state.asteroidSerial++;
+	state.asteroidPosition = vec3(astx, 0.0f, astz);
+	state.asteroidVelocity = vec3(valx * multx, 0.0f, valz * multz) * legacyFrameRate;
+	state.destroyed[AST] = false;
+}
+
+void Simulation::Collide(SimState& state)
+{
+	// Same bodies in the same order as the original per-planet checks
+	static const int order[] = { EARTH, VENUS, MERCURY, MOON, MARS, JUPITER, SATURN, URANUS, NEPTUNE };
+
+	// The push away from a planet was 0.02 * size per frame, now it's per second
+	const float push = 0.02f * legacyFrameRate * stepSize;
+
+	vec3 positions[BODY_COUNT];
+	BodyPositions(state, positions);
+
+	vec3& ast = state.asteroidPosition;
+	for (int i = 0; i < (int)(sizeof(order) / sizeof(order[0])); i++)
+	{
+		int body = order[i];
+		if (state.destroyed[body])
+			continue;
+
+		float size = bodyInfo[body].size;
+		vec3 position = positions[body];
+
+		// The last term compares the planet's x against the asteroid's z, as the original checks did
+		if (((position.x - ast.x) < size + 0.5f && (position.x - ast.x) > 0) && ((position.z - ast.z) < size + 0.5f && (position.x - ast.z) > 0)) {
+			ast.x -= push * size;
+			ast.z -= push * size;
+		}
+		else if (((position.x - ast.x) > -size - 0.5f && (position.x - ast.x) < 0) && ((position.z - ast.z) > -size - 0.5f && (position.x - ast.z) < 0)) {
+			ast.x += push * size;
+			ast.z += push * size;
+		}
+
+		if ((abs(position.x - ast.x) < size) && (abs(position.z - ast.z) < size)) {
+			state.destroyed[body] = true;
+			state.destroyed[AST] = true;
+		}
+	}
+}
+
+SimState Interpolate(const SimState& a, const SimState& b, float alpha)
+{
+	SimState state = b;
+	state.earthDays = a.earthDays + (b.earthDays - a.earthDays) * alpha;
+
+	if (a.asteroidLaunched && a.asteroidSerial == b.asteroidSerial)
+		state.asteroidPosition = mix(a.asteroidPosition, b.asteroidPosition, alpha);
+
+	return state;
+}
+
+SimState Simulation::Interpolate(float alpha) const
+{
+	return ::Interpolate(previous, current, alpha);
+}
+
+void Simulation::JumpTo(double days)
+{
+	current.earthDays = days;
+	previous = current;
+}
+
+SimulationWorker::SimulationWorker()
+{
+	simulation = 0;
+	running = false;
+	launchRequests = 0;
+	launchesSeen = 0;
+	jumpDays = 0.0;
+	jumpRequests = 0;
+	jumpsSeen = 0;
+	simulationSpeed = 0.01f;
+	simulationRate = 240.0f;
+	nbodyMode = false;
+	beltParticles = 0;
+	publishedBeltStep = 0;
+	publishedBeltCount = -1;
+}
+
+SimulationWorker::~SimulationWorker()
+{
+	Stop();
+}
+
+double SimulationWorker::Now()
+{
+	using namespace std::chrono;
+	static const steady_clock::time_point epoch = steady_clock::now();
+	return duration<double>(steady_clock::now() - epoch).count();
+}
+
+void SimulationWorker::Start(Simulation* sim)
+{
+	if (simulation)
+		return;
+
+	// Seed every slot, so the render thread has something to draw before the first step lands
+	SimSnapshot first;
+	first.previous = sim->Previous();
+	first.current = sim->Current();
+	first.time = Now();
+	first.stepSize = 1.0f / sim->Rate();
+	first.step = sim->StepCount();
+	snapshots.Fill(first);
+
+	launchesSeen = launchRequests;
+	jumpsSeen = jumpRequests;
+	publishedBeltCount = -1;
+	simulation = sim;
+	running = true;
+	thread = std::thread(&SimulationWorker::Run, this);
+}
+
+void SimulationWorker::Stop()
+{
+	if (!simulation)
+		return;
+
+	running = false;
+	thread.join();
+	simulation = 0;
+}
+
+void SimulationWorker::Run()
+{
+	Profiler::SetThreadName("Simulation");
+	double next = Now();
+
+	while (running)
+	{
+		simulation->SetRate(simulationRate);
+		float stepSize = 1.0f / simulation->Rate();
+
+		// Every request since the last step turns into one launch, same as holding P for a frame did
+		SimInput input;
+		int requests = launchRequests;
+		input.launchAsteroid = requests != launchesSeen;
+		input.simulationSpeed = simulationSpeed;
+		input.nbody = nbodyMode;
+		input.beltCount = beltParticles;
+		launchesSeen = requests;
+
+		// Only the newest jump matters, any in between were scrubbed past
+		int jumps = jumpRequests;
+		if (jumps != jumpsSeen)
+		{
+			simulation->JumpTo(jumpDays);
+			jumpsSeen = jumps;
+		}
+
+		ProfileScope step("Simulation Step");
+		simulation->Step(input);
+
+		SimSnapshot& snapshot = snapshots.WriteBuffer();
+		snapshot.previous = simulation->Previous();
+		snapshot.current = simulation->Current();
+		snapshot.time = next;
+		snapshot.stepSize = stepSize;
+		snapshot.step = simulation->StepCount();
+		snapshots.Publish();
+
+		// The belt only moves a few times for every step, so it's copied out when it has, or when it's been reseeded or cleared
+		const NBody& belt = simulation->Belt();
+		if (belt.Count() != publishedBeltCount || (belt.Count() > 0 && simulation->BeltSteps() != publishedBeltStep))
+		{
+			std::vector<float>& positions = beltPositions.WriteBuffer();
+			positions.resize(belt.Count() * 3);
+			if (!positions.empty())
+				belt.CopyPositions(&positions[0]);
+			beltPositions.Publish();
+			publishedBeltCount = belt.Count();
+			publishedBeltStep = simulation->BeltSteps();
+		}
+		step.End();
+
+		// Catch up with back to back steps if we're behind, but give up after a long stall
+		next += stepSize;
+		double now = Now();
+		if (now - next > maxFrameTime)
+			next = now;
+		if (next > now)
+			std::this_thread::sleep_for(std::chrono::duration<double>(next - now));
+	}
+}
+
+const SimSnapshot& SimulationWorker::Latest()
+{
+	snapshots.Fetch();
+	return snapshots.ReadBuffer();
+}
+
+bool SimulationWorker::FetchBelt(const std::vector<float>*& positions)
+{
+	if (!beltPositions.Fetch())
+		return false;
+	positions = &beltPositions.ReadBuffer();
+	return true;
+}
+
+SimState SimulationWorker::Sample()
+{
+	const SimSnapshot& snapshot = Latest();
+	float alpha = (float)((Now() - snapshot.time) / snapshot.stepSize);
+	return ::Interpolate(snapshot.previous, snapshot.current, clamp(alpha, 0.0f, 1.0f));
+}
@@ -0,0 +1,202 @@
+/**************************************************
+ *
+ *                 Simulation.h
+ *
+ *  Fixed-step solar system simulation. Rendering
+ *  blends between the last two steps.
+ *
+ ***************************************************/
+
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include <GLM/glm.hpp>
+
+#include <atomic>
+#include <thread>
+#include <random>
+
+#include "triplebuffer.h"
+#include "nbody.h"
+#include "minorplanets.h"
+#include "ephemeris.h"
+
+enum
+{
+    EARTH = 0,
+    SUN = 1,
+    MOON = 2,
+    MERCURY = 3,
+    VENUS = 4,
+    MARS = 5,
+    JUPITER = 6,
+    SATURN = 7,
+    URANUS = 8,
+    NEPTUNE = 9,
+    AST = 10,
+    BODY_COUNT = 11
+};
+
+struct BodyInfo
+{
+    int parent;         // Body this one orbits around, -1 for the sun
+    float spinPeriod;   // Days per turn, negative spins backwards, 0 for none
+    float size;
+    float mass;         // Solar masses, only used for gravity in n-body mode
+};
+
+extern const BodyInfo bodyInfo[BODY_COUNT];
+
+// Orbits around each body's parent, the sun and the asteroid have none
+extern const OrbitElements bodyOrbits[BODY_COUNT];
+
+struct SimState
+{
+    double earthDays;               // Double so the date keeps its precision centuries out
+    bool destroyed[BODY_COUNT];
+
+    bool asteroidLaunched;
+    int asteroidSerial;             // Bumped on every launch so we never blend across a respawn
+    glm::vec3 asteroidPosition;
+    glm::vec3 asteroidVelocity;     // Units per second
+};
+
+// Everything the simulation reads from the outside world for one step
+struct SimInput
+{
+    bool launchAsteroid;
+    float simulationSpeed;
+
+    bool nbody;         // Integrate the belt and the asteroid under gravity
+    int beltCount;
+};
+
+// Spin angle at the given day
+float SpinAngle(int body, double days);
+
+// The asteroid belt between mars and jupiter, under gravity for n-body mode or on rails otherwise
+void SeedAsteroidBelt(NBody& belt, int count);
+void SeedAsteroidBelt(MinorPlanets& belt, int count);
+
+// Blend between two consecutive steps, discrete things (destroyed bodies, launches) snap to b
+SimState Interpolate(const SimState& a, const SimState& b, float alpha);
+
+class Simulation
+{
+public:
+    Simulation();
+
+    // Back to the starting state, with launches drawn from the given seed so runs can be repeated
+    void Reset(unsigned int seed);
+
+    void SetRate(float hz);
+    float Rate() const { return 1.0f / stepSize; }
+
+    // Runs as many fixed steps as the accumulated frame time allows and returns how far
+    // we are towards the next one, for blending Previous() into Current()
+    float Advance(float frameTime, const SimInput& input);
+    void Step(const SimInput& input);
+
+    const SimState& Previous() const { return previous; }
+    const SimState& Current() const { return current; }
+    SimState Interpolate(float alpha) const;
+
+    // Moves the clock without stepping, for scrubbing the timeline. The asteroid and the belt
+    // carry on from wherever they are
+    void JumpTo(double days);
+
+    const NBody& Belt() const { return belt; }
+
+    // Bumped only when the belt actually moves, which is at beltRate rather than every step. Never goes back,
+    // not even on Reset(), so anything that copies the belt out can compare against the last one it saw
+    unsigned long long BeltSteps() const { return beltSteps; }
+
+    // Pushes a launched asteroid off the bodies it passes, or destroys it and whatever it hit.
+    // Step() runs it, it's out here so the benchmarks can time it on its own
+    void Collide(SimState& state);
+
+    int StepsLastFrame() const { return stepsLastFrame; }
+    unsigned long long StepCount() const { return stepCount; }
+
+private:
+    void LaunchAsteroid(SimState& state);
+    void StepGravity(const SimInput& input, float days);
+    void BodyPositions(const SimState& state, glm::vec3* positions) const;
+
+    SimState previous, current;
+    Ephemeris ephemeris;
+    std::mt19937 rng;
+    NBody belt;
+    float beltTime, beltDays;   // Time and days gathered since the belt last stepped
+    float stepSize;
+    double accumulator;
+    int stepsLastFrame;
+    unsigned long long stepCount;
+    unsigned long long beltSteps;
+};
+
+// One finished step handed from the simulation thread to the render thread
+struct SimSnapshot
+{
+    SimState previous, current;
+    double time;                    // SimulationWorker::Now() that current belongs to
+    float stepSize;
+    unsigned long long step;
+};
+
+// Runs a Simulation on its own thread at its fixed rate. Input goes in through atomics and
+// finished steps come out through a triple buffer, so neither side ever waits on the other
+class SimulationWorker
+{
+public:
+    SimulationWorker();
+    ~SimulationWorker();
+
+    // The simulation belongs to the worker between Start() and Stop()
+    void Start(Simulation* simulation);
+    void Stop();
+    bool Running() const { return simulation != 0; }
+
+    // Render thread side
+    void RequestLaunch() { launchRequests++; }
+    void RequestJump(double days) { jumpDays = days; jumpRequests++; }
+    void SetSpeed(float speed) { simulationSpeed = speed; }
+    void SetRate(float hz) { simulationRate = hz; }
+    void SetGravity(bool nbody, int beltCount) { nbodyMode = nbody; beltParticles = beltCount; }
+    const SimSnapshot& Latest();
+
+    // Newest belt positions (xyz floats), only returns true when there's something new
+    bool FetchBelt(const std::vector<float>*& positions);
+
+    // Blend of the newest snapshot for the current time. We draw one step behind so there's
+    // always a step on either side of the time we're showing
+    SimState Sample();
+
+    static double Now();
+
+private:
+    void Run();
+
+    Simulation* simulation;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    std::atomic<int> launchRequests;
+    std::atomic<float> simulationSpeed;
+    std::atomic<float> simulationRate;
+    std::atomic<bool> nbodyMode;
+    std::atomic<int> beltParticles;
+    int launchesSeen;
+    std::atomic<double> jumpDays;
+    std::atomic<int> jumpRequests;
+    int jumpsSeen;
+
+    TripleBuffer<SimSnapshot> snapshots;
+
+    // The belt is far too big to copy along with every snapshot, so it gets its own buffer
+    TripleBuffer<std::vector<float> > beltPositions;
+    unsigned long long publishedBeltStep;
+    int publishedBeltCount;             // -1 until the first publish, so a fresh start always sends one
+};
+
+#endif
@@ -3,11 +3,11 @@
 in vec3 direction;
  
 uniform samplerCube skybox;
+uniform float skyIntensity;     // HDR scale of the cubemap, the tonemapper's exposure does the rest
 
 out vec4 frag_colour;
  
 void main()
 {    
-	float exposure = 2.0f;
-	frag_colour = texture(skybox, direction) * exposure;
+	frag_colour = texture(skybox, direction) * skyIntensity;
 }
\ No newline at end of file
@@ -0,0 +1,61 @@
+#version 400
+
+#define PI 3.14159265f
+
+out vec4 frag_colour;
+
+in ImpostorData
+{
+	vec3 worldPos;
+	flat vec3 centre;
+	flat float radius;
+}	inData;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+
+uniform vec3 cameraPos;
+uniform bool mirrorU;           // The phong vertex shaders flip u, the emissive one doesn't
+
+// In phongShading.frag or emissiveShading.frag
+vec4 ShadeSurface(vec3 worldPos, vec3 normal, vec2 texcoord);
+
+void main()
+{
+	// Nearest hit of the eye ray with the sphere
+	vec3 dir = normalize(inData.worldPos - cameraPos);
+	vec3 fromCentre = cameraPos - inData.centre;
+	float b = dot(fromCentre, dir);
+	float h = b * b - (dot(fromCentre, fromCentre) - inData.radius * inData.radius);
+	float t = -b - sqrt(max(h, 0.0f));
+
+	// Misses are only discarded at the end, the texture lookups need their neighbours' derivatives
+	bool miss = h < 0.0f || t < 0.0f;
+
+	vec3 hit = cameraPos + dir * t;
+	vec3 normal = (hit - inData.centre) / inData.radius;
+
+	vec4 clip = proj * view * vec4(hit, 1.0f);
+	gl_FragDepth = clip.z / clip.w * 0.5f + 0.5f;
+
+	// Back into the body's own frame for the lat/long lookup, the rotation is all that's left once it's normalised
+	vec3 local = normalize(transpose(mat3(model)) * normal);
+	float u = atan(local.z, local.x) / (2.0f * PI);
+	float v = 1.0f - acos(clamp(local.y, -1.0f, 1.0f)) / PI;
+
+	// atan jumps by a whole turn at the seam. Of the two ways to wrap u, one is smooth there, so take
+	// whichever changes least across the pixel and the mip selection doesn't drop to 1x1 along it
+	float u1 = fract(u);
+	float u2 = fract(u + 0.5f) - 0.5f;
+	u = fwidth(u1) <= fwidth(u2) + 1e-5f ? u1 : u2;
+
+	// The sphere mesh's mapping, u goes round from +x towards +z and v runs south to north. Mirrored
+	// for the planets, the same as simpleLights.vert and sphereTess.tese do
+	if (mirrorU)
+		u = 1.0f - u;
+	frag_colour = ShadeSurface(hit, normal, vec2(u, v));
+
+	if (miss)
+		discard;
+}
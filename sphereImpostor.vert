@@ -0,0 +1,39 @@
+#version 400
+
+// Four corners of a quad facing the camera that just covers the body, drawn as a strip with no attributes.
+// The fragment shader finds the sphere itself
+out ImpostorData
+{
+	vec3 worldPos;
+	flat vec3 centre;
+	flat float radius;
+}	outData;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 proj;
+
+uniform vec3 cameraPos;
+
+void main()
+{
+	// Same unit diameter sphere the meshes use, scaled and placed by the model matrix
+	vec3 centre = vec3(model[3]);
+	float radius = length(vec3(model[0])) * 0.5f;
+
+	vec3 toCentre = centre - cameraPos;
+	float distance = max(length(toCentre), radius * 1.001f);
+	vec3 forward = toCentre / max(length(toCentre), 1e-6f);
+	vec3 right = normalize(cross(forward, abs(forward.y) < 0.99f ? vec3(0.0f, 1.0f, 0.0f) : vec3(1.0f, 0.0f, 0.0f)));
+	vec3 up = cross(right, forward);
+
+	// The cone of rays that touch the sphere is wider than the sphere where it crosses the centre
+	float halfSize = radius * distance / sqrt(distance * distance - radius * radius);
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0f - 1.0f;
+
+	outData.worldPos	= centre + (right * corner.x + up * corner.y) * halfSize;
+	outData.centre		= centre;
+	outData.radius		= radius;
+
+	gl_Position = proj * view * vec4(outData.worldPos, 1.0f);
+}
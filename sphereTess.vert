@@ -0,0 +1,14 @@
+#version 400
+
+layout (location = 2) in vec2 vertexTexCoord;
+
+// The patch corners are only lat/long coordinates, the evaluation shader puts them on the sphere
+out PatchData
+{
+	vec2 texcoord;
+}	outData;
+
+void main()
+{
+	outData.texcoord = vertexTexCoord;
+}
@@ -0,0 +1,264 @@
+/*****************************************
+ *
+ *           StarField.cpp
+ *
+ *  Catalog stars go up once as a sorted
+ *  instance buffer, twelve bytes a star,
+ *  and are drawn as gaussian sprites.
+ *
+ ****************************************/
+
+#include "starfield.h"
+#include "shaders.h"
+#include "profiler.h"
+#include "glstate.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+
+#include <GLM/gtc/constants.hpp>
+
+static const char magic[4] = { 'S', 'T', 'A', 'R' };
+static const unsigned int version = 1;
+
+// Sky made up when there's no catalog, about as many stars as Hipparcos down to the same depth
+static const int proceduralCount = 120000;
+static const float proceduralFaintest = 9.0f;
+static const unsigned int proceduralSeed = 1;                   // <- The same sky every run
+
+// Tilt of the equator against the ecliptic, the orbits in the scene lie in the ecliptic
+static const float obliquity = 0.4090928f;
+
+struct StarRecord
+{
+	float rightAscension, declination;
+	float magnitude, colourIndex;
+};
+
+// What the vertex shader reads per instance
+struct StarInstance
+{
+	GLshort direction[3];       // Normalised, unit vector towards the star
+	GLshort magnitude;          // Thousandths of a magnitude
+	GLubyte colour[4];
+};
+
+float StarField::magnitudeLimit = 9.0f;
+float StarField::starSize = 1.5f;
+float StarField::maxStarSize = 6.0f;
+float StarField::brightness = 0.5f;
+
+BufferHandle StarField::starBuffer;
+VertexArrayHandle StarField::starVao;
+GLuint StarField::program = 0;
+int StarField::count = 0;
+int StarField::drawn = 0;
+std::vector<float> StarField::magnitudes;
+
+template <class T>
+static bool Read(FILE* file, T& value)
+{
+	return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+static bool LoadCatalog(const char* path, ArenaVector<StarRecord>& records)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return false;
+
+	char fileMagic[4];
+	unsigned int fileVersion = 0, fileCount = 0;
+	bool ok = fread(fileMagic, 1, sizeof(fileMagic), file) == sizeof(fileMagic) && memcmp(fileMagic, magic, sizeof(magic)) == 0
+		&& Read(file, fileVersion) && fileVersion == version && Read(file, fileCount);
+
+	if (ok)
+	{
+		records.resize(fileCount);
+		ok = fileCount == 0 || fread(&records[0], sizeof(StarRecord), fileCount, file) == fileCount;
+	}
+	fclose(file);
+
+	if (!ok)
+	{
+		printf("not a star catalog (or an old one): %s\n", path);
+		records.clear();
+	}
+	return ok;
+}
+
+// Unit vector in equatorial coordinates
+static glm::vec3 Equatorial(float rightAscension, float declination)
+{
+	return glm::vec3(cos(declination) * cos(rightAscension), cos(declination) * sin(rightAscension), sin(declination));
+}
+
+// Random sky, thickened along the galactic plane and with faint stars far outnumbering bright ones
+static void MakeCatalog(ArenaVector<StarRecord>& records, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::normal_distribution<float> colour(0.65f, 0.45f);
+
+	// Galactic north pole, RA 192.86 Dec 27.13
+	glm::vec3 pole = Equatorial(3.3660f, 0.4735f);
+	glm::vec3 across = glm::normalize(glm::cross(pole, glm::vec3(0.0f, 0.0f, 1.0f)));
+	glm::vec3 along = glm::cross(pole, across);
+
+	records.resize(proceduralCount);
+	for (int i = 0; i < proceduralCount; i++)
+	{
+		// Counts go up about 10^0.5 per magnitude, so m = faintest + 2 log10(u)
+		float magnitude = proceduralFaintest + 2.0f * log10(std::max(unit(rng), 1e-6f));
+
+		float z = unit(rng) * 2.0f - 1.0f;
+		float angle = unit(rng) * glm::two_pi<float>();
+		if (unit(rng) < 0.5f)
+			z *= 0.15f;                                                 // <- Half of them crowd into the Milky Way
+		glm::vec3 galactic = glm::normalize(glm::vec3(sqrt(1.0f - z * z) * cos(angle), sqrt(1.0f - z * z) * sin(angle), z));
+		glm::vec3 direction = across * galactic.x + along * galactic.y + pole * galactic.z;
+
+		records[i].rightAscension = atan2(direction.y, direction.x);
+		records[i].declination = asin(glm::clamp(direction.z, -1.0f, 1.0f));
+		records[i].magnitude = std::max(magnitude, -1.5f);
+		records[i].colourIndex = glm::clamp(colour(rng), -0.3f, 2.0f);
+	}
+}
+
+// B-V to a temperature (Ballesteros), then a fit to the blackbody colour. Normalised, magnitude carries the brightness
+static glm::vec3 StarColour(float colourIndex)
+{
+	float kelvin = 4600.0f * (1.0f / (0.92f * colourIndex + 1.7f) + 1.0f / (0.92f * colourIndex + 0.62f));
+	float t = kelvin / 100.0f;
+
+	glm::vec3 rgb;
+	rgb.x = t <= 66.0f ? 255.0f : 329.698727f * pow(t - 60.0f, -0.1332048f);
+	rgb.y = t <= 66.0f ? 99.4708026f * log(t) - 161.1195682f : 288.1221695f * pow(t - 60.0f, -0.0755148f);
+	rgb.z = t >= 66.0f ? 255.0f : (t <= 19.0f ? 0.0f : 138.5177312f * log(t - 10.0f) - 305.0447927f);
+	rgb = glm::clamp(rgb, 0.0f, 255.0f);
+
+	return rgb / std::max(std::max(rgb.x, rgb.y), std::max(rgb.z, 1.0f));
+}
+
+bool StarField::Initialize(const char* catalogPath)
+{
+	PROFILE_SCOPE("Star Catalog", catalogPath);
+
+	GLuint vs = buildShader(GL_VERTEX_SHADER, ASSETS"stars.vert");
+	GLuint fs = buildShader(GL_FRAGMENT_SHADER, ASSETS"stars.frag");
+	if (vs && fs)
+		program = linkProgram(buildProgram(vs, fs, 0));
+	if (!program)
+	{
+		printf("star shaders failed to build, the sky stays on the cubemap\n");
+		return false;
+	}
+
+	ScratchScope scratch;
+	ArenaVector<StarRecord> records(Arena::Scratch());
+	if (!LoadCatalog(catalogPath, records))
+	{
+		printf("no star catalog at %s, making up %d stars\n", catalogPath, proceduralCount);
+		MakeCatalog(records, proceduralSeed);
+	}
+
+	// Brightest first, so any magnitude limit is a count from the start of the buffer
+	std::sort(records.begin(), records.end(),
+		[](const StarRecord& a, const StarRecord& b) { return a.magnitude < b.magnitude; });
+
+	count = (int)records.size();
+	if (count == 0)
+		return false;
+	magnitudes.resize(count);
+
+	ArenaVector<StarInstance> instances(count, Arena::Scratch());
+	for (int i = 0; i < count; i++)
+	{
+		// Equatorial into the scene's frame, y up out of the ecliptic
+		glm::vec3 equatorial = Equatorial(records[i].rightAscension, records[i].declination);
+		glm::vec3 ecliptic = glm::vec3(equatorial.x,
+			equatorial.y * cos(obliquity) + equatorial.z * sin(obliquity),
+			-equatorial.y * sin(obliquity) + equatorial.z * cos(obliquity));
+		glm::vec3 direction = glm::vec3(ecliptic.x, ecliptic.z, -ecliptic.y);
+		glm::vec3 colour = StarColour(records[i].colourIndex);
+
+		magnitudes[i] = records[i].magnitude;
+
+		StarInstance& star = instances[i];
+		for (int axis = 0; axis < 3; axis++)
+			star.direction[axis] = (GLshort)floor(glm::clamp(direction[axis], -1.0f, 1.0f) * 32767.0f + 0.5f);
+		star.magnitude = (GLshort)floor(glm::clamp(records[i].magnitude, -30.0f, 30.0f) * 1000.0f + 0.5f);
+		for (int channel = 0; channel < 3; channel++)
+			star.colour[channel] = (GLubyte)(colour[channel] * 255.0f + 0.5f);
+		star.colour[3] = 255;
+	}
+
+	starVao.Create(MEMORY_GEOMETRY);
+	GLState::BindVertexArray(starVao);
+
+	starBuffer.Create(MEMORY_GEOMETRY);
+	GLState::BindBuffer(GL_ARRAY_BUFFER, starBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(StarInstance) * count, &instances[0], GL_STATIC_DRAW);
+	starBuffer.SetBytes(sizeof(StarInstance) * count);
+
+	// One record per sprite, the four corners come from gl_VertexID
+	glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(StarInstance), (void*)offsetof(StarInstance, direction));
+	glVertexAttribPointer(1, 1, GL_SHORT, GL_FALSE, sizeof(StarInstance), (void*)offsetof(StarInstance, magnitude));
+	glVertexAttribPointer(2, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(StarInstance), (void*)offsetof(StarInstance, colour));
+	for (int attribute = 0; attribute < 3; attribute++)
+	{
+		glEnableVertexAttribArray(attribute);
+		glVertexAttribDivisor(attribute, 1);
+	}
+
+	GLState::BindVertexArray(GL_NONE);
+	GLState::BindBuffer(GL_ARRAY_BUFFER, GL_NONE);
+	return true;
+}
+
+void StarField::Cleanup()
+{
+	starBuffer.Reset();
+	starVao.Reset();
+	if (program) GLState::DeleteProgram(program);
+
+	program = 0;
+	count = drawn = 0;
+	magnitudes.clear();
+}
+
+size_t StarField::Bytes()
+{
+	return (size_t)count * sizeof(StarInstance);
+}
+
+void StarField::Draw(const glm::mat4& view, const glm::mat4& proj, int viewportWidth, int viewportHeight)
+{
+	if (count == 0)
+		return;
+
+	drawn = (int)(std::upper_bound(magnitudes.begin(), magnitudes.end(), magnitudeLimit) - magnitudes.begin());
+	if (drawn == 0)
+		return;
+
+	GLState::UseProgram(program);
+	GLState::UniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, &glm::mat4(glm::mat3(view))[0][0]);  // <- Rotation only, stars are at infinity
+	GLState::UniformMatrix4fv(glGetUniformLocation(program, "proj"), 1, GL_FALSE, &proj[0][0]);
+	GLState::Uniform2f(glGetUniformLocation(program, "viewportSize"), (float)viewportWidth, (float)viewportHeight);
+	GLState::Uniform1f(glGetUniformLocation(program, "magnitudeLimit"), magnitudeLimit);
+	GLState::Uniform1f(glGetUniformLocation(program, "starSize"), starSize);
+	GLState::Uniform1f(glGetUniformLocation(program, "maxStarSize"), maxStarSize);
+	GLState::Uniform1f(glGetUniformLocation(program, "brightness"), brightness);
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_ONE, GL_ONE);                                        // <- Overlapping stars add up, the sky behind is black
+	GLState::BindVertexArray(starVao);
+	GLState::DrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, drawn);
+	GLState::BindVertexArray(GL_NONE);
+	glDisable(GL_BLEND);
+}
@@ -0,0 +1,52 @@
+/**************************************************
+ *
+ *                 StarField.h
+ *
+ *  Background stars drawn from a catalog as one
+ *  instanced batch of sprites, sized and lit by
+ *  magnitude instead of sampled from a cubemap.
+ *
+ ***************************************************/
+
+#ifndef STARFIELD_H
+#define STARFIELD_H
+
+#include <GL/gl3w.h>
+#include <GLM/glm.hpp>
+
+#include <vector>
+
+#include "gpumemory.h"
+
+// Catalog file, little endian:
+//   char magic[4] = "STAR", unsigned int version = 1, unsigned int count
+//   count records of float rightAscension, declination (radians, J2000), magnitude, colourIndex (B-V)
+class StarField
+{
+public:
+    // Reads the catalog, or makes a random sky with the same statistics when the file isn't there
+    static bool Initialize(const char* catalogPath);
+    static bool Available() { return count > 0; }
+    static void Cleanup();
+
+    // Only stars brighter than the limit are drawn, the buffer is sorted so that's a prefix of it
+    static void Draw(const glm::mat4& view, const glm::mat4& proj, int viewportWidth, int viewportHeight);
+
+    static int Count() { return count; }
+    static int DrawnCount() { return drawn; }
+    static size_t Bytes();
+
+    static float magnitudeLimit;    // Faintest star drawn, about 6.5 by eye on a dark night
+    static float starSize;          // Sprite radius in output pixels of a star at the limit
+    static float maxStarSize;       // Cap for the brightest ones, so Sirius doesn't turn into a disc
+    static float brightness;        // HDR scale, bright stars go over the bloom threshold
+
+private:
+    static BufferHandle starBuffer;
+    static VertexArrayHandle starVao;
+    static GLuint program;
+    static int count, drawn;
+    static std::vector<float> magnitudes;  // Sorted brightest first, for finding how many pass the limit
+};
+
+#endif
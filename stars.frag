@@ -0,0 +1,16 @@
+#version 400
+
+in StarData
+{
+	vec2 corner;
+	vec3 colour;
+}	inData;
+
+out vec4 frag_colour;
+
+void main()
+{
+	// Gaussian rather than a hard disc, so even a one pixel star is antialiased
+	float falloff = exp(-4.0f * dot(inData.corner, inData.corner));
+	frag_colour = vec4(inData.colour * falloff, 1.0f);
+}
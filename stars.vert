@@ -0,0 +1,42 @@
+#version 400
+
+// One instance per star, the sprite's corners come from gl_VertexID
+layout (location = 0) in vec3 starDirection;
+layout (location = 1) in float starMagnitude;	// Thousandths
+layout (location = 2) in vec3 starColour;
+
+out StarData
+{
+	vec2 corner;
+	vec3 colour;
+}	outData;
+
+uniform mat4 view;	// Rotation only
+uniform mat4 proj;
+uniform vec2 viewportSize;
+
+uniform float magnitudeLimit;
+uniform float starSize;
+uniform float maxStarSize;
+uniform float brightness;
+
+void main()
+{
+	// Five magnitudes is a factor of 100 in flux. Use the square root of it, the eye is closer to logarithmic
+	float flux = pow(10.0f, 0.2f * (magnitudeLimit - starMagnitude * 0.001f));
+
+	// Bright stars grow until the cap and then only get brighter, so the energy in the sprite follows the flux
+	float size = min(starSize * sqrt(flux), maxStarSize);
+	float spread = starSize / size;
+
+	outData.corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0f - 1.0f;
+	outData.colour = starColour * brightness * flux * spread * spread;
+
+	// Stars sit at infinity. Depth writes are off for the background, anywhere inside the depth range will do
+	vec4 clip = proj * vec4(mat3(view) * starDirection, 0.0f);
+	clip.z = 0.0f;
+
+	// Sized in pixels, the same at every resolution
+	clip.xy += outData.corner * size * 2.0f / viewportSize * clip.w;
+	gl_Position = clip;
+}
@@ -0,0 +1,553 @@
+/*****************************************
+ *
+ *           TextureStream.cpp
+ *
+ *  Mip streaming. Every level is cooked
+ *  once into a .mips file next to the
+ *  source so any level can be read alone.
+ *
+ ****************************************/
+
+#include "texturestream.h"
+#include "profiler.h"
+#include "glstate.h"
+#include "arena.h"
+
+#include <SOIL.h>
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+// S3TC isn't core, but every desktop driver has it
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Levels this size and smaller always stay resident, it's enough for anything a few hundred pixels across
+static const int tailSize = 256;
+
+static const char mipMagic[4] = { 'M', 'I', 'P', 'S' };
+static const unsigned int mipVersion = 1;
+static const long mipHeaderSize = 4 + 4 + 8 + 4 * 4;
+
+static int LevelSize(int size, int level)
+{
+	return std::max(1, size >> level);
+}
+
+static int LevelCount(int width, int height)
+{
+	int levels = 1;
+	while ((width >> levels) > 0 || (height >> levels) > 0)
+		levels++;
+	return levels;
+}
+
+static int TailLevel(int width, int height, int levels)
+{
+	int level = 0;
+	while (level < levels - 1 && std::max(LevelSize(width, level), LevelSize(height, level)) > tailSize)
+		level++;
+	return level;
+}
+
+static long long FileSize(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (!file)
+		return -1;
+	fseek(file, 0, SEEK_END);
+	long long size = ftell(file);
+	fclose(file);
+	return size;
+}
+
+// Half size box filter, odd edges reuse their last row or column
+static void Downsample(const std::vector<unsigned char>& src, int sw, int sh, int c, std::vector<unsigned char>& dst)
+{
+	int dw = std::max(1, sw / 2), dh = std::max(1, sh / 2);
+	dst.resize(dw * dh * c);
+	for (int y = 0; y < dh; y++)
+	{
+		const unsigned char* row0 = &src[std::min(y * 2, sh - 1) * sw * c];
+		const unsigned char* row1 = &src[std::min(y * 2 + 1, sh - 1) * sw * c];
+		for (int x = 0; x < dw; x++)
+		{
+			int x0 = std::min(x * 2, sw - 1) * c, x1 = std::min(x * 2 + 1, sw - 1) * c;
+			for (int k = 0; k < c; k++)
+				dst[(y * dw + x) * c + k] = (unsigned char)((row0[x0 + k] + row0[x1 + k] + row1[x0 + k] + row1[x1 + k] + 2) >> 2);
+		}
+	}
+}
+
+// Decodes the source the way SOIL's flags used to (flipped, NTSC safe) and hands over every level,
+// most detailed first. Returns false if the image can't be loaded or the callback gives up
+template <class F>
+static bool CookLevels(const std::string& path, F emit)
+{
+	int w, h, c;
+	unsigned char* data = SOIL_load_image(path.c_str(), &w, &h, &c, SOIL_LOAD_AUTO);
+	if (!data)
+	{
+		printf("can't load texture: %s\n", path.c_str());
+		return false;
+	}
+
+	// Grey maps become RGB and grey + alpha becomes RGBA, so there are only two upload formats
+	int channels = (c == 2 || c == 4) ? 4 : 3;
+	std::vector<unsigned char> level(w * h * channels), next;
+	for (int y = 0; y < h; y++)
+	{
+		for (int x = 0; x < w; x++)
+		{
+			const unsigned char* in = data + ((h - 1 - y) * w + x) * c;
+			unsigned char* out = &level[(y * w + x) * channels];
+			for (int k = 0; k < 3; k++)
+				out[k] = (unsigned char)(16 + (c >= 3 ? in[k] : in[0]) * 219 / 255);
+			if (channels == 4)
+				out[3] = in[c - 1];
+		}
+	}
+	SOIL_free_image_data(data);
+
+	int levels = LevelCount(w, h);
+	for (int l = 0; l < levels; l++)
+	{
+		if (!emit(l, w, h, channels, levels, level))
+			return false;
+		if (l + 1 < levels)
+		{
+			Downsample(level, LevelSize(w, l), LevelSize(h, l), channels, next);
+			level.swap(next);
+		}
+	}
+	return true;
+}
+
+static bool CookFile(const std::string& path, const std::string& cachePath, long long sourceSize)
+{
+	PROFILE_SCOPE("Cook Mips", path.c_str());
+
+	FILE* file = fopen(cachePath.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool ok = CookLevels(path, [&](int l, int w, int h, int c, int levels, const std::vector<unsigned char>& pixels)
+	{
+		if (l == 0)
+		{
+			fwrite(mipMagic, 1, sizeof(mipMagic), file);
+			fwrite(&mipVersion, sizeof(mipVersion), 1, file);
+			fwrite(&sourceSize, sizeof(sourceSize), 1, file);
+			int header[4] = { w, h, c, levels };
+			fwrite(header, sizeof(int), 4, file);
+		}
+		return fwrite(&pixels[0], 1, pixels.size(), file) == pixels.size();
+	});
+
+	fclose(file);
+	if (!ok)
+		remove(cachePath.c_str());
+	return ok;
+}
+
+TextureStreamer::TextureStreamer()
+{
+	budget = 256 * 1024 * 1024;
+	uploadPerFrame = 16 * 1024 * 1024;
+	resident = 0;
+	pending = 0;
+	stopping = false;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	StopWorker();
+}
+
+GLuint TextureStreamer::Load(const char* path)
+{
+	PROFILE_SCOPE("Texture Load", path);
+
+	if (!worker.joinable())
+	{
+		stopping = false;
+		worker = std::thread(&TextureStreamer::Run, this);
+	}
+
+	Texture texture = {};
+	texture.path = path;
+	texture.loadingLevel = -1;
+
+	// A single grey texel to draw with until the small mips arrive
+	const unsigned char grey[3] = { 128, 128, 128 };
+	texture.id.Create(MEMORY_STREAMED);
+	GLState::BindTexture(GL_TEXTURE_2D, texture.id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, grey);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	GLState::BindTexture(GL_TEXTURE_2D, GL_NONE);
+
+	texture.bytes = sizeof(grey);
+	texture.id.SetBytes(texture.bytes);
+	GpuMemory::SetEvictable(texture.id, EvictLevel, this);
+
+	GLuint id = texture.id;
+	int index = (int)textures.size();
+	textures.push_back(std::move(texture));
+	lookup[id] = index;
+
+	Job job = { index, -1, textures[index].path };
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	wake.notify_one();
+
+	return id;
+}
+
+void TextureStreamer::Require(GLuint texture, float screenPixels)
+{
+	std::map<GLuint, int>::iterator it = lookup.find(texture);
+	if (it != lookup.end())
+		textures[it->second].needPixels = std::max(textures[it->second].needPixels, screenPixels);
+}
+
+int TextureStreamer::PendingLoads() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return (int)(jobs.size() + results.size());
+}
+
+size_t TextureStreamer::LevelBytes(const Texture& texture, int level) const
+{
+	// DXT1 is 8 bytes per 4x4 block, DXT5 16
+	size_t blocks = (size_t)((LevelSize(texture.width, level) + 3) / 4) * ((LevelSize(texture.height, level) + 3) / 4);
+	return blocks * (texture.channels == 4 ? 16 : 8);
+}
+
+float TextureStreamer::Score(const Texture& texture, int level) const
+{
+	// Screen pixels per texel across the width, above 1 the level is still adding detail
+	return texture.needPixels / LevelSize(texture.width, level);
+}
+
+void TextureStreamer::Upload(Texture& texture, const Result& result)
+{
+	PROFILE_SCOPE("Texture Upload", texture.path.c_str());
+
+	GLenum internal = result.channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	GLenum format = result.channels == 4 ? GL_RGBA : GL_RGB;
+
+	GLState::BindTexture(GL_TEXTURE_2D, texture.id);
+	if (texture.levels == 0)
+	{
+		// First the small mips, which replace the placeholder
+		texture.width = result.width;
+		texture.height = result.height;
+		texture.channels = result.channels;
+		texture.levels = result.levels;
+		texture.tailLevel = result.first;
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, result.first);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, 0, 0, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+		texture.bytes = 0;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	}
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for (int i = 0; i < (int)result.pixels.size(); i++)
+	{
+		int level = result.first + i;
+		glTexImage2D(GL_TEXTURE_2D, level, internal, LevelSize(texture.width, level), LevelSize(texture.height, level), 0,
+			format, GL_UNSIGNED_BYTE, &result.pixels[i][0]);
+		resident += LevelBytes(texture, level);
+		texture.bytes += LevelBytes(texture, level);
+	}
+	texture.id.SetBytes(texture.bytes);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	// Sampling only moves up to the new level once it's all there
+	texture.baseLevel = result.first;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.baseLevel);
+	GLState::BindTexture(GL_TEXTURE_2D, GL_NONE);
+}
+
+void TextureStreamer::Evict(Texture& texture)
+{
+	// Stop sampling the level before freeing it, a zero sized image gives the memory back
+	int level = texture.baseLevel++;
+	GLenum internal = texture.channels == 4 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+
+	GLState::BindTexture(GL_TEXTURE_2D, texture.id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.baseLevel);
+	glTexImage2D(GL_TEXTURE_2D, level, internal, 0, 0, 0, texture.channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	GLState::BindTexture(GL_TEXTURE_2D, GL_NONE);
+
+	resident -= LevelBytes(texture, level);
+	texture.bytes -= LevelBytes(texture, level);
+	texture.id.SetBytes(texture.bytes);
+}
+
+size_t TextureStreamer::EvictLevel(GLuint id, void* owner)
+{
+	TextureStreamer* streamer = (TextureStreamer*)owner;
+	std::map<GLuint, int>::iterator it = streamer->lookup.find(id);
+	if (it == streamer->lookup.end())
+		return 0;
+
+	// The tail always stays, and a level on its way in is dropped when it lands anyway
+	Texture& texture = streamer->textures[it->second];
+	if (texture.levels == 0 || texture.baseLevel >= texture.tailLevel)
+		return 0;
+
+	size_t bytes = streamer->LevelBytes(texture, texture.baseLevel);
+	streamer->Evict(texture);
+	return bytes;
+}
+
+void TextureStreamer::Update()
+{
+	//------------------------------------------------------------------------------------------------ Uploads
+
+	size_t uploaded = 0;
+	while (uploaded < uploadPerFrame)
+	{
+		Result result;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (results.empty())
+				break;
+			result = std::move(results.front());
+			results.pop_front();
+		}
+
+		Texture& texture = textures[result.texture];
+		if (texture.levels > 0)
+		{
+			pending -= LevelBytes(texture, texture.loadingLevel);
+			texture.loadingLevel = -1;
+
+			// It may have been evicted past, or stopped being wanted, while it loaded
+			if (result.pixels.empty() || result.first != texture.baseLevel - 1)
+				continue;
+		}
+		else if (result.pixels.empty())
+			continue;
+
+		Upload(texture, result);
+		for (int i = 0; i < (int)result.pixels.size(); i++)
+			uploaded += result.pixels[i].size();
+	}
+
+	//------------------------------------------------------------------------------------------------ Evictions
+
+	// Wanted level is the smallest one that still has at least a texel per pixel
+	ArenaVector<int> wanted(textures.size(), 0, Arena::Frame());
+	for (int i = 0; i < (int)textures.size(); i++)
+	{
+		Texture& texture = textures[i];
+		if (texture.levels == 0)
+			continue;
+
+		wanted[i] = texture.tailLevel;
+		if (texture.needPixels > 0.0f)
+			wanted[i] = std::max(0, std::min(texture.tailLevel, (int)floor(log2(texture.width / texture.needPixels))));
+
+		// One level of slack so a body sitting on the edge doesn't bounce between two
+		while (texture.baseLevel < wanted[i] - 1)
+			Evict(texture);
+	}
+
+	// Over budget, the most over-resolved texture on screen gives up a level first
+	while (resident > budget)
+	{
+		int victim = -1;
+		for (int i = 0; i < (int)textures.size(); i++)
+		{
+			const Texture& t = textures[i];
+			if (t.levels > 0 && t.baseLevel < t.tailLevel && (victim < 0 || Score(t, t.baseLevel) < Score(textures[victim], textures[victim].baseLevel)))
+				victim = i;
+		}
+		if (victim < 0)
+			break;
+		Evict(textures[victim]);
+	}
+
+	//------------------------------------------------------------------------------------------------ Requests
+
+	// One level at a time per texture, each one only if the budget takes it, possibly by evicting
+	// a level that's doing less on screen than this one would
+	for (int i = 0; i < (int)textures.size(); i++)
+	{
+		Texture& texture = textures[i];
+		if (texture.levels == 0 || texture.loadingLevel >= 0 || texture.baseLevel <= wanted[i])
+			continue;
+
+		int level = texture.baseLevel - 1;
+		size_t bytes = LevelBytes(texture, level);
+		float score = Score(texture, level);
+		while (resident + pending + bytes > budget)
+		{
+			int victim = -1;
+			for (int j = 0; j < (int)textures.size(); j++)
+			{
+				const Texture& t = textures[j];
+				if (j != i && t.levels > 0 && t.baseLevel < t.tailLevel && Score(t, t.baseLevel) < score
+					&& (victim < 0 || Score(t, t.baseLevel) < Score(textures[victim], textures[victim].baseLevel)))
+					victim = j;
+			}
+			if (victim < 0)
+				break;
+			Evict(textures[victim]);
+		}
+		if (resident + pending + bytes > budget)
+			continue;
+
+		texture.loadingLevel = level;
+		pending += bytes;
+
+		Job job = { i, level, texture.path };
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(job);
+		}
+		wake.notify_one();
+	}
+
+	for (int i = 0; i < (int)textures.size(); i++)
+		textures[i].needPixels = 0.0f;
+}
+
+void TextureStreamer::StopWorker()
+{
+	if (!worker.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_one();
+	worker.join();
+}
+
+void TextureStreamer::Cleanup()
+{
+	StopWorker();
+
+	textures.clear();
+	lookup.clear();
+	jobs.clear();
+	results.clear();
+	resident = pending = 0;
+}
+
+void TextureStreamer::Run()
+{
+	Profiler::SetThreadName("Texture Streaming");
+	for (;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+			if (stopping)
+				return;
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		Result result;
+		result.texture = job.texture;
+		if (!ReadLevels(job, result))
+			result.pixels.clear();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		results.push_back(std::move(result));
+	}
+}
+
+bool TextureStreamer::ReadLevels(const Job& job, Result& result)
+{
+	PROFILE_SCOPE(job.level < 0 ? "Read Small Mips" : "Read Mip Level", job.path.c_str());
+
+	std::string cachePath = job.path + ".mips";
+	long long sourceSize = FileSize(job.path.c_str());
+
+	// Cook the levels out on first use, or again when the source has changed size
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		FILE* file = fopen(cachePath.c_str(), "rb");
+		if (file)
+		{
+			char magic[4];
+			unsigned int version = 0;
+			long long cookedSize = 0;
+			int header[4];
+			bool ok = fread(magic, 1, 4, file) == 4 && std::equal(magic, magic + 4, mipMagic)
+				&& fread(&version, sizeof(version), 1, file) == 1 && version == mipVersion
+				&& fread(&cookedSize, sizeof(cookedSize), 1, file) == 1 && cookedSize == sourceSize
+				&& fread(header, sizeof(int), 4, file) == 4;
+
+			if (ok)
+			{
+				result.width = header[0];
+				result.height = header[1];
+				result.channels = header[2];
+				result.levels = header[3];
+
+				int first = job.level >= 0 ? job.level : TailLevel(result.width, result.height, result.levels);
+				int last = job.level >= 0 ? job.level : result.levels - 1;
+
+				long offset = mipHeaderSize;
+				for (int l = 0; l < first; l++)
+					offset += LevelSize(result.width, l) * LevelSize(result.height, l) * result.channels;
+				fseek(file, offset, SEEK_SET);
+
+				result.first = first;
+				result.pixels.resize(last - first + 1);
+				for (int l = first; l <= last && ok; l++)
+				{
+					std::vector<unsigned char>& pixels = result.pixels[l - first];
+					pixels.resize(LevelSize(result.width, l) * LevelSize(result.height, l) * result.channels);
+					ok = fread(&pixels[0], 1, pixels.size(), file) == pixels.size();
+				}
+			}
+			fclose(file);
+			if (ok)
+				return true;
+		}
+
+		if (attempt == 0 && !CookFile(job.path, cachePath, sourceSize))
+			break;
+	}
+
+	// Nowhere to write the cooked levels, so decode the source for just the ones asked for
+	int first = -1;
+	bool found = CookLevels(job.path, [&](int l, int w, int h, int c, int levels, const std::vector<unsigned char>& pixels)
+	{
+		if (first < 0)
+		{
+			first = job.level >= 0 ? job.level : TailLevel(w, h, levels);
+			result.width = w;
+			result.height = h;
+			result.channels = c;
+			result.levels = levels;
+			result.first = first;
+		}
+		if (l >= first && (job.level < 0 || l == job.level))
+			result.pixels.push_back(pixels);
+		return job.level < 0 || l < job.level;
+	});
+	return !result.pixels.empty() && (found || job.level >= 0);
+}
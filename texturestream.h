@@ -0,0 +1,101 @@
+/**************************************************
+ *
+ *                 TextureStream.h
+ *
+ *  Planet textures that start out with only their
+ *  small mips and stream detail in and out on a
+ *  worker thread, under a VRAM budget.
+ *
+ ***************************************************/
+
+#ifndef TEXTURESTREAM_H
+#define TEXTURESTREAM_H
+
+#include <GL/gl3w.h>
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "gpumemory.h"
+
+class TextureStreamer
+{
+public:
+    TextureStreamer();
+    ~TextureStreamer();
+
+    // Hands the texture back straight away. It's a grey texel until the worker has the small mips ready
+    GLuint Load(const char* path);
+
+    // How many pixels of screen the texture's full width covers this frame, the largest call wins
+    void Require(GLuint texture, float screenPixels);
+
+    // Uploads what the worker finished, evicts down to the budget and queues the next loads
+    void Update();
+    void Cleanup();
+
+    size_t budget;                  // Bytes the streamed levels may take up on the GPU, set from GpuMemory's every frame
+    size_t uploadPerFrame;          // Bytes we'll upload in one frame before leaving the rest for later
+
+    size_t ResidentBytes() const { return resident; }
+    int PendingLoads() const;
+
+private:
+    struct Texture
+    {
+        TextureHandle id;
+        std::string path;
+        int width, height, channels, levels;    // Zero until the small mips come in
+        int tailLevel;                          // Smallest levels that always stay resident start here
+        int baseLevel;                          // Most detailed level on the GPU
+        int loadingLevel;                       // Level the worker is on, -1 for none
+        float needPixels;
+        size_t bytes;                           // Levels on the GPU, as told to GpuMemory
+    };
+
+    // A run of levels [first, first + pixels.size()) of one texture, read off disk by the worker
+    struct Result
+    {
+        int texture;
+        int width, height, channels, levels;
+        int first;
+        std::vector<std::vector<unsigned char> > pixels;
+    };
+
+    struct Job
+    {
+        int texture;
+        int level;                              // -1 for the small mips
+        std::string path;
+    };
+
+    void Run();
+    void StopWorker();
+    bool ReadLevels(const Job& job, Result& result);
+    void Upload(Texture& texture, const Result& result);
+    void Evict(Texture& texture);
+
+    // GpuMemory's way in when it's over budget, gives up one level of a texture that hasn't been drawn lately
+    static size_t EvictLevel(GLuint texture, void* owner);
+
+    size_t LevelBytes(const Texture& texture, int level) const;
+    float Score(const Texture& texture, int level) const;
+
+    std::vector<Texture> textures;
+    std::map<GLuint, int> lookup;
+    size_t resident, pending;
+
+    std::thread worker;
+    mutable std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Job> jobs;
+    std::deque<Result> results;
+    bool stopping;
+};
+
+#endif
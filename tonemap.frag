@@ -0,0 +1,24 @@
+#version 400
+
+in vec2 texcoord;
+
+out vec4 frag_colour;
+
+uniform sampler2D sceneTex;
+uniform sampler2D bloomTex;
+uniform float exposure;
+uniform float bloomStrength;
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 ACESFilm(vec3 x)
+{
+	return clamp((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 0.0f, 1.0f);
+}
+
+void main()
+{
+	vec3 hdr = texture(sceneTex, texcoord).rgb;
+	hdr += texture(bloomTex, texcoord).rgb * bloomStrength;
+
+	frag_colour = vec4(ACESFilm(hdr * exposure), 1.0f);
+}
@@ -0,0 +1,105 @@
+/*****************************************
+ *
+ *           Transform.cpp
+ *
+ *  Flat transform hierarchy with dirty
+ *  flags and a single batched pass that
+ *  derives world and normal matrices.
+ *
+ ****************************************/
+
+#include "transform.h"
+
+#include <GLM/gtc/matrix_transform.hpp>
+
+#include <assert.h>
+#include <algorithm>
+
+int TransformGraph::AddNode(int parentNode)
+{
+	int node = (int)parent.size();
+	assert(parentNode < node);
+
+	parent.push_back(parentNode);
+	dirty.push_back(1);
+	translation.push_back(glm::vec3(0.0f));
+	rotation.push_back(glm::mat3(1.0f));
+	scale.push_back(glm::vec3(1.0f));
+	world.push_back(glm::mat4(1.0f));
+	normal.push_back(glm::mat4(1.0f));
+
+	return node;
+}
+
+void TransformGraph::SetTranslation(int node, const glm::vec3& t)
+{
+	if (translation[node] == t)
+		return;
+	translation[node] = t;
+	dirty[node] = 1;
+}
+
+void TransformGraph::SetRotation(int node, float angle, const glm::vec3& axis)
+{
+	glm::mat3 r = glm::mat3(glm::rotate(glm::mat4(1.0f), angle, axis));
+	if (rotation[node][0] == r[0] && rotation[node][1] == r[1] && rotation[node][2] == r[2])
+		return;
+	rotation[node] = r;
+	dirty[node] = 1;
+}
+
+void TransformGraph::SetScale(int node, const glm::vec3& s)
+{
+	if (scale[node] == s)
+		return;
+	scale[node] = s;
+	dirty[node] = 1;
+}
+
+void TransformGraph::UpdateWorld()
+{
+	const int count = (int)parent.size();
+
+	for (int i = 0; i < count; i++)
+	{
+		int p = parent[i];
+
+		// Parents are always earlier in the arrays, so a dirty parent has already been
+		// resolved by the time we get here and its whole subtree gets picked up in this pass
+		if (p >= 0 && dirty[p])
+			dirty[i] = 1;
+		if (!dirty[i])
+			continue;
+
+		const glm::mat3& r = rotation[i];
+		const glm::vec3& s = scale[i];
+
+		// Local matrix is T * R * S, written out by column
+		glm::mat4 local(
+			glm::vec4(r[0] * s.x, 0.0f),
+			glm::vec4(r[1] * s.y, 0.0f),
+			glm::vec4(r[2] * s.z, 0.0f),
+			glm::vec4(translation[i], 1.0f));
+
+		// transpose(inverse(T * R * S)) only needs R * S^-1 for normals, so there's no general
+		// 4x4 inverse. A zero scale (hidden body) gives a zero normal matrix instead of a NaN
+		glm::vec3 inv(
+			s.x != 0.0f ? 1.0f / s.x : 0.0f,
+			s.y != 0.0f ? 1.0f / s.y : 0.0f,
+			s.z != 0.0f ? 1.0f / s.z : 0.0f);
+		glm::mat3 localNormal(r[0] * inv.x, r[1] * inv.y, r[2] * inv.z);
+
+		if (p < 0)
+		{
+			world[i] = local;
+			normal[i] = glm::mat4(localNormal);
+		}
+		else
+		{
+			world[i] = world[p] * local;
+			normal[i] = glm::mat4(glm::mat3(normal[p]) * localNormal);
+		}
+	}
+
+	std::fill(dirty.begin(), dirty.end(), 0);
+}
@@ -0,0 +1,50 @@
+/**************************************************
+ *
+ *                 Transform.h
+ *
+ *  Parent/child transform graph stored in flat
+ *  arrays, parents always before their children.
+ *
+ ***************************************************/
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <GLM/glm.hpp>
+
+#include <vector>
+
+class TransformGraph
+{
+public:
+    // Parents have to be added before their children (-1 for a root), which keeps the arrays parent-first
+    int AddNode(int parent);
+
+    // Setters only mark the node dirty when the value actually changes
+    void SetTranslation(int node, const glm::vec3& translation);
+    void SetRotation(int node, float angle, const glm::vec3& axis);
+    void SetScale(int node, const glm::vec3& scale);
+
+    // Derives world and normal matrices for every dirty node and its children in one pass
+    void UpdateWorld();
+
+    const glm::mat4& World(int node) const { return world[node]; }
+    const glm::mat4& Normal(int node) const { return normal[node]; }
+    glm::vec3 WorldPosition(int node) const { return glm::vec3(world[node][3]); }
+    int Count() const { return (int)parent.size(); }
+
+private:
+    std::vector<int> parent;
+    std::vector<unsigned char> dirty;
+
+    // Local transforms
+    std::vector<glm::vec3> translation;
+    std::vector<glm::mat3> rotation;
+    std::vector<glm::vec3> scale;
+
+    // Derived transforms
+    std::vector<glm::mat4> world;
+    std::vector<glm::mat4> normal;
+};
+
+#endif
@@ -0,0 +1,55 @@
+/**************************************************
+ *
+ *                 TripleBuffer.h
+ *
+ *  Lock-free single producer / single consumer
+ *  handoff. The writer never waits for the reader
+ *  and the reader always gets the newest finished
+ *  slot without blocking.
+ *
+ ***************************************************/
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+template <class T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : front(0), middle(1), back(2) {}
+
+    // Writer side: fill WriteBuffer(), then Publish() swaps it into the middle slot
+    T& WriteBuffer() { return slots[back]; }
+    void Publish()
+    {
+        back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // Reader side: Fetch() takes the middle slot if something new was published since last time
+    bool Fetch()
+    {
+        if (!(middle.load(std::memory_order_acquire) & freshBit))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+        return true;
+    }
+    const T& ReadBuffer() const { return slots[front]; }
+
+    // Only safe while nobody else is using the buffer
+    void Fill(const T& value)
+    {
+        slots[0] = slots[1] = slots[2] = value;
+    }
+
+private:
+    enum { indexMask = 3, freshBit = 4 };
+
+    T slots[3];
+    int front;                  // Owned by the reader
+    std::atomic<int> middle;    // Shared, index plus the fresh bit
+    int back;                   // Owned by the writer
+};
+
+#endif